@@ -0,0 +1,128 @@
+#include "application.h"
+#include "HostLcd.h"
+
+#include <LiquidCrystal.h>
+#include <LocalTimeRK.h>
+#include "../src/PublishOutbox.h"
+#include "../src/LcdFramebuffer.h"
+#include "../src/LcdWriter.h"
+
+// Counts the LocalTimeConvert conversions and bytes sent to the LCD per simulated hour for the loop() in version 1.00 of
+// the firmware, which converted and redrew everything every 100 ms, and for the current
+// event-driven loop(). Both hours include the four evening events, so both should queue 4 events.
+//
+// make && TZ=UTC ./ConversionCount
+
+// From Event_Timer_Firmware.cpp
+extern LiquidCrystal lcd;
+extern LcdFramebuffer display;
+extern LcdWriter lcdWriter;
+extern LocalTimeScheduleManager MNScheduleManager;
+extern PublishOutbox outbox;
+int simulateSensor(const char *sensorNum);
+void setup();
+void loop();
+
+// Time Device OS takes between calls to loop()
+const uint64_t LOOP_OVERHEAD_MICROS = 1000;
+
+// loop() from version 1.00
+void legacyLoop() {
+
+    // display the date and time on the lcd
+    LocalTimeConvert conv;
+    conv.withCurrentTime().convert();
+
+    // set the DST indicator LED
+    if(conv.isDST()) {
+        digitalWrite(D19, HIGH);
+    } else {
+        digitalWrite(D19, LOW);
+    }
+
+    String msg;
+    // first line of display is the date
+    msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
+    lcd.setCursor(0,0);
+    lcd.print(msg);
+
+    time_t earliestTime = 0;
+    // for each schedule in the schedule manager, check if there is an event for now
+    MNScheduleManager.forEach([&](LocalTimeSchedule &schedule) {
+        if (schedule.isScheduledTime()) {
+            // Publish event if scheduled time
+            String temp = schedule.name;
+            simulateSensor(temp.c_str());
+
+            // flash the indicator LED briefly
+            digitalWrite(D18, HIGH);
+            delay(200);
+            digitalWrite(D18, LOW);
+        }
+
+        // Get next scheduled event time for display on the second line of the LCD
+        conv.withCurrentTime().convert();   // set conv with the current time for next scheduled event
+        schedule.getNextScheduledTime(conv);    // update he conv object with the next scheduled time
+        time_t nextTime = conv.time;       // converts conv to a time type
+        if(earliestTime == 0) {
+            earliestTime = nextTime;
+        } else if(nextTime < earliestTime) {
+            earliestTime = nextTime;
+        }
+    });
+
+    // second line of the display is the time
+    conv.withTime(earliestTime).convert();
+    msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
+    lcd.setCursor(0,1);
+    lcd.print(msg);
+
+    delay(100);     // wait a bit before looping back
+
+} // end of legacyLoop()
+
+// Model of the LCD, to count the bytes sent to it
+HostLcd panel(D11, 255, D12, D13, D14, D5, D6);
+
+// loop(), then the work the LCD thread does while loop() is idle on the device
+void eventDrivenLoop() {
+    loop();
+    lcdWriter.service();
+}
+
+// Runs loopFn from start (UTC) for one simulated hour and prints the number of conversions
+void runHour(const char *title, void (*loopFn)(), const char *startStr) {
+    HostDevice &device = HostDevice::instance();
+    // a cloud time sync, so the firmware's holdover clock steps to the new time
+    device.syncTime(LocalTime::stringToTime(startStr));
+    outbox.clear();
+    uint32_t startEvents = outbox.getStats().enqueued;
+    display.invalidate();
+    panel.clearCounts();
+
+    time_t end = device.getTime() + 3600;
+    uint32_t startCount = LocalTimeConvert::convertCount;
+    uint32_t loops = 0;
+
+    while(device.getTime() < end) {
+        loopFn();
+        device.advanceMicros(LOOP_OVERHEAD_MICROS);
+        loops++;
+    }
+
+    printf("%-16s %10u conversions/hour %10u LCD bytes/hour %10u loops %3u events\n", title,
+        (unsigned)(LocalTimeConvert::convertCount - startCount), (unsigned)(panel.commandCount + panel.dataCount),
+        (unsigned)loops, (unsigned)(outbox.getStats().enqueued - startEvents));
+}
+
+int main(int argc, char *argv[]) {
+    HostDevice::instance().setTime(LocalTime::stringToTime("2022-07-01 18:00:00"));
+    setup();
+    loop();     // the first loop() validates and resumes the schedules, once, so it's not counted
+
+    // 9:15 PM to 10:15 PM PDT on two consecutive days
+    runHour("version 1.00", legacyLoop, "2022-07-02 04:15:00");
+    runHour("event-driven", eventDrivenLoop, "2022-07-03 04:15:00");
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "HostTest.h"
+#include "alloc_counter.h"
+
+#include "../src/EventPayload.h"
+
+#include <climits>
+
+// Tests EventPayload, including that it does not allocate memory
+//
+// make && ./EventPayloadTest
+
+// The longest expansion of a template literal can be checked at compile time
+static_assert(EventPayload::maxLength("abc") == 3, "");
+static_assert(EventPayload::maxLength("{{") == 1, "");
+static_assert(EventPayload::maxLength("n={name}") == 2 + EventPayload::MAX_NAME_LEN, "");
+static_assert(EventPayload::maxLength("{time:%H:%M} {late}") == EventPayload::MAX_TIME_LEN + 1 + EventPayload::MAX_INT_LEN, "");
+static_assert(EventPayload::maxLength("+-{uncertainty}ms") == 4 + EventPayload::MAX_INT_LEN, "");
+
+void testEventPayload() {
+	struct tm localTime = {};
+	localTime.tm_year = 2025 - 1900;
+	localTime.tm_mon = 7;
+	localTime.tm_mday = 25;
+	localTime.tm_hour = 21;
+	localTime.tm_min = 30;
+	localTime.tm_sec = 2;
+
+	// Same format as the String concatenation it replaces
+	{
+		char buf[EventPayload::MAX_LOG_MESSAGE_LEN + 1];
+		AllocCounter counter;
+		size_t len = EventPayload::formatLogMessage(buf, "EventTimer", 13, "dummyPayload", 0, 0);
+		assertInt("", (int)counter.getAllocations(), 0);
+		assertStr("", buf, "message=EventTimer|deviceNum=13|payload=dummyPayload|SNRhub1=0|RSSIHub1=0");
+		assertInt("", (int)len, (int)strlen(buf));
+
+		// Longest possible message fits
+		char message[EventPayload::MAX_MESSAGE_LEN + 10];
+		memset(message, 'm', sizeof(message) - 1);
+		message[sizeof(message) - 1] = 0;
+		char payload[EventPayload::MAX_PAYLOAD_LEN + 10];
+		memset(payload, 'p', sizeof(payload) - 1);
+		payload[sizeof(payload) - 1] = 0;
+		len = EventPayload::formatLogMessage(buf, message, INT_MIN, payload, INT_MIN, INT_MIN);
+		assertInt("", (int)len, (int)EventPayload::MAX_LOG_MESSAGE_LEN);
+		assertInt("", (int)strlen(buf), (int)EventPayload::MAX_LOG_MESSAGE_LEN);
+
+		// Runtime sized buffer is truncated
+		char small[16];
+		len = EventPayload::formatLogMessage(small, sizeof(small), "EventTimer", 13, "dummyPayload", 0, 0);
+		assertStr("", small, "message=EventTi");
+		assertInt("", (int)len, 15);
+	}
+
+	// Templates
+	{
+		EventPayloadContext context;
+		context.scheduleName = "15";
+		context.localTime = &localTime;
+		context.lateSeconds = 2;
+
+		char buf[128];
+		AllocCounter counter;
+		assertInt("", EventPayload::expand("message=EventTimer|deviceNum={name}|payload=closed {time:%I:%M%p}|late={late}", context, buf, sizeof(buf)), true);
+		assertInt("", (int)counter.getAllocations(), 0);
+		assertStr("", buf, "message=EventTimer|deviceNum=15|payload=closed 09:30PM|late=2");
+
+		assertInt("", EventPayload::expand("{time}", context, buf, sizeof(buf)), true);
+		assertStr("", buf, "08-25 21:30:02");
+
+		context.uncertaintyMs = 2360;
+		assertInt("", EventPayload::expand("holdover:{uncertainty}ms", context, buf, sizeof(buf)), true);
+		assertStr("", buf, "holdover:2360ms");
+
+		assertInt("", EventPayload::expand("{{name} {unknown} {name", context, buf, sizeof(buf)), true);
+		assertStr("", buf, "{name} {unknown} {name");
+
+		assertInt("", EventPayload::expand("{time:%H", context, buf, sizeof(buf)), true);
+		assertStr("", buf, "{time:%H");
+
+		context.localTime = nullptr;
+		assertInt("", EventPayload::expand("[{time}]", context, buf, sizeof(buf)), true);
+		assertStr("", buf, "[]");
+
+		context.scheduleName = "a schedule name longer than the limit";
+		assertInt("", EventPayload::expand("{name}", context, buf, sizeof(buf)), true);
+		assertInt("", (int)strlen(buf), (int)EventPayload::MAX_NAME_LEN);
+
+		context.scheduleName = "15";
+		char small[8];
+		assertInt("", EventPayload::expand("deviceNum={name}", context, small, sizeof(small)), false);
+		assertStr("", small, "deviceN");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testEventPayload();
+	printf("EventPayloadTest passed\n");
+	return 0;
+}
@@ -0,0 +1,323 @@
+#include "application.h"
+#include "HostLcd.h"
+#include "HostTest.h"
+
+#include <LocalTimeRK.h>
+#include "../src/IndicatorEffects.h"
+#include "../src/PublishOutbox.h"
+#include "../src/LcdWriter.h"
+#include "../src/LoopTiming.h"
+
+#include <ctime>
+#include <functional>
+#include <vector>
+
+// Runs the firmware (setup(), loop(), and the work the LCD thread does) on the virtual clock for all
+// of 2023 and checks every event published against the schedules worked out independently, and what
+// the LCD shows when each event is published. Along the way the cloud is disconnected for an evening,
+// and time syncs are slewed and stepped, forwards and backwards. The timing histograms are checked
+// against what happened.
+//
+// make && TZ=UTC ./EventTimerSim
+
+// From Event_Timer_Firmware.cpp
+extern LcdWriter lcdWriter;
+extern LocalTimeScheduleManager MNScheduleManager;
+extern IndicatorEffects indicators;
+extern PublishOutbox outbox;
+extern LoopTiming timing;
+extern char timingJson[];
+void setup();
+void loop();
+
+// Virtual time between calls to loop() while something is happening
+const uint64_t LOOP_MICROS = 10000;
+
+// Longest the simulator skips at once when nothing is happening
+const time_t MAX_SKIP_SECONDS = 3600;
+
+// Start this many seconds before an event when skipping, so the firmware sees it arrive
+const time_t SKIP_MARGIN_SECONDS = 2;
+
+// Latest an event may be published after its scheduled time, normally
+const time_t MAX_LATE_SECONDS = 3;
+
+// The LCD, decoded from the fake GPIO
+HostLcd panel(D11, 255, D12, D13, D14, D5, D6);
+
+/**
+ * @brief An event the firmware should publish, worked out without LocalTimeRK
+ */
+class ExpectedEvent {
+public:
+    time_t time; //!< Scheduled time (UTC)
+    int deviceNum; //!< Schedule name
+    char lcdTime[17]; //!< How the LCD shows it, "%m-%d %I:%M:%S%p"
+};
+
+/**
+ * @brief Something the simulator does to the device at a time
+ */
+class SimAction {
+public:
+    time_t time; //!< Virtual time (UTC) to do it
+    const char *description;
+    std::function<void()> fn;
+};
+
+/**
+ * @brief What the LCD showed when an event was published
+ */
+class PublishedScreen {
+public:
+    String line0;
+    String line1;
+};
+
+// The four closing time events, each evening in Pacific time, for 2023. DST is from March 12 to
+// November 5, so the events are at UTC-7 in between and UTC-8 otherwise.
+std::vector<ExpectedEvent> expectedEvents2023() {
+    static const struct {
+        int deviceNum;
+        int hour;
+        int minute;
+    } schedules[] = {
+        { 13, 21, 30 },
+        { 14, 21, 45 },
+        { 17, 21, 55 },
+        { 15, 22, 0 },
+    };
+
+    std::vector<ExpectedEvent> result;
+    for(int yday = 0; yday < 365; yday++) {
+        struct tm date = {};
+        date.tm_year = 2023 - 1900;
+        date.tm_mon = 0;
+        date.tm_mday = 1 + yday;
+        timegm(&date); // normalizes tm_mon and tm_mday
+
+        bool dst = (date.tm_mon > 2 || (date.tm_mon == 2 && date.tm_mday >= 12)) &&
+            (date.tm_mon < 10 || (date.tm_mon == 10 && date.tm_mday < 5));
+
+        for(size_t ii = 0; ii < sizeof(schedules) / sizeof(schedules[0]); ii++) {
+            struct tm local = date;
+            local.tm_hour = schedules[ii].hour;
+            local.tm_min = schedules[ii].minute;
+            local.tm_sec = 0;
+
+            ExpectedEvent event;
+            event.time = timegm(&local) + (dst ? 7 : 8) * 3600;
+            event.deviceNum = schedules[ii].deviceNum;
+            strftime(event.lcdTime, sizeof(event.lcdTime), "%m-%d %I:%M:%S%p", &local);
+            result.push_back(event);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Runs the firmware on the virtual clock
+ */
+class EventTimerSim {
+public:
+    /**
+     * @brief Boot at start (UTC): the cloud has already synced the time, as it has after a normal power up
+     */
+    void boot(time_t start) {
+        HostDevice &device = HostDevice::instance();
+        device.eraseEeprom();
+        device.advanceMicros(3000000);
+        device.syncTime(start);
+        setup();
+    }
+
+    /**
+     * @brief Run the firmware until end (UTC), doing the actions when their time comes
+     */
+    void runUntil(time_t end) {
+        HostDevice &device = HostDevice::instance();
+
+        while(device.getTime() < end) {
+            loop();
+            lcdWriter.service();
+            loops++;
+
+            if (device.publishes.size() != screens.size()) {
+                // loop() published an event; the LCD thread has drawn the frame loop() posted
+                PublishedScreen screen;
+                screen.line0 = panel.getLine(0);
+                screen.line1 = panel.getLine(1);
+                while(screens.size() < device.publishes.size()) {
+                    screens.push_back(screen);
+                }
+            }
+
+            // The cloud answers a time sync request from the firmware if it's connected
+            if (device.syncTimeRequests != answeredSyncRequests && device.cloudConnected) {
+                answeredSyncRequests = device.syncTimeRequests;
+                device.syncTime(device.getTime());
+                syncs++;
+            }
+
+            time_t now = device.getTime();
+            while(nextAction < actions.size() && actions[nextAction].time <= now) {
+                actions[nextAction++].fn();
+            }
+
+            device.advanceMicros(skipMicros(end));
+        }
+    }
+
+    /**
+     * @brief Virtual time to the next call to loop(): LOOP_MICROS while the firmware has something to
+     * do, or up to the next event, action or MAX_SKIP_SECONDS if it doesn't
+     */
+    uint64_t skipMicros(time_t end) {
+        HostDevice &device = HostDevice::instance();
+        bool busy = !indicators.isIdle() || !lcdWriter.isIdle() ||
+            (device.cloudConnected && (!outbox.isEmpty() || device.syncTimeRequests != answeredSyncRequests));
+        if (busy) {
+            return LOOP_MICROS;
+        }
+
+        time_t now = device.getTime();
+        time_t wake = now + MAX_SKIP_SECONDS;
+        time_t nextEvent = MNScheduleManager.getNextEventTime();
+        if (nextEvent != 0 && nextEvent - SKIP_MARGIN_SECONDS < wake) {
+            wake = nextEvent - SKIP_MARGIN_SECONDS;
+        }
+        if (nextAction < actions.size() && actions[nextAction].time < wake) {
+            wake = actions[nextAction].time;
+        }
+        if (end < wake) {
+            wake = end;
+        }
+        if (wake <= now + 1) {
+            return LOOP_MICROS;
+        }
+        skipped++;
+        return (uint64_t)(wake - now - 1) * 1000000;
+    }
+
+    std::vector<SimAction> actions; //!< In time order
+    size_t nextAction = 0;
+    std::vector<PublishedScreen> screens; //!< For each publish in HostDevice::publishes
+    uint32_t answeredSyncRequests = 0;
+    uint32_t loops = 0;
+    uint32_t skipped = 0;
+    uint32_t syncs = 0;
+};
+
+// Returns true if the event is scheduled from fromStr up to toStr (UTC)
+bool isInWindow(const ExpectedEvent &event, const char *fromStr, const char *toStr) {
+    return event.time >= LocalTime::stringToTime(fromStr) && event.time < LocalTime::stringToTime(toStr);
+}
+
+void runYear() {
+    HostDevice &device = HostDevice::instance();
+    EventTimerSim sim;
+
+    // The cloud is down for one evening; the events are queued and published when it's back
+    const char *outageStart = "2023-06-11 03:00:00"; // 20:00 PDT
+    const char *outageEnd = "2023-06-11 08:00:00";
+    sim.actions.push_back({ LocalTime::stringToTime(outageStart), "cloud disconnected", [&]() {
+        device.cloudConnected = false;
+    }});
+    sim.actions.push_back({ LocalTime::stringToTime(outageEnd), "cloud connected", [&]() {
+        device.cloudConnected = true;
+    }});
+
+    // The cloud finds the clock 40 seconds fast just after the 22:00 event: stepped back, and the
+    // event does not fire again
+    sim.actions.push_back({ LocalTime::stringToTime("2023-08-01 05:00:30"), "sync 40 s back", [&]() {
+        device.syncTime(device.getTime() - 40);
+    }});
+
+    // 3 seconds slow: slewed in
+    sim.actions.push_back({ LocalTime::stringToTime("2023-09-01 04:00:00"), "sync 3 s ahead", [&]() {
+        device.syncTime(device.getTime() + 3);
+    }});
+
+    // 90 seconds slow just before the 21:30 event: stepped forward, and the event fires at once, late
+    const char *catchUpSync = "2023-10-01 04:29:00";
+    sim.actions.push_back({ LocalTime::stringToTime(catchUpSync), "sync 90 s ahead", [&]() {
+        device.syncTime(device.getTime() + 90);
+    }});
+
+    // CPU time: CLOCK_MONOTONIC is the virtual clock
+    clock_t startClock = clock();
+    sim.boot(LocalTime::stringToTime("2023-01-01 08:00:00")); // midnight PST
+    sim.runUntil(LocalTime::stringToTime("2024-01-01 08:00:00"));
+    double seconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    // Every event, in order, once, on time, with what the LCD showed
+    std::vector<ExpectedEvent> expected = expectedEvents2023();
+    assertInt("", (int)device.publishes.size(), (int)expected.size());
+
+    int holdoverEvents = 0;
+    int lateEvents = 0;
+    for(size_t ii = 0; ii < expected.size(); ii++) {
+        const ExpectedEvent &event = expected[ii];
+        const HostPublish &pub = device.publishes[ii];
+        const PublishedScreen &screen = sim.screens[ii];
+
+        char deviceNum[32];
+        snprintf(deviceNum, sizeof(deviceNum), "|deviceNum=%d|", event.deviceNum);
+        assertStr("", pub.eventName.c_str(), "LoRaHubLogging");
+        assertInt("", pub.data.indexOf(deviceNum) > 0, true);
+
+        if (isInWindow(event, outageStart, outageEnd)) {
+            // Fired in holdover, published in order once the cloud was back
+            holdoverEvents++;
+            assertInt("", pub.data.indexOf("|payload=holdover:") > 0, true);
+            assertInt("", pub.time >= LocalTime::stringToTime(outageEnd), true);
+            continue;
+        }
+        assertInt("", pub.data.indexOf("|payload=dummyPayload|") > 0, true);
+
+        time_t maxLate = MAX_LATE_SECONDS;
+        if (isInWindow(event, catchUpSync, "2023-10-01 04:31:00")) {
+            maxLate = 60;
+            lateEvents++;
+        }
+        if (pub.time < event.time || pub.time > event.time + maxLate) {
+            printf("event %d at %s published at %s\n", event.deviceNum, LocalTime::timeToString(event.time).c_str(),
+                LocalTime::timeToString(pub.time).c_str());
+            assertInt("", (int)(pub.time - event.time), 0);
+        }
+
+        // The clock line shows the time the event fired, and the second line the next event
+        assertStr("", screen.line0.substring(0, 11).c_str(), String(event.lcdTime).substring(0, 11).c_str());
+        if (ii + 1 < expected.size()) {
+            assertStr("", screen.line1.c_str(), expected[ii + 1].lcdTime);
+        }
+    }
+    assertInt("", holdoverEvents, 4);
+    assertInt("", lateEvents, 1);
+
+    // Every loop, event and publish is in the histograms. Events fire within MAX_LATE_SECONDS except
+    // the one after the step forward; the holdover events wait hours to be published.
+    assertInt("", (int)timing.loopMicros.getCount(), (int)sim.loops);
+    assertInt("", (int)timing.fireLateMs.getCount(), (int)expected.size());
+    assertInt("", (int)timing.fireLateMs.getMax() <= 60 * 1000, true);
+    assertInt("", (int)(timing.fireLateMs.getCount() - timing.fireLateMs.getBucket(TimingHistogram::BUCKETS - 1)) >= (int)expected.size() - 1, true);
+    assertInt("", (int)timing.publishLatencyMs.getCount(), (int)device.publishes.size());
+    assertInt("", (int)timing.publishLatencyMs.getMax() >= 3 * 3600 * 1000, true);
+    assertInt("", (int)timing.lcdWriteMicros.read().getCount() > 0, true);
+
+    // The cloud variable was refreshed in the last second
+    JSONValue timingObj = JSONValue::parseCopy(timingJson);
+    assertInt("", timingObj.isObject(), true);
+    assertInt("", strstr(timingJson, "\"late_ms\":{\"n\":1460,") != nullptr, true);
+
+    printf("%u events in 2023 checked in %.1f s: %u loops, %u skips, %u time syncs\n",
+        (unsigned)device.publishes.size(), seconds, (unsigned)sim.loops, (unsigned)sim.skipped, (unsigned)sim.syncs);
+    printf("max late %u ms, max publish latency %u ms, max LCD write %u us (virtual time)\n",
+        (unsigned)timing.fireLateMs.getMax(), (unsigned)timing.publishLatencyMs.getMax(), (unsigned)timing.lcdWriteMicros.read().getMax());
+}
+
+int main(int argc, char *argv[]) {
+    runYear();
+    printf("EventTimerSim passed\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "HostDevice.h"
+
+#include <sys/syscall.h>
+
+CloudClass Particle;
+EEPROMClass EEPROM;
+
+HostDevice *HostDevice::_instance;
+
+HostDevice::HostDevice() {
+    memset(pinModes, PIN_MODE_NONE, sizeof(pinModes));
+    memset(pinValues, LOW, sizeof(pinValues));
+    memset(eeprom, 0xff, sizeof(eeprom));
+}
+
+// [static]
+HostDevice &HostDevice::instance() {
+    if (!_instance) {
+        _instance = new HostDevice();
+    }
+    return *_instance;
+}
+
+void HostDevice::setTime(time_t time) {
+    timeAtBoot = time - (time_t)(microsSinceBoot / 1000000);
+}
+
+void HostDevice::syncTime(time_t time) {
+    setTime(time);
+    lastTimeSyncMillis = millis();
+    if (lastTimeSyncMillis == 0) {
+        // 0 means no sync
+        lastTimeSyncMillis = 1;
+    }
+}
+
+void HostDevice::setEepromFile(const char *path) {
+    eepromFile = path;
+    memset(eeprom, 0xff, sizeof(eeprom));
+
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        fread(eeprom, 1, sizeof(eeprom), fp);
+        fclose(fp);
+    }
+}
+
+void HostDevice::eraseEeprom() {
+    memset(eeprom, 0xff, sizeof(eeprom));
+    if (eepromFile.length()) {
+        remove(eepromFile.c_str());
+    }
+}
+
+uint8_t EEPROMClass::read(int address) {
+    if (address < 0 || address >= (int)SIZE) {
+        return 0xff;
+    }
+    return HostDevice::instance().eeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    HostDevice &device = HostDevice::instance();
+    if (address < 0 || address >= (int)SIZE || device.eeprom[address] == value) {
+        return;
+    }
+    device.eeprom[address] = value;
+    device.eepromWrites++;
+
+    if (device.eepromFile.length()) {
+        FILE *fp = fopen(device.eepromFile.c_str(), "wb");
+        if (fp) {
+            fwrite(device.eeprom, 1, sizeof(device.eeprom), fp);
+            fclose(fp);
+        }
+    }
+}
+
+Thread::Thread(const char *name, std::function<void()> function, os_thread_prio_t priority, size_t stackSize) {
+    HostDevice::instance().threadNames.push_back(name);
+}
+
+void os_thread_yield() {
+}
+
+bool CloudClass::connected() {
+    return HostDevice::instance().cloudConnected;
+}
+
+particle::Future<bool> CloudClass::publish(const char *eventName, const String &data, PublishFlags flags) {
+    HostDevice &device = HostDevice::instance();
+
+    HostPublish pub;
+    pub.time = device.getTime();
+    pub.eventName = eventName;
+    pub.data = data;
+    device.publishes.push_back(pub);
+    return particle::Future<bool>(true);
+}
+
+bool CloudClass::syncTime() {
+    HostDevice::instance().syncTimeRequests++;
+    return true;
+}
+
+system_tick_t CloudClass::timeSyncedLast() {
+    return HostDevice::instance().lastTimeSyncMillis;
+}
+
+void pinMode(pin_t pin, PinMode mode) {
+    if (pin < HostDevice::NUM_PINS) {
+        HostDevice::instance().pinModes[pin] = (uint8_t) mode;
+    }
+}
+
+void digitalWrite(pin_t pin, uint8_t value) {
+    HostDevice &device = HostDevice::instance();
+    value = value ? HIGH : LOW;
+
+    if (pin < HostDevice::NUM_PINS) {
+        if (device.recordPins && device.pinValues[pin] != value) {
+            HostPinChange change;
+            change.micros = device.microsSinceBoot;
+            change.pin = pin;
+            change.value = value;
+            device.pinChanges.push_back(change);
+        }
+        device.pinValues[pin] = value;
+    }
+    for(auto it = device.pinListeners.begin(); it != device.pinListeners.end(); ++it) {
+        (*it)->pinWritten(pin, value);
+    }
+}
+
+int32_t digitalRead(pin_t pin) {
+    HostDevice &device = HostDevice::instance();
+
+    int32_t value;
+    for(auto it = device.pinListeners.begin(); it != device.pinListeners.end(); ++it) {
+        if ((*it)->pinRead(pin, value)) {
+            return value;
+        }
+    }
+    if (pin < HostDevice::NUM_PINS) {
+        return device.pinValues[pin];
+    }
+    return LOW;
+}
+
+void delay(unsigned long ms) {
+    HostDevice::instance().advanceMicros((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    HostDevice::instance().advanceMicros(us);
+}
+
+uint32_t micros() {
+    return (uint32_t) HostDevice::instance().microsSinceBoot;
+}
+
+// UnitTestLib implements Time.now() with time() and millis() with clock_gettime(CLOCK_MONOTONIC).
+// These definitions take precedence over the C library so both use the virtual clock.
+extern "C" time_t time(time_t *t) {
+    time_t result = HostDevice::instance().getTime();
+    if (t) {
+        *t = result;
+    }
+    return result;
+}
+
+extern "C" int clock_gettime(clockid_t clockId, struct timespec *ts) {
+    if (clockId == CLOCK_MONOTONIC) {
+        uint64_t us = HostDevice::instance().microsSinceBoot;
+        ts->tv_sec = (time_t)(us / 1000000);
+        ts->tv_nsec = (long)(us % 1000000) * 1000;
+        return 0;
+    }
+    return (int) syscall(SYS_clock_gettime, clockId, ts);
+}
@@ -0,0 +1,299 @@
+#ifndef __HOSTDEVICE_H
+#define __HOSTDEVICE_H
+
+// Fakes for the parts of Device OS used by the Event Timer firmware that UnitTestLib does not
+// provide (GPIO, delay, the cloud), plus a virtual clock. This allows the firmware and the
+// LiquidCrystal library to be built and run on a host computer.
+
+#include "Particle.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#define SYSTEM_MODE(x)
+#define retained
+
+typedef uint16_t pin_t;
+
+typedef enum PinMode {
+    INPUT,
+    OUTPUT,
+    INPUT_PULLUP,
+    INPUT_PULLDOWN,
+    PIN_MODE_NONE = 0xff
+} PinMode;
+
+#define LOW 0
+#define HIGH 1
+
+const pin_t D0 = 0;
+const pin_t D1 = 1;
+const pin_t D2 = 2;
+const pin_t D3 = 3;
+const pin_t D4 = 4;
+const pin_t D5 = 5;
+const pin_t D6 = 6;
+const pin_t D7 = 7;
+const pin_t D8 = 8;
+const pin_t D9 = 9;
+const pin_t D10 = 10;
+const pin_t D11 = 11;
+const pin_t D12 = 12;
+const pin_t D13 = 13;
+const pin_t D14 = 14;
+const pin_t D15 = 15;
+const pin_t D16 = 16;
+const pin_t D17 = 17;
+const pin_t D18 = 18;
+const pin_t D19 = 19;
+
+void pinMode(pin_t pin, PinMode mode);
+void digitalWrite(pin_t pin, uint8_t value);
+int32_t digitalRead(pin_t pin);
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+uint32_t micros();
+
+typedef uint8_t os_thread_prio_t;
+const os_thread_prio_t OS_THREAD_PRIORITY_DEFAULT = 2;
+const size_t OS_THREAD_STACK_SIZE_DEFAULT = 3 * 1024;
+
+void os_thread_yield();
+
+/**
+ * @brief Fake Device OS thread. The function is recorded in HostDevice but not run; the host
+ * programs call the work it would do directly, so the simulation stays single threaded and repeatable.
+ */
+class Thread {
+public:
+    Thread(const char *name, std::function<void()> function, os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT);
+};
+
+namespace particle {
+
+/**
+ * @brief Fake of the Device OS Future returned by Particle.publish(). A Future made with a result is
+ * already done; one from Promise::future() is done when the promise is given a result or an error.
+ *
+ * There is no conversion to the result type, which blocks on a device, so firmware that waits for
+ * a Future doesn't build on the host.
+ */
+template<typename T>
+class Future {
+public:
+    Future() : state(std::make_shared<State>()) {};
+    Future(T result) : Future() { state->done = state->succeeded = true; state->result = result; };
+
+    bool isDone() const { return state->done; };
+    bool isSucceeded() const { return state->done && state->succeeded; };
+    bool isFailed() const { return state->done && !state->succeeded; };
+    T result() const { return state->result; };
+
+protected:
+    struct State {
+        bool done = false;
+        bool succeeded = false;
+        T result = T();
+    };
+    std::shared_ptr<State> state; //!< Shared with the Promise and the copies of this Future
+
+    template<typename> friend class Promise;
+};
+
+/**
+ * @brief Fake of the Device OS Promise, for stand-ins that finish an operation later
+ */
+template<typename T>
+class Promise {
+public:
+    void setResult(T result) { f.state->done = f.state->succeeded = true; f.state->result = result; };
+    void setError() { f.state->done = true; f.state->succeeded = false; };
+    Future<T> future() const { return f; };
+
+protected:
+    Future<T> f;
+};
+
+} // namespace particle
+
+/**
+ * @brief Record of a call to Particle.publish()
+ */
+class HostPublish {
+public:
+    time_t time; //!< Virtual time (UTC) of the publish
+    String eventName; //!< Event name
+    String data; //!< Event data
+};
+
+/**
+ * @brief Record of a change in the value of an output pin
+ */
+class HostPinChange {
+public:
+    uint64_t micros; //!< Virtual microseconds since boot
+    pin_t pin; //!< Pin number
+    uint8_t value; //!< New value, LOW or HIGH
+};
+
+/**
+ * @brief Interface for simulated hardware connected to the fake GPIO, such as an LCD controller
+ */
+class HostPinListener {
+public:
+    virtual ~HostPinListener() {};
+
+    /**
+     * @brief Called after digitalWrite() sets the value of a pin
+     */
+    virtual void pinWritten(pin_t pin, uint8_t value) {};
+
+    /**
+     * @brief Called by digitalRead(). Set value and return true if this hardware is driving the pin.
+     */
+    virtual bool pinRead(pin_t pin, int32_t &value) { return false; };
+};
+
+/**
+ * @brief Fake Particle cloud object. Publishes are recorded in HostDevice.
+ */
+class CloudClass {
+public:
+    bool connected();
+
+    template<class T>
+    bool variable(const char *name, const T &value) { return true; };
+
+    /**
+     * @brief Records the publish in HostDevice. The Future is already done and succeeded.
+     */
+    particle::Future<bool> publish(const char *eventName, const String &data, PublishFlags flags = PublishFlags());
+
+    /**
+     * @brief Counted in HostDevice::syncTimeRequests; the time only changes when the simulator calls HostDevice::syncTime()
+     */
+    bool syncTime();
+
+    /**
+     * @brief millis() value of the last HostDevice::syncTime(), 0 if none
+     */
+    system_tick_t timeSyncedLast();
+};
+extern CloudClass Particle;
+
+/**
+ * @brief Fake emulated EEPROM, kept in HostDevice::eeprom. If HostDevice::setEepromFile() was called,
+ * every write is also saved to the file, so a simulated restart (a new HostDevice or a new process)
+ * sees what was written.
+ */
+class EEPROMClass {
+public:
+    static const size_t SIZE = 4096; //!< Bytes of emulated EEPROM, as on the Photon 2
+
+    size_t length() { return SIZE; };
+
+    uint8_t read(int address);
+
+    void write(int address, uint8_t value);
+
+    template<class T>
+    T &get(int address, T &t) {
+        uint8_t *p = (uint8_t *)&t;
+        for(size_t ii = 0; ii < sizeof(T); ii++) {
+            p[ii] = read(address + ii);
+        }
+        return t;
+    };
+
+    template<class T>
+    const T &put(int address, const T &t) {
+        const uint8_t *p = (const uint8_t *)&t;
+        for(size_t ii = 0; ii < sizeof(T); ii++) {
+            write(address + ii, p[ii]);
+        }
+        return t;
+    };
+};
+extern EEPROMClass EEPROM;
+
+/**
+ * @brief Virtual clock and recorded state of the fake device
+ *
+ * Time.now() and millis() come from the virtual clock, which only moves forward when delay()
+ * or delayMicroseconds() is called or the simulator calls advanceMicros().
+ */
+class HostDevice {
+public:
+    /**
+     * @brief Get the singleton instance of this class
+     */
+    static HostDevice &instance();
+
+    /**
+     * @brief Set the virtual clock to a time (UTC). millis() is not affected.
+     */
+    void setTime(time_t time);
+
+    /**
+     * @brief Simulate the cloud syncing the time: set the virtual clock and record the millis() value for Particle.timeSyncedLast()
+     */
+    void syncTime(time_t time);
+
+    /**
+     * @brief Get the virtual clock (UTC)
+     */
+    time_t getTime() const { return timeAtBoot + (time_t)(microsSinceBoot / 1000000); };
+
+    /**
+     * @brief Move the virtual clock forward
+     */
+    void advanceMicros(uint64_t us) { microsSinceBoot += us; };
+
+    /**
+     * @brief Clear the recorded publishes
+     */
+    void clearPublishes() { publishes.clear(); };
+
+    /**
+     * @brief Start recording changes to the pin values, clearing any previously recorded changes
+     */
+    void startPinRecording() { pinChanges.clear(); recordPins = true; };
+
+    /**
+     * @brief Back the fake EEPROM with a file. The EEPROM is loaded from the file, or erased (0xff)
+     * if the file doesn't exist, and every write is saved to it.
+     */
+    void setEepromFile(const char *path);
+
+    /**
+     * @brief Erase the fake EEPROM (0xff), and its file if there is one
+     */
+    void eraseEeprom();
+
+    static const size_t NUM_PINS = 20; //!< D0 - D19
+
+    uint64_t microsSinceBoot = 0; //!< Virtual microseconds since boot, the basis for millis() and micros()
+    time_t timeAtBoot = 0; //!< Virtual time (UTC) when microsSinceBoot was 0
+    uint8_t pinModes[NUM_PINS]; //!< Last mode set by pinMode()
+    uint8_t pinValues[NUM_PINS]; //!< Last value set by digitalWrite()
+    bool cloudConnected = true; //!< Value returned by Particle.connected()
+    system_tick_t lastTimeSyncMillis = 0; //!< Value returned by Particle.timeSyncedLast()
+    uint32_t syncTimeRequests = 0; //!< Calls to Particle.syncTime()
+    std::vector<HostPublish> publishes; //!< Calls to Particle.publish(), in order
+    bool recordPins = false; //!< True to record changes to pin values in pinChanges
+    std::vector<HostPinChange> pinChanges; //!< Changes to pin values since startPinRecording(), in order
+    std::vector<HostPinListener *> pinListeners; //!< Simulated hardware connected to the pins
+    std::vector<String> threadNames; //!< Names of the Thread objects created
+    uint8_t eeprom[EEPROMClass::SIZE]; //!< Contents of the fake EEPROM
+    String eepromFile; //!< File the fake EEPROM is saved to, empty for none
+    uint32_t eepromWrites = 0; //!< Calls to EEPROM.write() that changed a byte
+
+protected:
+    HostDevice();
+
+    static HostDevice *_instance;
+};
+
+#endif /* __HOSTDEVICE_H */
@@ -0,0 +1,190 @@
+#include "HostLcd.h"
+
+#include <algorithm>
+
+HostLcd::HostLcd(pin_t rs, pin_t rw, pin_t enable, pin_t d4, pin_t d5, pin_t d6, pin_t d7) :
+    rsPin(rs), rwPin(rw), enablePin(enable) {
+    dataPins[0] = d4;
+    dataPins[1] = d5;
+    dataPins[2] = d6;
+    dataPins[3] = d7;
+    memset(ddram, ' ', sizeof(ddram));
+
+    HostDevice::instance().pinListeners.push_back(this);
+}
+
+HostLcd::~HostLcd() {
+    std::vector<HostPinListener *> &listeners = HostDevice::instance().pinListeners;
+    listeners.erase(std::remove(listeners.begin(), listeners.end(), this), listeners.end());
+}
+
+const char *HostLcd::getLine(uint8_t row) {
+    memcpy(lineBuf, &ddram[row ? 0x40 : 0x00], COLS);
+    lineBuf[COLS] = 0;
+    return lineBuf;
+}
+
+void HostLcd::pinWritten(pin_t pin, uint8_t value) {
+    if (pin != enablePin) {
+        return;
+    }
+    uint8_t prev = lastEnable;
+    lastEnable = value;
+    if (prev != HIGH || value != LOW) {
+        return;
+    }
+
+    // Falling edge of EN latches the data pins
+    HostDevice &device = HostDevice::instance();
+    if (rwPin != 255 && device.pinValues[rwPin] == HIGH) {
+        // End of a read cycle; in 4-bit mode the second nibble is the low half
+        if (fourBitMode) {
+            readLowNibble = !readLowNibble;
+        }
+        if (!readLowNibble) {
+            busyReads++;
+        }
+        return;
+    }
+    readLowNibble = false;
+
+    if (isBusy()) {
+        busyViolations++;
+        return;
+    }
+    uint8_t nibble = 0;
+    for(int ii = 0; ii < 4; ii++) {
+        if (device.pinValues[dataPins[ii]] == HIGH) {
+            nibble |= (1 << ii);
+        }
+    }
+    bool isData = (device.pinValues[rsPin] == HIGH);
+
+    if (!fourBitMode) {
+        // 8-bit interface with D0-D3 not connected (read as 0)
+        execute((uint8_t)(nibble << 4), isData);
+    }
+    else
+    if (!haveHighNibble) {
+        highNibble = nibble;
+        haveHighNibble = true;
+    }
+    else {
+        haveHighNibble = false;
+        execute((uint8_t)((highNibble << 4) | nibble), isData);
+    }
+}
+
+bool HostLcd::pinRead(pin_t pin, int32_t &value) {
+    HostDevice &device = HostDevice::instance();
+    if (rwPin == 255 || device.pinValues[rwPin] != HIGH || device.pinValues[rsPin] != LOW || device.pinValues[enablePin] != HIGH) {
+        return false;
+    }
+    for(int ii = 0; ii < 4; ii++) {
+        if (pin == dataPins[ii]) {
+            // Busy flag and address counter: DB7 = BF, DB6-DB0 = AC
+            uint8_t status = (isBusy() ? 0x80 : 0x00) | (address & 0x7f);
+            uint8_t nibble = readLowNibble ? (status & 0x0f) : (status >> 4);
+            value = (nibble >> ii) & 0x01;
+            return true;
+        }
+    }
+    return false;
+}
+
+void HostLcd::execute(uint8_t value, bool isData) {
+    if (recordInstructions) {
+        HostLcdInstruction instruction;
+        instruction.micros = HostDevice::instance().microsSinceBoot;
+        instruction.value = value;
+        instruction.isData = isData;
+        instructions.push_back(instruction);
+    }
+
+    // Clear display and return home take longer than the rest
+    uint64_t now = HostDevice::instance().microsSinceBoot;
+    busyUntil = now + ((!isData && value != 0 && value < 0x04) ? clearUs : commandUs);
+
+    if (isData) {
+        dataCount++;
+        ddram[address & 0x7f] = value;
+    }
+    else {
+        commandCount++;
+        if (value & 0x80) {
+            // Set DDRAM address
+            address = value & 0x7f;
+            return;
+        }
+        else
+        if (value & 0x40) {
+            // Set CGRAM address; characters written after this are not modeled
+            return;
+        }
+        else
+        if (value & 0x20) {
+            // Function set
+            fourBitMode = ((value & 0x10) == 0);
+            haveHighNibble = false;
+            return;
+        }
+        else
+        if (value & 0x10) {
+            // Cursor or display shift, not modeled
+            return;
+        }
+        else
+        if (value & 0x08) {
+            // Display on/off control
+            return;
+        }
+        else
+        if (value & 0x04) {
+            // Entry mode set
+            increment = ((value & 0x02) != 0);
+            return;
+        }
+        else
+        if (value & 0x02) {
+            // Return home
+            address = 0;
+            return;
+        }
+        else
+        if (value & 0x01) {
+            // Clear display
+            memset(ddram, ' ', sizeof(ddram));
+            address = 0;
+            increment = true;
+            return;
+        }
+        return;
+    }
+
+    // Address counter moves after a data write. In 2-line mode each line has 40 addresses and
+    // the end of one line wraps to the start of the other.
+    if (increment) {
+        if (address == 0x27) {
+            address = 0x40;
+        }
+        else
+        if (address == 0x67) {
+            address = 0x00;
+        }
+        else {
+            address++;
+        }
+    }
+    else {
+        if (address == 0x00) {
+            address = 0x67;
+        }
+        else
+        if (address == 0x40) {
+            address = 0x27;
+        }
+        else {
+            address--;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef __HOSTLCD_H
+#define __HOSTLCD_H
+
+#include "HostDevice.h"
+
+/**
+ * @brief Record of an instruction or character received by HostLcd
+ */
+class HostLcdInstruction {
+public:
+    uint64_t micros; //!< Virtual microseconds since boot when it was latched
+    uint8_t value; //!< Instruction or character. In 8-bit mode the low nibble is always 0.
+    bool isData; //!< True for a character (RS HIGH), false for an instruction
+};
+
+/**
+ * @brief Model of an HD44780 LCD controller connected to the fake GPIO
+ *
+ * Decodes the nibbles LiquidCrystal clocks out on the falling edge of EN. The controller starts
+ * in 8-bit mode, where each nibble is the upper half of a command, until a function set command
+ * selects the 4-bit interface; after that nibbles are paired, high half first.
+ *
+ * Only the display data RAM (DDRAM) and address counter are modeled, which is enough to check
+ * what the panel shows and count the bytes sent to it.
+ *
+ * Each instruction keeps the controller busy for its execution time on the virtual clock. While
+ * busy, the busy flag reads as 1 (if RW is connected) and nibbles written are ignored and counted
+ * in busyViolations, like the real controller.
+ */
+class HostLcd : public HostPinListener {
+public:
+    /**
+     * @brief Connect to the pins, in the same order as the LiquidCrystal 4-bit constructor
+     *
+     * @param rw The RW pin, or 255 if RW is tied to ground
+     */
+    HostLcd(pin_t rs, pin_t rw, pin_t enable, pin_t d4, pin_t d5, pin_t d6, pin_t d7);
+    virtual ~HostLcd();
+
+    /**
+     * @brief Get a line of the display (c string), as the panel shows it
+     */
+    const char *getLine(uint8_t row);
+
+    /**
+     * @brief Reset the counters
+     */
+    void clearCounts() { commandCount = 0; dataCount = 0; busyViolations = 0; busyReads = 0; };
+
+    /**
+     * @brief Returns true if the controller is still executing the last instruction
+     */
+    bool isBusy() const { return HostDevice::instance().microsSinceBoot < busyUntil; };
+
+    virtual void pinWritten(pin_t pin, uint8_t value);
+    virtual bool pinRead(pin_t pin, int32_t &value);
+
+    static const size_t COLS = 16; //!< Characters per line returned by getLine()
+
+    uint8_t ddram[128]; //!< Display data RAM. Line 1 starts at 0x00, line 2 at 0x40.
+    uint8_t address = 0; //!< Address counter
+    bool fourBitMode = false; //!< True once a function set command selected the 4-bit interface
+    bool increment = true; //!< Entry mode: address counter increments (true) or decrements (false)
+    uint32_t commandCount = 0; //!< Instructions received (RS LOW)
+    uint32_t dataCount = 0; //!< Characters received (RS HIGH)
+    uint32_t busyViolations = 0; //!< Nibbles written while busy, which were ignored
+    uint32_t busyReads = 0; //!< Busy flag reads (RW HIGH, RS LOW)
+    uint32_t commandUs = 37; //!< Execution time of most instructions and characters, in microseconds
+    uint32_t clearUs = 1520; //!< Execution time of clear display and return home, in microseconds
+    bool recordInstructions = false; //!< True to add each instruction and character to instructions
+    std::vector<HostLcdInstruction> instructions; //!< Instructions and characters received, in order
+
+protected:
+    void execute(uint8_t value, bool isData);
+
+    pin_t rsPin;
+    pin_t rwPin;
+    pin_t enablePin;
+    pin_t dataPins[4];
+    uint8_t lastEnable = LOW;
+    bool haveHighNibble = false;
+    bool readLowNibble = false;
+    uint64_t busyUntil = 0;
+    uint8_t highNibble = 0;
+    char lineBuf[COLS + 1];
+};
+
+#endif /* __HOSTLCD_H */
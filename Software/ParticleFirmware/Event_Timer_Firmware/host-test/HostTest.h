@@ -0,0 +1,30 @@
+#ifndef __HOSTTEST_H
+#define __HOSTTEST_H
+
+// Assertions shared by the host tests, in the same style as LocalTimeRK automated-test/TimeTest.cpp
+
+#include "Particle.h"
+
+#define assertInt(msg, got, expected) _assertInt(msg, got, expected, __LINE__)
+inline void _assertInt(const char *msg, int got, int expected, int line) {
+	if (expected != got) {
+		printf("assertion failed %s line %d\n", msg, line);
+		printf("expected: %d\n", expected);
+		printf("     got: %d\n", got);
+		fflush(stdout);
+		assert(false);
+	}
+}
+
+#define assertStr(msg, got, expected) _assertStr(msg, got, expected, __LINE__)
+inline void _assertStr(const char *msg, const char *got, const char *expected, int line) {
+	if (strcmp(expected, got) != 0) {
+		printf("assertion failed %s line %d\n", msg, line);
+		printf("expected: %s\n", expected);
+		printf("     got: %s\n", got);
+		fflush(stdout);
+		assert(false);
+	}
+}
+
+#endif /* __HOSTTEST_H */
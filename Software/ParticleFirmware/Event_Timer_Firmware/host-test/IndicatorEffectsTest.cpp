@@ -0,0 +1,159 @@
+#include "HostTest.h"
+
+#include "../src/IndicatorEffects.h"
+
+// Tests IndicatorEffects against the fake GPIO in HostDevice, comparing the recorded pin timeline
+//
+// make && ./IndicatorEffectsTest
+
+// Asserts the recorded pin changes, as milliseconds since startPinRecording() and pin/value pairs.
+// For example "0:18=1 200:18=0" is pin 18 HIGH at 0 ms and LOW at 200 ms.
+#define assertTimeline(msg, start, expected) _assertTimeline(msg, start, expected, __LINE__)
+void _assertTimeline(const char *msg, uint64_t start, const char *expected, int line) {
+	String got;
+	for(auto it = HostDevice::instance().pinChanges.begin(); it != HostDevice::instance().pinChanges.end(); ++it) {
+		if (got.length()) {
+			got += " ";
+		}
+		got += String::format("%d:%d=%d", (int)((it->micros - start) / 1000), (int)it->pin, (int)it->value);
+	}
+	if (strcmp(got.c_str(), expected) != 0) {
+		printf("assertion failed %s line %d\n", msg, line);
+		printf("expected: %s\n", expected);
+		printf("     got: %s\n", got.c_str());
+		assert(false);
+	}
+}
+
+// Calls effects.loop() every ms for ms milliseconds, like the main loop
+void runFor(IndicatorEffects &effects, int ms) {
+	for(int ii = 0; ii < ms; ii++) {
+		effects.loop();
+		HostDevice::instance().advanceMicros(1000);
+	}
+	effects.loop();
+}
+
+// Starts recording pin changes and returns the time recording started
+uint64_t startRecording() {
+	HostDevice::instance().startPinRecording();
+	return HostDevice::instance().microsSinceBoot;
+}
+
+void testIndicatorEffects() {
+	HostDevice &device = HostDevice::instance();
+
+	// Single blink
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		assertInt("", effects.blink(D18, 200), true);
+		assertInt("", device.pinValues[D18], HIGH);
+		assertInt("", effects.isIdle(), false);
+		runFor(effects, 500);
+		assertTimeline("", start, "0:18=1 200:18=0");
+		assertInt("", effects.isIdle(), true);
+	}
+
+	// Beep sequence does not block: play() returns without the clock moving
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		assertInt("", effects.beep(D2, 100, 100, 2), true);
+		assertInt("", (int)(device.microsSinceBoot - start), 0);
+		runFor(effects, 500);
+		assertTimeline("", start, "0:2=1 100:2=0 200:2=1 300:2=0");
+	}
+
+	// Several blinks on the same pin are queued and separated by the gap
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.blink(D18, 200, 200);
+		effects.blink(D18, 200, 200);
+		effects.blink(D18, 200, 200);
+		runFor(effects, 1500);
+		assertTimeline("", start, "0:18=1 200:18=0 400:18=1 600:18=0 800:18=1 1000:18=0");
+	}
+
+	// Different pins play at the same time
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.blink(D18, 200);
+		effects.beep(D2, 50, 50, 3);
+		runFor(effects, 500);
+		assertTimeline("", start, "0:18=1 0:2=1 50:2=0 100:2=1 150:2=0 200:18=0 200:2=1 250:2=0");
+	}
+
+	// Higher priority preempts the playing effect and plays before queued effects
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.blink(D18, 100, 100, 5);
+		effects.blink(D18, 300, 0, 1, 0);
+		runFor(effects, 150);
+		effects.blink(D18, 50, 50, 1, 2);
+		effects.blink(D18, 10, 10, 1, 1);
+		runFor(effects, 800);
+		// The 5-blink effect is cut off at 150 ms, then priority 2, priority 1, then the queued priority 0 effect
+		assertTimeline("", start, "0:18=1 100:18=0 150:18=1 200:18=0 250:18=1 260:18=0 270:18=1 570:18=0");
+	}
+
+	// Lower priority does not preempt
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.blink(D18, 100, 0, 1, 1);
+		effects.blink(D18, 100, 0, 1, 0);
+		runFor(effects, 300);
+		assertTimeline("", start, "0:18=1 100:18=0 100:18=1 200:18=0");
+	}
+
+	// Full queue: lower priority queued effects are discarded to make room, equal ones are not
+	{
+		IndicatorEffects effects;
+		effects.blink(D18, 100);
+		for(size_t ii = 1; ii < IndicatorEffects::MAX_EFFECTS; ii++) {
+			assertInt("", effects.blink(D18, 100), true);
+		}
+		assertInt("", effects.blink(D18, 100), false);
+		assertInt("", effects.blink(D18, 100, 0, 1, 1), true);
+		assertInt("", effects.blink(D18, 100, 0, 0), false);
+
+		effects.stopAll();
+		assertInt("", effects.isIdle(), true);
+		assertInt("", device.pinValues[D18], LOW);
+	}
+
+	// loop() called late: each step starts when loop() runs, pulses are never skipped
+	{
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.beep(D2, 100, 100, 2);
+		device.advanceMicros(250000);
+		effects.loop();
+		runFor(effects, 400);
+		assertTimeline("", start, "0:2=1 250:2=0 350:2=1 450:2=0");
+	}
+
+	// millis() wrapping around
+	{
+		uint64_t savedMicros = device.microsSinceBoot;
+		device.microsSinceBoot = 0xffffff00ull * 1000;
+
+		IndicatorEffects effects;
+		uint64_t start = startRecording();
+		effects.blink(D18, 400);
+		runFor(effects, 600);
+		assertTimeline("", start, "0:18=1 400:18=0");
+
+		device.microsSinceBoot = savedMicros;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testIndicatorEffects();
+	printf("IndicatorEffectsTest passed\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "HostTest.h"
+#include "HostLcd.h"
+
+#include "../src/LcdFramebuffer.h"
+
+// Tests LcdFramebuffer against the HD44780 model in HostLcd, checking what the panel shows and
+// the number of bytes sent for each frame
+//
+// make && ./LcdFramebufferTest
+
+void testLcdFramebuffer() {
+	// Same pins as the firmware: RS, EN, D4, D5, D6, D7
+	LiquidCrystal lcd(D11, D12, D13, D14, D5, D6);
+	HostLcd panel(D11, 255, D12, D13, D14, D5, D6);
+
+	lcd.begin(16, 2);
+	assertInt("", panel.fourBitMode, true);
+
+	LcdFramebuffer display(lcd);
+	display.begin();
+	assertStr("", panel.getLine(0), "                ");
+	assertInt("", (int)display.flush(), 0);
+
+	// First frame: the address counter is already at the start of line 1 after begin(). The
+	// space in column 5 is already on the panel, so each line is two runs and the three runs
+	// after the first each need a setCursor.
+	{
+		display.setLine(0, "07-02 09:15:01PM");
+		display.setLine(1, "07-02 09:30:00PM");
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 33);
+		assertInt("", (int)panel.commandCount, 3);
+		assertInt("", (int)panel.dataCount, 30);
+		assertStr("", panel.getLine(0), "07-02 09:15:01PM");
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+		assertInt("", (int)display.getLastFrameBytes(), 33);
+	}
+
+	// Clock tick: only the seconds digit changes
+	{
+		display.setLine(0, "07-02 09:15:02PM");
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 2);
+		assertInt("", (int)panel.commandCount, 1);
+		assertInt("", (int)panel.dataCount, 1);
+		assertStr("", panel.getLine(0), "07-02 09:15:02PM");
+	}
+
+	// Minute rollover: the minutes digit and the seconds digit change, the tens of seconds do not
+	{
+		display.setLine(0, "07-02 09:16:00PM");
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 4);
+		assertStr("", panel.getLine(0), "07-02 09:16:00PM");
+	}
+
+	// A run of two cells on the second line needs one setCursor
+	{
+		display.setLine(0, "07-02 09:16:01PM");
+		display.setLine(1, "07-02 09:45:00PM");
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 5);
+		assertInt("", (int)panel.commandCount, 2);
+		assertStr("", panel.getLine(0), "07-02 09:16:01PM");
+		assertStr("", panel.getLine(1), "07-02 09:45:00PM");
+	}
+
+	// Setting the same text again sends nothing
+	{
+		assertInt("", display.setLine(1, "07-02 09:45:00PM"), false);
+		assertInt("", display.isDirty(), false);
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 0);
+		assertInt("", (int)(panel.commandCount + panel.dataCount), 0);
+	}
+
+	// Short lines are padded, long lines truncated, setText changes part of a line
+	{
+		display.setLine(1, " -------------- ");
+		display.flush();
+		display.setLine(0, "abc");
+		display.setText(14, 1, "XYZ");
+		display.flush();
+		assertStr("", panel.getLine(0), "abc             ");
+		assertStr("", panel.getLine(1), " -------------XY");
+
+		display.setLine(0, "0123456789abcdefghij");
+		display.flush();
+		assertStr("", panel.getLine(0), "0123456789abcdef");
+	}
+
+	// invalidate() redraws every cell after something else drew to the panel
+	{
+		lcd.setCursor(0, 0);
+		lcd.print("garbage");
+		display.invalidate();
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 34);
+		assertStr("", panel.getLine(0), "0123456789abcdef");
+		assertStr("", panel.getLine(1), " -------------XY");
+	}
+
+	// clear() then flush only sends the cells that were not already spaces
+	{
+		display.setLine(0, "ab");
+		display.setLine(1, "");
+		display.flush();
+		display.clear();
+		panel.clearCounts();
+		assertInt("", (int)display.flush(), 3);
+		assertStr("", panel.getLine(0), "                ");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testLcdFramebuffer();
+	printf("LcdFramebufferTest passed\n");
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include "HostTest.h"
+#include "HostLcd.h"
+
+#include "../src/LcdWriter.h"
+
+#include <thread>
+
+// Tests LcdWriter and LcdFrameQueue: frames collapse to the newest, the worker sends them in
+// slices, posting never touches the LCD, and the queue holds up with a real producer and
+// consumer thread
+//
+// make && ./LcdWriterTest
+
+// Returns true if any character of text was sent to the panel since the instructions were cleared
+bool panelReceived(const HostLcd &panel, const char *text) {
+	String received;
+	for(auto it = panel.instructions.begin(); it != panel.instructions.end(); ++it) {
+		if (it->isData) {
+			received += (char)it->value;
+		}
+	}
+	return received.indexOf(text) >= 0;
+}
+
+void testLcdWriter() {
+	LiquidCrystal lcd(D11, D12, D13, D14, D5, D6);
+	HostLcd panel(D11, 255, D12, D13, D14, D5, D6);
+	lcd.begin(16, 2);
+
+	LcdFramebuffer display(lcd);
+	display.begin();
+	LcdWriter writer(display);
+	assertInt("", writer.isIdle(), true);
+	assertInt("", (int)writer.service(), 0);
+
+	// Posting does not touch the LCD or take any time
+	{
+		HostDevice::instance().startPinRecording();
+		uint64_t start = HostDevice::instance().microsSinceBoot;
+		writer.setLine(0, "07-02 09:15:01PM");
+		writer.setLine(1, "07-02 09:30:00PM");
+		assertInt("", writer.post(), true);
+		assertInt("", (int)HostDevice::instance().pinChanges.size(), 0);
+		assertInt("", (int)(HostDevice::instance().microsSinceBoot - start), 0);
+		HostDevice::instance().recordPins = false;
+
+		// Nothing changed, nothing posted
+		assertInt("", writer.post(), false);
+		assertInt("", (int)writer.getStats().posted, 1);
+
+		assertInt("", writer.isIdle(), false);
+		writer.service();
+		assertInt("", writer.isIdle(), true);
+		assertStr("", panel.getLine(0), "07-02 09:15:01PM");
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+	}
+
+	// Frames posted before the worker runs collapse to the newest
+	{
+		panel.recordInstructions = true;
+		panel.instructions.clear();
+		writer.setLine(0, "07-02 09:15:02PM");
+		writer.post();
+		writer.setLine(0, "07-02 09:15:03PM");
+		writer.post();
+		writer.setLine(0, "07-02 09:15:04PM");
+		writer.post();
+		assertInt("", (int)writer.getStats().collapsed, 2);
+
+		assertInt("", (int)writer.service(), 2);
+		assertInt("", (int)writer.getStats().taken, 2);
+		assertStr("", panel.getLine(0), "07-02 09:15:04PM");
+		assertInt("", panelReceived(panel, "2"), false);
+		assertInt("", panelReceived(panel, "3"), false);
+	}
+
+	// The worker sends a few bytes per call, and moves on to a newer frame posted part way through
+	{
+		writer.setLine(0, "ABCDEFGHIJKLMNOP");
+		writer.setLine(1, "abcdefghijklmnop");
+		writer.post();
+		assertInt("", (int)writer.service(4), 4);
+		assertStr("", panel.getLine(0), "ABC02 09:15:04PM");
+		assertInt("", (int)writer.service(4), 4);
+		assertStr("", panel.getLine(0), "ABCDEFG9:15:04PM");
+
+		// Newer frame: row 0 keeps the cells already sent, row 1 goes back to what the panel shows
+		writer.setLine(0, "ABCDEFGHIJ");
+		writer.setLine(1, "07-02 09:30:00PM");
+		writer.post();
+		size_t bytes = 0;
+		int calls = 0;
+		while(!writer.isIdle()) {
+			bytes += writer.service(4);
+			calls++;
+		}
+		assertStr("", panel.getLine(0), "ABCDEFGHIJ      ");
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+		assertInt("", (int)bytes, 9);
+		assertInt("", calls, 3);
+	}
+	panel.recordInstructions = false;
+
+	// The time of each service() call that sends something is recorded: the bus time on the virtual clock
+	{
+		SharedTimingHistogram histogram;
+		writer.withServiceHistogram(&histogram);
+		writer.setLine(0, "07-02 09:15:05PM");
+		writer.post();
+		uint64_t start = HostDevice::instance().microsSinceBoot;
+		assertInt("", (int)writer.service() > 0, true);
+		assertInt("", (int)histogram.read().getCount(), 1);
+		assertInt("", (int)histogram.read().getMax(), (int)(HostDevice::instance().microsSinceBoot - start));
+		assertInt("", (int)histogram.read().getMax() > 0, true);
+
+		// Nothing to send, nothing recorded
+		assertInt("", (int)writer.service(), 0);
+		assertInt("", (int)histogram.read().getCount(), 1);
+		writer.withServiceHistogram(nullptr);
+	}
+}
+
+// Producer and consumer on separate threads. Each frame has the same number on both lines, so
+// a frame mixed from two posts would show up as lines that differ. The consumer holds each frame
+// for a while, like the LCD thread sending it, and checks the producer did not write to it.
+void testLcdFrameQueueThreads() {
+	const int NUM_FRAMES = 200000;
+	LcdFrameQueue queue;
+	int taken = 0;
+	int torn = 0;
+	int outOfOrder = 0;
+
+	std::thread consumer([&]() {
+		int last = -1;
+		while(last < NUM_FRAMES - 1) {
+			const LcdFrame *frame = queue.take();
+			if (!frame) {
+				std::this_thread::yield();
+				continue;
+			}
+			taken++;
+			char copy[LcdFramebuffer::COLS + 1];
+			strcpy(copy, frame->text[0]);
+			for(volatile int spin = 0; spin < 2000; spin++) {
+			}
+			if (strcmp(frame->text[0], frame->text[1]) != 0 || strcmp(frame->text[0], copy) != 0) {
+				torn++;
+			}
+			int n = atoi(frame->text[0]);
+			if (n <= last) {
+				outOfOrder++;
+			}
+			last = n;
+		}
+	});
+
+	LcdFrame frame;
+	char buf[32];
+	for(int ii = 0; ii < NUM_FRAMES; ii++) {
+		snprintf(buf, sizeof(buf), "%016d", ii);
+		frame.setLine(0, buf);
+		frame.setLine(1, buf);
+		queue.post(frame);
+		if ((ii % 16) == 0) {
+			std::this_thread::yield();
+		}
+	}
+	consumer.join();
+
+	assertInt("", torn, 0);
+	assertInt("", outOfOrder, 0);
+	assertInt("", taken > 0 && taken <= NUM_FRAMES, true);
+	printf("%d frames posted, %d taken by the consumer thread\n", NUM_FRAMES, taken);
+}
+
+int main(int argc, char *argv[]) {
+	testLcdWriter();
+	testLcdFrameQueueThreads();
+	printf("LcdWriterTest passed\n");
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include "HostTest.h"
+#include "HostLcd.h"
+
+#include <LiquidCrystal.h>
+
+// Tests the LiquidCrystal timing against the HD44780 model in HostLcd: the order of the
+// instructions, that nothing is written while the controller is busy, and the total bus time,
+// with the busy flag (RW connected) and with the execution time fallback (RW not connected)
+//
+// make && ./LiquidCrystalTest
+
+// Asserts the recorded instructions as hex, with characters prefixed by "d". For example
+// "28 01 d41" is function set, clear display, then the character 'A'.
+#define assertInstructions(msg, panel, expected) _assertInstructions(msg, panel, expected, __LINE__)
+void _assertInstructions(const char *msg, const HostLcd &panel, const char *expected, int line) {
+	String got;
+	for(auto it = panel.instructions.begin(); it != panel.instructions.end(); ++it) {
+		if (got.length()) {
+			got += " ";
+		}
+		got += String::format("%s%02x", it->isData ? "d" : "", (int)it->value);
+	}
+	if (strcmp(got.c_str(), expected) != 0) {
+		printf("assertion failed %s line %d\n", msg, line);
+		printf("expected: %s\n", expected);
+		printf("     got: %s\n", got.c_str());
+		fflush(stdout);
+		assert(false);
+	}
+}
+
+// Instructions sent by begin(16, 2): the 8-bit mode nibbles, then 4-bit function set, display off,
+// function set, clear, entry mode, home, display on
+static const char *BEGIN_INSTRUCTIONS = "30 80 20 28 08 28 01 06 02 0c";
+
+// Time for begin() with the fixed delays in version 0.0.3 of the library
+static const uint32_t OLD_BEGIN_US = 50000 + 9 * 5000;
+
+// Time per byte with the fixed delays in version 0.0.3 of the library, two nibbles of 102 us each
+static const uint32_t OLD_BYTE_US = 2 * 102;
+
+// Writes both lines and returns the elapsed virtual time in microseconds
+uint32_t writeFrame(LiquidCrystal &lcd) {
+	uint32_t start = micros();
+	lcd.setCursor(0, 0);
+	lcd.print("07-02 09:15:01PM");
+	lcd.setCursor(0, 1);
+	lcd.print("07-02 09:30:00PM");
+	return micros() - start;
+}
+
+void testLiquidCrystal() {
+	// RW connected: wait for the busy flag
+	{
+		LiquidCrystal lcd(D11, D10, D12, D13, D14, D5, D6);
+		HostLcd panel(D11, D10, D12, D13, D14, D5, D6);
+		panel.recordInstructions = true;
+
+		uint32_t start = micros();
+		lcd.begin(16, 2);
+		uint32_t beginUs = micros() - start;
+		assertInstructions("", panel, BEGIN_INSTRUCTIONS);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertInt("", panel.busyReads > 0, true);
+		assertInt("", beginUs < OLD_BEGIN_US - 30000, true);
+
+		panel.instructions.clear();
+		panel.clearCounts();
+		uint32_t frameUs = writeFrame(lcd);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertInt("", (int)(panel.commandCount + panel.dataCount), 34);
+		assertStr("", panel.getLine(0), "07-02 09:15:01PM");
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+		assertInt("", frameUs < 34 * OLD_BYTE_US / 3, true);
+
+		// Clear takes 1.52 ms in the model; the next write waits for it
+		panel.instructions.clear();
+		lcd.clear();
+		lcd.write('A');
+		assertInstructions("", panel, "01 d41");
+		assertInt("", (int)(panel.instructions[1].micros - panel.instructions[0].micros) >= 1520, true);
+		assertInt("", (int)(panel.instructions[1].micros - panel.instructions[0].micros) < 1600, true);
+		assertInt("", (int)panel.busyViolations, 0);
+
+		// Slower controller: still no writes while busy
+		panel.commandUs = 80;
+		panel.clearUs = 3000;
+		panel.clearCounts();
+		writeFrame(lcd);
+		lcd.clear();
+		writeFrame(lcd);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+
+		printf("RW connected:     begin %6u us, frame of 34 bytes %5u us\n", (unsigned)beginUs, (unsigned)frameUs);
+	}
+
+	// RW not connected: wait the execution time, which allows for the slowest controller
+	{
+		LiquidCrystal lcd(D11, D12, D13, D14, D5, D6);
+		HostLcd panel(D11, 255, D12, D13, D14, D5, D6);
+		panel.recordInstructions = true;
+
+		uint32_t start = micros();
+		lcd.begin(16, 2);
+		uint32_t beginUs = micros() - start;
+		assertInstructions("", panel, BEGIN_INSTRUCTIONS);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertInt("", (int)panel.busyReads, 0);
+		assertInt("", beginUs < OLD_BEGIN_US - 30000, true);
+
+		panel.clearCounts();
+		uint32_t frameUs = writeFrame(lcd);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertStr("", panel.getLine(0), "07-02 09:15:01PM");
+		assertStr("", panel.getLine(1), "07-02 09:30:00PM");
+		assertInt("", frameUs < 34 * OLD_BYTE_US / 3, true);
+
+		// Time between writes counts toward the execution time, so there's no extra wait
+		lcd.clear();
+		delay(3);
+		start = micros();
+		lcd.write('A');
+		assertInt("", (int)(micros() - start) < 10, true);
+
+		// A controller slower than the default allows writes while busy, and setExecutionTimes() fixes it
+		panel.commandUs = 80;
+		panel.clearCounts();
+		writeFrame(lcd);
+		assertInt("", panel.busyViolations > 0, true);
+
+		lcd.setExecutionTimes(90, LCD_CLEAR_US);
+		lcd.clear();
+		panel.clearCounts();
+		writeFrame(lcd);
+		assertInt("", (int)panel.busyViolations, 0);
+		assertStr("", panel.getLine(0), "07-02 09:15:01PM");
+
+		printf("RW not connected: begin %6u us, frame of 34 bytes %5u us\n", (unsigned)beginUs, (unsigned)frameUs);
+	}
+
+	printf("version 0.0.3:    begin %6u us, frame of 34 bytes %5u us\n", (unsigned)OLD_BEGIN_US, (unsigned)(34 * OLD_BYTE_US));
+}
+
+int main(int argc, char *argv[]) {
+	testLiquidCrystal();
+	printf("LiquidCrystalTest passed\n");
+	return 0;
+}
@@ -0,0 +1,170 @@
+#include "HostTest.h"
+#include "alloc_counter.h"
+
+#include "../src/LoopTiming.h"
+
+#include <climits>
+#include <thread>
+
+// Tests the TimingHistogram buckets and the LoopTiming JSON, and that recording and rendering
+// don't allocate memory. SharedTimingHistogram is also run with a real recording and reading thread.
+//
+// make && ./LoopTimingTest
+
+void testTimingHistogram() {
+	// Powers of two: bucket n is from 2^(n-1) to 2^n - 1, and the last bucket has the rest
+	assertInt("", (int)TimingHistogram::bucketFor(0), 0);
+	assertInt("", (int)TimingHistogram::bucketFor(1), 1);
+	assertInt("", (int)TimingHistogram::bucketFor(2), 2);
+	assertInt("", (int)TimingHistogram::bucketFor(3), 2);
+	assertInt("", (int)TimingHistogram::bucketFor(4), 3);
+	assertInt("", (int)TimingHistogram::bucketFor(1023), 10);
+	assertInt("", (int)TimingHistogram::bucketFor(1024), 11);
+	assertInt("", (int)TimingHistogram::bucketFor(16383), 14);
+	assertInt("", (int)TimingHistogram::bucketFor(16384), 15);
+	assertInt("", (int)TimingHistogram::bucketFor(UINT_MAX), 15);
+
+	TimingHistogram histogram;
+	histogram.record(0);
+	histogram.record(5);
+	histogram.record(7);
+	histogram.record(100);
+	assertInt("", (int)histogram.getCount(), 4);
+	assertInt("", (int)histogram.getMax(), 100);
+	assertInt("", (int)histogram.getTotal(), 112);
+	assertInt("", (int)histogram.getBucket(0), 1);
+	assertInt("", (int)histogram.getBucket(3), 2);
+	assertInt("", (int)histogram.getBucket(7), 1);
+	assertInt("", (int)histogram.getBucket(TimingHistogram::BUCKETS), 0);
+
+	// The empty buckets after the last one used are left out
+	char buf[256];
+	{
+		JSONBufferWriter writer(buf, sizeof(buf) - 1);
+		histogram.toJson(writer);
+		buf[writer.dataSize()] = 0;
+		assertStr("", buf, "{\"n\":4,\"max\":100,\"sum\":112,\"b\":[1,0,0,2,0,0,0,1]}");
+	}
+	{
+		JSONBufferWriter writer(buf, sizeof(buf) - 1);
+		histogram.toJson(writer, false);
+		buf[writer.dataSize()] = 0;
+		assertStr("", buf, "{\"n\":4,\"max\":100,\"sum\":112}");
+	}
+
+	histogram.clear();
+	assertInt("", (int)histogram.getCount(), 0);
+	assertInt("", (int)histogram.getMax(), 0);
+	assertInt("", (int)histogram.getBucket(3), 0);
+
+	// Time on the virtual clock
+	{
+		TimingScope scope(histogram);
+		delayMicroseconds(300);
+	}
+	assertInt("", (int)histogram.getCount(), 1);
+	assertInt("", (int)histogram.getMax(), 300);
+}
+
+void testSharedTimingHistogram() {
+	SharedTimingHistogram shared;
+	assertInt("", (int)shared.read().getCount(), 0);
+
+	shared.record(5);
+	shared.record(700);
+	assertInt("", (int)shared.read().getCount(), 2);
+	assertInt("", (int)shared.read().getMax(), 700);
+	assertInt("", (int)shared.read().getTotal(), 705);
+
+	// Nothing new: the same copy
+	assertInt("", (int)shared.read().getCount(), 2);
+
+	// The reader only ever sees complete copies. Every value is 3, so in a copy mixed from two
+	// recordings the total, count and bucket would disagree.
+	const uint32_t RECORDS = 200000;
+	std::thread recorder([&]() {
+		for(uint32_t ii = 0; ii < RECORDS; ii++) {
+			shared.record(3);
+		}
+	});
+	uint32_t lastCount = 0;
+	int reads = 0;
+	while(lastCount < RECORDS + 2) {
+		const TimingHistogram &histogram = shared.read();
+		uint32_t count = histogram.getCount();
+		assertInt("", count >= lastCount, true);
+		assertInt("", (int)histogram.getTotal(), (int)(705 + (count - 2) * 3));
+		assertInt("", (int)histogram.getBucket(TimingHistogram::bucketFor(3)), (int)(count - 2));
+		lastCount = count;
+		reads++;
+	}
+	recorder.join();
+	printf("SharedTimingHistogram: %d reads while recording\n", reads);
+}
+
+void testLoopTiming() {
+	LoopTiming timing;
+	char buf[LoopTiming::MAX_JSON_LEN + 1];
+
+	size_t len = timing.toJson(buf, sizeof(buf));
+	assertInt("", (int)len, (int)strlen(buf));
+	assertStr("", buf, "{\"loop_us\":{\"n\":0,\"max\":0,\"sum\":0,\"b\":[]},\"publish_ms\":{\"n\":0,\"max\":0,\"sum\":0,\"b\":[]},"
+		"\"lcd_us\":{\"n\":0,\"max\":0,\"sum\":0,\"b\":[]},\"late_ms\":{\"n\":0,\"max\":0,\"sum\":0,\"b\":[]}}");
+
+	// Recording and rendering don't allocate
+	{
+		AllocCounter counter;
+		for(uint32_t ii = 0; ii < 100000; ii++) {
+			timing.loopMicros.record(ii % 5000);
+			timing.publishLatencyMs.record(ii * 7);
+			timing.lcdWriteMicros.record(ii % 900);
+			timing.fireLateMs.record(ii % 1200);
+		}
+		timing.toJson(buf, sizeof(buf));
+		assertInt("", (int)counter.getAllocations(), 0);
+	}
+
+	// Every bucket used, and still fits
+	len = timing.toJson(buf, sizeof(buf));
+	assertInt("", (int)len, (int)strlen(buf));
+	assertInt("", strstr(buf, "\"b\"") != nullptr, true);
+	JSONValue obj = JSONValue::parseCopy(buf);
+	assertInt("", obj.isObject(), true);
+	JSONObjectIterator iter(obj);
+	int histograms = 0;
+	while(iter.next()) {
+		JSONObjectIterator histIter(iter.value());
+		while(histIter.next()) {
+			if (histIter.name() == "n") {
+				assertInt("", histIter.value().toInt(), 100000);
+			}
+		}
+		histograms++;
+	}
+	assertInt("", histograms, 4);
+
+	// Too long for the buffer: the buckets are left out
+	{
+		char small[300];
+		len = timing.toJson(small, sizeof(small));
+		assertInt("", (int)len, (int)strlen(small));
+		assertInt("", strstr(small, "\"b\"") == nullptr, true);
+		assertInt("", JSONValue::parseCopy(small).isObject(), true);
+	}
+
+	// Still too long: cut off, but null terminated
+	{
+		char tiny[20];
+		len = timing.toJson(tiny, sizeof(tiny));
+		assertInt("", (int)len > (int)sizeof(tiny), true);
+		assertInt("", strlen(tiny) < sizeof(tiny), true);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testTimingHistogram();
+	testSharedTimingHistogram();
+	testLoopTiming();
+	printf("LoopTimingTest passed\n");
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef __HOST_PARTICLE_H
+#define __HOST_PARTICLE_H
+
+// Host replacement for Particle.h: the UnitTestLib version plus the fake device in HostDevice.h
+
+#include "../lib/LocalTimeRK/automated-test/UnitTestLib/Particle.h"
+#include "HostDevice.h"
+
+#endif /* __HOST_PARTICLE_H */
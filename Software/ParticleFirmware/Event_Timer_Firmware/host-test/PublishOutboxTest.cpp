@@ -0,0 +1,243 @@
+#include "HostTest.h"
+
+#include "../src/PublishOutbox.h"
+
+// Tests PublishOutbox with a stand-in publisher and the virtual clock in HostDevice
+//
+// make && ./PublishOutboxTest
+
+// Stand-in publisher: records each attempt as "name:data@ms" and fails while failuresLeft > 0.
+// With finishLater set, the publish stays in progress until the test finishes it through promise.
+class StandInPublisher {
+public:
+	particle::Future<bool> publish(const char *eventName, const char *data) {
+		if (log.length()) {
+			log += " ";
+		}
+		log += String::format("%s:%s@%d", eventName, data, (int)(millis() - startMillis));
+		promise = particle::Promise<bool>();
+		if (finishLater) {
+			return promise.future();
+		}
+		if (failuresLeft > 0) {
+			failuresLeft--;
+			log += "!";
+			promise.setError();
+		}
+		else {
+			promise.setResult(true);
+		}
+		return promise.future();
+	}
+
+	String log;
+	int failuresLeft = 0;
+	bool finishLater = false;
+	particle::Promise<bool> promise;
+	uint32_t startMillis = millis();
+};
+
+// Sets up outbox to use publisher and the fake cloud connection
+void usePublisher(PublishOutbox &outbox, StandInPublisher &publisher) {
+	outbox.withPublisher([&publisher](const char *eventName, const char *data) {
+		return publisher.publish(eventName, data);
+	});
+}
+
+// Calls outbox.loop() every ms for ms milliseconds, like the main loop
+void runFor(PublishOutbox &outbox, int ms) {
+	for(int ii = 0; ii < ms; ii++) {
+		outbox.loop();
+		HostDevice::instance().advanceMicros(1000);
+	}
+}
+
+void testPublishOutbox() {
+	HostDevice &device = HostDevice::instance();
+
+	// Events queued at the same time are published one per second, in order
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+		TimingHistogram latency;
+		outbox.withLatencyHistogram(&latency);
+
+		assertInt("", outbox.enqueue("e", "13"), true);
+		assertInt("", outbox.enqueue("e", "14"), true);
+		assertInt("", outbox.enqueue("e", "15"), true);
+		assertInt("", (int)outbox.getDepth(), 3);
+
+		runFor(outbox, 5000);
+		assertStr("", publisher.log.c_str(), "e:13@0 e:14@1000 e:15@2000");
+		assertInt("", outbox.isEmpty(), true);
+
+		const PublishOutboxStats &stats = outbox.getStats();
+		assertInt("", (int)stats.enqueued, 3);
+		assertInt("", (int)stats.published, 3);
+		assertInt("", (int)stats.maxDepth, 3);
+		assertInt("", (int)stats.lastLatencyMs, 2000);
+		assertInt("", (int)stats.maxLatencyMs, 2000);
+		assertInt("", (int)stats.totalLatencyMs, 3000);
+
+		// 0, 1000 and 2000 ms
+		assertInt("", (int)latency.getCount(), 3);
+		assertInt("", (int)latency.getBucket(0), 1);
+		assertInt("", (int)latency.getBucket(10), 1);
+		assertInt("", (int)latency.getBucket(11), 1);
+		assertInt("", (int)latency.getMax(), 2000);
+	}
+
+	// Failed publishes are retried with a doubling backoff, and later events wait
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+		publisher.failuresLeft = 3;
+
+		outbox.enqueue("e", "a");
+		outbox.enqueue("e", "b");
+		runFor(outbox, 10000);
+		assertStr("", publisher.log.c_str(), "e:a@0! e:a@1000! e:a@3000! e:a@7000 e:b@8000");
+
+		const PublishOutboxStats &stats = outbox.getStats();
+		assertInt("", (int)stats.failedAttempts, 3);
+		assertInt("", (int)stats.published, 2);
+		assertInt("", (int)stats.droppedRetries, 0);
+	}
+
+	// Discarded after maxAttempts
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+		outbox.withMaxAttempts(2).withRetryMs(500);
+		publisher.failuresLeft = 2;
+
+		outbox.enqueue("e", "a");
+		outbox.enqueue("e", "b");
+		runFor(outbox, 5000);
+		assertStr("", publisher.log.c_str(), "e:a@0! e:a@1000! e:b@2000");
+		assertInt("", (int)outbox.getStats().droppedRetries, 1);
+	}
+
+	// loop() doesn't wait for the cloud. The publish finishes on a later call, and the next one
+	// doesn't start until it has.
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+		publisher.finishLater = true;
+
+		outbox.enqueue("e", "a");
+		outbox.enqueue("e", "b");
+		outbox.loop();
+		assertInt("", outbox.isPublishing(), true);
+		assertInt("", (int)outbox.getStats().published, 0);
+
+		// A slow cloud: loop() keeps returning, without starting another attempt
+		runFor(outbox, 3000);
+		assertStr("", publisher.log.c_str(), "e:a@0");
+		assertInt("", outbox.isPublishing(), true);
+		assertInt("", (int)outbox.getDepth(), 2);
+
+		publisher.finishLater = false;
+		publisher.promise.setResult(true);
+		runFor(outbox, 2);
+		assertStr("", publisher.log.c_str(), "e:a@0 e:b@3001");
+		assertInt("", outbox.isEmpty(), true);
+		assertInt("", (int)outbox.getStats().published, 2);
+		assertInt("", (int)outbox.getStats().maxLatencyMs, 3001);
+
+		// A publish that fails later is retried after the backoff from when it failed
+		publisher.finishLater = true;
+		outbox.enqueue("e", "c");
+		runFor(outbox, 1000);
+		assertStr("", publisher.log.c_str(), "e:a@0 e:b@3001 e:c@4001");
+		runFor(outbox, 500);
+		publisher.finishLater = false;
+		publisher.promise.setError();
+		runFor(outbox, 2000);
+		assertStr("", publisher.log.c_str(), "e:a@0 e:b@3001 e:c@4001 e:c@5502");
+		assertInt("", (int)outbox.getStats().failedAttempts, 1);
+		assertInt("", outbox.isEmpty(), true);
+
+		// The event being published is discarded when the outbox fills up
+		publisher.finishLater = true;
+		for(size_t ii = 0; ii <= PublishOutbox::CAPACITY; ii++) {
+			outbox.enqueue("e", String(ii).c_str());
+			outbox.loop();
+		}
+		assertInt("", outbox.isPublishing(), false);
+		assertInt("", (int)outbox.getStats().droppedFull, 1);
+		publisher.finishLater = false;
+		runFor(outbox, 1001);
+		assertStr("", publisher.log.c_str(), "e:a@0 e:b@3001 e:c@4001 e:c@5502 e:0@6502 e:1@7502");
+	}
+
+	// Events queued while disconnected are published after reconnecting
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+
+		device.cloudConnected = false;
+		outbox.enqueue("e", "a");
+		runFor(outbox, 3000);
+		assertStr("", publisher.log.c_str(), "");
+		assertInt("", (int)outbox.getStats().failedAttempts, 0);
+
+		device.cloudConnected = true;
+		runFor(outbox, 1000);
+		assertStr("", publisher.log.c_str(), "e:a@3000");
+		assertInt("", (int)outbox.getStats().lastLatencyMs, 3000);
+	}
+
+	// Full: the oldest event is discarded
+	{
+		PublishOutbox outbox;
+		StandInPublisher publisher;
+		usePublisher(outbox, publisher);
+
+		for(size_t ii = 0; ii < PublishOutbox::CAPACITY; ii++) {
+			assertInt("", outbox.enqueue("e", String(ii).c_str()), true);
+		}
+		assertInt("", outbox.enqueue("e", "new"), false);
+		assertInt("", (int)outbox.getDepth(), (int)PublishOutbox::CAPACITY);
+		assertInt("", (int)outbox.getStats().droppedFull, 1);
+
+		runFor(outbox, 1);
+		assertStr("", publisher.log.c_str(), "e:1@0");
+	}
+
+	// Too long
+	{
+		PublishOutbox outbox;
+		char data[PublishOutboxEntry::MAX_DATA_LEN + 2];
+		memset(data, 'x', sizeof(data) - 1);
+		data[sizeof(data) - 1] = 0;
+		assertInt("", outbox.enqueue("e", data), false);
+		assertInt("", (int)outbox.getStats().droppedTooLong, 1);
+		assertInt("", outbox.isEmpty(), true);
+
+		data[sizeof(data) - 2] = 0;
+		assertInt("", outbox.enqueue("e", data), true);
+	}
+
+	// Default publisher uses Particle.publish
+	{
+		PublishOutbox outbox;
+		device.clearPublishes();
+		outbox.enqueue("LoRaHubLogging", "message=EventTimer");
+		outbox.loop();
+		assertInt("", (int)device.publishes.size(), 1);
+		assertStr("", device.publishes[0].eventName.c_str(), "LoRaHubLogging");
+		assertStr("", device.publishes[0].data.c_str(), "message=EventTimer");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testPublishOutbox();
+	printf("PublishOutboxTest passed\n");
+	return 0;
+}
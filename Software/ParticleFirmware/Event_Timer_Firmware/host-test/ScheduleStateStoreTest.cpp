@@ -0,0 +1,115 @@
+#include "HostTest.h"
+
+#include <LocalTimeRK.h>
+#include "../src/ScheduleStateStore.h"
+
+// Tests ScheduleStateStore with the fake EEPROM kept in a file: a restart during the evening
+// neither repeats an event that was published nor skips one that came due while the device was down
+//
+// make && ./ScheduleStateStoreTest
+
+const char *EEPROM_FILE = "build/ScheduleStateStoreTest.eeprom";
+
+// The firmware's schedules, for a fresh manager after each simulated restart
+void addSchedules(LocalTimeScheduleManager &manager) {
+	manager.getScheduleByName("13").withTime(LocalTimeHMSRestricted(LocalTimeHMS("21:30:00")));
+	manager.getScheduleByName("14").withTime(LocalTimeHMSRestricted(LocalTimeHMS("21:45:00")));
+	manager.getScheduleByName("17").withTime(LocalTimeHMSRestricted(LocalTimeHMS("21:55:00")));
+	manager.getScheduleByName("15").withTime(LocalTimeHMSRestricted(LocalTimeHMS("22:00:00")));
+}
+
+// Checks the schedules at timeStr (UTC) and saves like the firmware; returns the names that fired
+String check(LocalTimeScheduleManager &manager, ScheduleStateStore &store, const char *timeStr) {
+	LocalTimeConvert conv;
+	conv.withTime(LocalTime::stringToTime(timeStr)).convert();
+
+	String fired;
+	bool result = manager.checkSchedules(conv, [&](LocalTimeSchedule &schedule, time_t scheduledTime) {
+		fired += schedule.name + " ";
+	});
+	if (result || store.getWriteCount() == 0) {
+		store.save();
+	}
+	return fired;
+}
+
+void testScheduleStateStore() {
+	HostDevice &device = HostDevice::instance();
+	LocalTime::instance().withConfig(LocalTimePosixTimezone("PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+
+	remove(EEPROM_FILE);
+	device.setEepromFile(EEPROM_FILE);
+
+	// First boot: the EEPROM is blank, so the schedules start from now
+	{
+		LocalTimeScheduleManager manager;
+		addSchedules(manager);
+		ScheduleStateStore store(manager);
+		assertInt("", store.restore(LocalTime::stringToTime("2022-07-02 04:00:00")), false);
+
+		assertStr("", check(manager, store, "2022-07-02 04:00:00").c_str(), ""); // 21:00 PDT
+		assertInt("", (int)store.getWriteCount(), 1);
+		assertStr("", check(manager, store, "2022-07-02 04:30:00").c_str(), "13 ");
+		assertInt("", (int)store.getWriteCount(), 2);
+
+		// Nothing fired, nothing written
+		assertStr("", check(manager, store, "2022-07-02 04:35:00").c_str(), "");
+		assertInt("", (int)store.getWriteCount(), 2);
+
+		// Saving again without a change doesn't write
+		store.save();
+		assertInt("", (int)store.save(), false);
+	}
+
+	// Restart from 21:40 to 21:50 PDT: 13 doesn't repeat and 14, due at 21:45, fires late
+	{
+		device.setEepromFile(EEPROM_FILE);
+		uint32_t writes = device.eepromWrites;
+
+		LocalTimeScheduleManager manager;
+		addSchedules(manager);
+		ScheduleStateStore store(manager);
+		assertInt("", store.restore(LocalTime::stringToTime("2022-07-02 04:50:00")), true);
+
+		assertStr("", check(manager, store, "2022-07-02 04:50:00").c_str(), "14 ");
+		assertStr("", check(manager, store, "2022-07-02 04:55:00").c_str(), "17 ");
+		assertStr("", check(manager, store, "2022-07-02 05:00:00").c_str(), "15 ");
+
+		// 12 bytes per schedule, and only the times that changed are written
+		assertInt("", (int)ScheduleStateStore::MAX_STATE_SIZE, 108);
+		assertInt("", device.eepromWrites - writes <= 3 * 3 * 8, true);
+	}
+
+	// Down overnight for longer than the catch-up limit: nothing fires late, the next evening is normal
+	{
+		device.setEepromFile(EEPROM_FILE);
+
+		LocalTimeScheduleManager manager;
+		addSchedules(manager);
+		ScheduleStateStore store(manager);
+		assertInt("", store.restore(LocalTime::stringToTime("2022-07-03 06:00:00")), true);
+
+		assertStr("", check(manager, store, "2022-07-03 06:00:00").c_str(), "");
+		assertInt("", (int)manager.getNextEventTime(), (int)LocalTime::stringToTime("2022-07-04 04:30:00"));
+	}
+
+	// A corrupted EEPROM starts from now
+	{
+		device.setEepromFile(EEPROM_FILE);
+		EEPROM.write(9, EEPROM.read(9) ^ 0x40);
+
+		LocalTimeScheduleManager manager;
+		addSchedules(manager);
+		ScheduleStateStore store(manager);
+		assertInt("", store.restore(LocalTime::stringToTime("2022-07-04 04:50:00")), false);
+		assertStr("", check(manager, store, "2022-07-04 04:50:00").c_str(), "");
+	}
+
+	device.eraseEeprom();
+}
+
+int main(int argc, char *argv[]) {
+	testScheduleStateStore();
+	printf("ScheduleStateStoreTest passed\n");
+	return 0;
+}
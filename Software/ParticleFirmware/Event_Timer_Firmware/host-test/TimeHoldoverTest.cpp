@@ -0,0 +1,174 @@
+#include "HostTest.h"
+
+#include "../src/TimeHoldover.h"
+
+// Tests TimeHoldover: the clock starts from the RTC without the cloud, the drift bound grows in
+// holdover, and syncs are slewed or stepped without the clock going backwards
+//
+// make && ./TimeHoldoverTest
+
+const time_t START = 1656720000; // 2022-07-02 00:00:00 UTC
+
+// Runs holdover.loop() every 10 ms of virtual time for seconds, checking the clock never goes
+// backwards and never moves more than maxStep seconds at once
+void runSeconds(TimeHoldover &holdover, int seconds, int maxStep = 1) {
+	for(int ii = 0; ii < seconds * 100; ii++) {
+		time_t before = holdover.now();
+		HostDevice::instance().advanceMicros(10000);
+		holdover.loop();
+		assertInt("", holdover.now() >= before, true);
+		assertInt("", holdover.now() - before <= maxStep, true);
+	}
+}
+
+// Returns true if the clock matches the device's time, or is behind by less than a second: a sync
+// only has whole seconds, so the clock can trail, but it must not be ahead
+bool isSynced(TimeHoldover &holdover) {
+	time_t behind = HostDevice::instance().getTime() - holdover.now();
+	return behind == 0 || behind == 1;
+}
+
+void testTimeHoldover() {
+	HostDevice &device = HostDevice::instance();
+
+	// Starts from the RTC right away, in holdover, with the fixed bound since the last sync is unknown
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+		device.cloudConnected = false;
+
+		TimeHoldover holdover;
+		holdover.begin();
+		assertInt("", holdover.isValid(), true);
+		assertInt("", holdover.isHoldover(), true);
+		assertInt("", (int)(holdover.now() - START), 0);
+		assertInt("", (int)holdover.getUncertaintyMs(), 2000);
+
+		// 100 ppm for an hour is 360 ms
+		runSeconds(holdover, 3600);
+		assertInt("", (int)(holdover.now() - START), 3600);
+		assertInt("", (int)holdover.getUncertaintyMs(), 2360);
+
+		// Connected but not synced yet is still holdover
+		device.cloudConnected = true;
+		assertInt("", holdover.isHoldover(), true);
+	}
+
+	// The last sync time saved before a reset sets the drift bound
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+
+		TimeHoldover holdover;
+		holdover.begin(START - 10 * 3600);
+		assertInt("", (int)holdover.getLastSyncTime(), (int)(START - 10 * 3600));
+		assertInt("", (int)holdover.getUncertaintyMs(), 3600);
+
+		// A saved time after the RTC is garbage
+		TimeHoldover holdover2;
+		holdover2.begin(START + 10);
+		assertInt("", (int)holdover2.getLastSyncTime(), 0);
+	}
+
+	// A sync 3 seconds ahead of the clock is slewed in at 100 ms per second
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+
+		TimeHoldover holdover;
+		holdover.begin();
+		runSeconds(holdover, 60);
+
+		device.syncTime(device.getTime() + 3);
+		holdover.loop();
+		assertInt("", holdover.isHoldover(), false);
+		assertInt("", holdover.getLastSyncErrorMs(), 3000);
+		assertInt("", holdover.getPendingSlewMs(), 3000);
+		assertInt("", (int)(device.getTime() - holdover.now()), 3);
+		assertInt("", (int)holdover.getUncertaintyMs(), 3000);
+
+		runSeconds(holdover, 29);
+		assertInt("", holdover.getPendingSlewMs() > 0, true);
+		runSeconds(holdover, 2);
+		assertInt("", holdover.getPendingSlewMs(), 0);
+		assertInt("", isSynced(holdover), true);
+		assertInt("", (int)holdover.getStepCount(), 0);
+
+		// Once synced, the bound grows from the sync, and disconnecting is holdover again
+		runSeconds(holdover, 1000);
+		assertInt("", (int)holdover.getUncertaintyMs(), 103);
+		device.cloudConnected = false;
+		assertInt("", holdover.isHoldover(), true);
+		device.cloudConnected = true;
+	}
+
+	// A sync 2 seconds behind the clock is slewed out by running slower, never backwards
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+
+		TimeHoldover holdover;
+		holdover.begin();
+		runSeconds(holdover, 60);
+
+		device.syncTime(device.getTime() - 2);
+		runSeconds(holdover, 30);
+		assertInt("", holdover.getPendingSlewMs(), 0);
+		assertInt("", isSynced(holdover), true);
+	}
+
+	// An error within the RTC's resolution is not corrected
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+
+		TimeHoldover holdover;
+		holdover.begin();
+		runSeconds(holdover, 10);
+		device.syncTime(device.getTime());
+		holdover.loop();
+		assertInt("", holdover.getLastSyncErrorMs(), 0);
+		assertInt("", holdover.getPendingSlewMs(), 0);
+	}
+
+	// A large error is stepped, forward or back
+	{
+		device.setTime(START);
+		device.lastTimeSyncMillis = 0;
+
+		TimeHoldover holdover;
+		holdover.begin();
+		runSeconds(holdover, 10);
+
+		device.syncTime(device.getTime() + 120);
+		holdover.loop();
+		assertInt("", (int)holdover.getStepCount(), 1);
+		assertInt("", holdover.getPendingSlewMs(), 0);
+		assertInt("", isSynced(holdover), true);
+
+		runSeconds(holdover, 1);
+		device.syncTime(device.getTime() - 600);
+		holdover.loop();
+		assertInt("", (int)holdover.getStepCount(), 2);
+		assertInt("", isSynced(holdover), true);
+	}
+
+	// A sync before begin() counts, and the time is taken when it becomes valid
+	{
+		device.setTime(START);
+		device.advanceMicros(5000000);
+		device.syncTime(START + 5);
+		device.advanceMicros(2000000);
+
+		TimeHoldover holdover;
+		holdover.begin();
+		assertInt("", holdover.isHoldover(), false);
+		assertInt("", (int)holdover.getLastSyncTime(), (int)(START + 5));
+	}
+}
+
+int main(int argc, char *argv[]) {
+	testTimeHoldover();
+	printf("TimeHoldoverTest passed\n");
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __APPLICATION_H
+#define __APPLICATION_H
+
+// Host replacement for the Device OS application.h, included by the firmware and the LiquidCrystal library
+
+#include "Particle.h"
+
+#endif /* __APPLICATION_H */
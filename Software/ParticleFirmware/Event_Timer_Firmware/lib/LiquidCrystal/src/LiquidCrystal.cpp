@@ -70,6 +70,19 @@ void LiquidCrystal::init(uint8_t fourbitmode, uint8_t rs, uint8_t rw, uint8_t en
     _displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
   //else 
     //_displayfunction = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
+
+  _initialized = 0;
+  _command_us = LCD_COMMAND_US;
+  _clear_us = LCD_CLEAR_US;
+  _ready_at = 0;
+}
+
+// Without an RW pin, each command is followed by a wait of its execution time instead of
+// reading the busy flag. The defaults allow for the slowest controller; a display that is
+// known to be faster can use shorter times.
+void LiquidCrystal::setExecutionTimes(uint16_t commandUs, uint16_t clearUs) {
+  _command_us = commandUs;
+  _clear_us = clearUs;
 }
 
 void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
@@ -103,43 +116,41 @@ void LiquidCrystal::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
   }
 
   // 4-Bit initialization sequence from Technobly
+  // The busy flag can't be read until the display is in 4-bit mode, so wait the execution time
+  _initialized = 0;
   write4bits(0x03);         // Put back into 8-bit mode
-  delayMicroseconds(5000);
+  delayMicroseconds(4100);  // the first function set needs more than 4.1ms
 
   write4bits(0x08);         // Comment this out for V1 OLED
-  delayMicroseconds(5000);  // Comment this out for V1 OLED
+  delayMicroseconds(_command_us);  // Comment this out for V1 OLED
   
   write4bits(0x02);         // Put into 4-bit mode
-  delayMicroseconds(5000);
+  delayMicroseconds(_command_us);
   write4bits(0x02);
-  delayMicroseconds(5000);
   write4bits(0x08);
-  delayMicroseconds(5000);
-  
+  _ready_at = micros() + _command_us;
+  _initialized = 1;
+
+  // From here on send() waits for the busy flag (or the execution time) before each command
   command(LCD_DISPLAYCONTROL);                  // Turn Off
-  delayMicroseconds(5000);
   command(LCD_FUNCTIONSET | _displayfunction);  // Set # lines, font size, etc.
-  delayMicroseconds(5000);
   clear();                                      // Clear Display
   command(LCD_ENTRYMODESET | LCD_ENTRYLEFT);    // Set Entry Mode
-  delayMicroseconds(5000);
   home();                                       // Home Cursor
-  delayMicroseconds(5000);
   command(LCD_DISPLAYCONTROL | LCD_DISPLAYON);  // Turn On - enable cursor & blink
-  delayMicroseconds(5000);
 }
 
 /********** high level commands, for the user! */
 void LiquidCrystal::clear()
 {
   command(LCD_CLEARDISPLAY);  // clear display, set cursor position to zero
-  delayMicroseconds(5000);  // this command takes a long time!
+  // this command takes a long time! send() waits for it before the next command
 }
 
 void LiquidCrystal::home()
 {
   command(LCD_RETURNHOME);  // set cursor position to zero
-  delayMicroseconds(5000);  // this command takes a long time!
+  // this command takes a long time! send() waits for it before the next command
 }
 
 void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
@@ -238,6 +249,9 @@ inline size_t LiquidCrystal::write(uint8_t value) {
 
 // write either command or data, with automatic 4/8-bit selection
 void LiquidCrystal::send(uint8_t value, uint8_t mode) {
+  // wait for the previous command to finish; the caller can do other work in the meantime
+  waitReady();
+
   digitalWrite(_rs_pin, mode);
 
   // if there is a RW pin indicated, set it low to Write
@@ -251,6 +265,57 @@ void LiquidCrystal::send(uint8_t value, uint8_t mode) {
     write4bits(value>>4);
     write4bits(value);
   }
+
+  // clear and home take much longer than the other commands
+  if (mode == LOW && value != 0 && value < LCD_ENTRYMODESET) {
+    _ready_at = micros() + _clear_us;
+  } else {
+    _ready_at = micros() + _command_us;
+  }
+}
+
+// wait until the display can accept another command
+void LiquidCrystal::waitReady() {
+  if (_rw_pin != 255 && _initialized) {
+    uint32_t start = micros();
+    while (readBusyFlag()) {
+      if (micros() - start > LCD_BUSY_TIMEOUT_US) {
+        break;    // not responding, don't hang
+      }
+    }
+  } else {
+    // no wait is ever longer than a clear; anything more means micros() wrapped past _ready_at
+    // after a long idle time
+    int32_t remaining = (int32_t)(_ready_at - micros());
+    if (remaining > 0 && remaining <= (int32_t)_clear_us) {
+      delayMicroseconds(remaining);
+    }
+  }
+}
+
+// read the busy flag (DB7) with RS low and RW high. In 4-bit mode the address counter is
+// clocked out in a second nibble, which is ignored.
+bool LiquidCrystal::readBusyFlag() {
+  for (int i = 0; i < 4; i++) {
+    pinMode(_data_pins[i], INPUT);
+  }
+  digitalWrite(_rs_pin, LOW);
+  digitalWrite(_rw_pin, HIGH);
+
+  digitalWrite(_enable_pin, HIGH);
+  delayMicroseconds(1);    // data is valid 360ns after enable rises
+  bool busy = (digitalRead(_data_pins[3]) == HIGH);
+  digitalWrite(_enable_pin, LOW);
+  delayMicroseconds(1);
+
+  digitalWrite(_enable_pin, HIGH);
+  delayMicroseconds(1);
+  digitalWrite(_enable_pin, LOW);
+  delayMicroseconds(1);
+
+  // write4bits() sets the data pins back to outputs
+  digitalWrite(_rw_pin, LOW);
+  return busy;
 }
 
 void LiquidCrystal::pulseEnable(void) {
@@ -259,7 +324,7 @@ void LiquidCrystal::pulseEnable(void) {
   digitalWrite(_enable_pin, HIGH);
   delayMicroseconds(1);    // enable pulse must be >450ns
   digitalWrite(_enable_pin, LOW);
-  delayMicroseconds(100);   // commands need > 37us to settle
+  delayMicroseconds(1);     // enable cycle time must be >1000ns; send() waits for the command to execute
 }
 
 void LiquidCrystal::write4bits(uint8_t value) {
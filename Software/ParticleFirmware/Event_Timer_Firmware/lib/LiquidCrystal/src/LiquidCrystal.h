@@ -39,6 +39,14 @@
 #define LCD_5x10DOTS 0x04
 #define LCD_5x8DOTS 0x00
 
+// execution times used when the busy flag can't be read (no RW pin), in microseconds.
+// The datasheet gives 37us and 1.52ms at 270kHz; these allow for the slowest oscillator (190kHz).
+#define LCD_COMMAND_US 53
+#define LCD_CLEAR_US 2160
+
+// give up waiting for the busy flag after this long, in microseconds
+#define LCD_BUSY_TIMEOUT_US 10000
+
 class LiquidCrystal : public Print {
 public:
   LiquidCrystal(uint8_t rs, uint8_t enable,
@@ -78,11 +86,16 @@ public:
   void setCursor(uint8_t, uint8_t); 
   virtual size_t write(uint8_t);
   void command(uint8_t);
+
+  // execution times to wait when there is no RW pin (default LCD_COMMAND_US and LCD_CLEAR_US)
+  void setExecutionTimes(uint16_t commandUs, uint16_t clearUs);
 private:
   void send(uint8_t, uint8_t);
   void write4bits(uint8_t);
   void write8bits(uint8_t);
   void pulseEnable();
+  void waitReady();
+  bool readBusyFlag();
 
   uint8_t _rs_pin; // LOW: command.  HIGH: character.
   uint8_t _rw_pin; // LOW: write to LCD.  HIGH: read from LCD.
@@ -93,9 +106,13 @@ private:
   uint8_t _displaycontrol;
   uint8_t _displaymode;
 
-  uint8_t _initialized;
+  uint8_t _initialized; // set once in 4-bit mode, when the busy flag can be read
 
   uint8_t _numlines,_currline;
+
+  uint16_t _command_us;
+  uint16_t _clear_us;
+  uint32_t _ready_at; // micros() when the last command has finished executing
 };
 
 #endif
\ No newline at end of file
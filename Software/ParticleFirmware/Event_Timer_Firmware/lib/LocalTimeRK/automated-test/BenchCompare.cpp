@@ -0,0 +1,218 @@
+#include "Particle.h"
+
+#include <map>
+
+// Compares LocalTimeBench results to a baseline and exits with 1 if any benchmark is significantly
+// slower or allocates more, so it can gate changes to LocalTimeRK:
+//
+// ./BenchCompare bench-baseline.json build/bench.json [bench-thresholds.json]
+//
+// The thresholds file sets how much slower than the baseline each benchmark can be before it counts
+// as a regression, as a fraction, by benchmark name prefix (the longest matching prefix is used):
+//
+// { "default": 0.25, "LocalTimeHMS::parse": 0.5 }
+//
+// Changes of less than MIN_NS_CHANGE are always noise. Allocations are counted exactly, so any
+// increase is a regression, as is a new benchmark that allocates. A benchmark in the baseline that
+// is missing from the results is a failure too, so a renamed benchmark needs a new baseline.
+
+// Slowdown allowed when the thresholds file doesn't set one
+const double DEFAULT_THRESHOLD = 0.25;
+
+// A change in time per call smaller than this is never a regression
+const double MIN_NS_CHANGE = 10.0;
+
+// LocalTimeBench runs whole cycles of the times it steps through, so the allocations per call are
+// the same every run; this only covers the rounding to 3 decimal places in the JSON
+const double ALLOC_TOLERANCE = 0.002;
+
+// One benchmark from a LocalTimeBench JSON file
+class BenchEntry {
+public:
+	double nsPerOp = 0;
+	double allocsPerOp = 0;
+};
+
+char *readFile(const char *filename) {
+	FILE *fd = fopen(filename, "r");
+	if (!fd) {
+		printf("failed to open %s\n", filename);
+		return 0;
+	}
+
+	fseek(fd, 0, SEEK_END);
+	size_t size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+
+	char *data = (char *) malloc(size + 1);
+	size = fread(data, 1, size, fd);
+	data[size] = 0;
+
+	fclose(fd);
+
+	return data;
+}
+
+// Reads the benchmarks from a LocalTimeBench JSON file, in order, into names and entries. Returns false on error.
+bool readResults(const char *filename, std::vector<String> &names, std::map<String, BenchEntry> &entries) {
+	char *data = readFile(filename);
+	if (!data) {
+		return false;
+	}
+	JSONValue outerObj = JSONValue::parseCopy(data);
+	free(data);
+
+	if (!outerObj.isObject()) {
+		printf("%s is not a JSON object\n", filename);
+		return false;
+	}
+
+	JSONObjectIterator outerIter(outerObj);
+	while(outerIter.next()) {
+		if (outerIter.name() != "benchmarks" || !outerIter.value().isArray()) {
+			continue;
+		}
+		JSONArrayIterator arrayIter(outerIter.value());
+		while(arrayIter.next()) {
+			String name;
+			BenchEntry entry;
+
+			JSONObjectIterator iter(arrayIter.value());
+			while(iter.next()) {
+				if (iter.name() == "name") {
+					name = (const char *) iter.value().toString();
+				}
+				else
+				if (iter.name() == "ns_per_op") {
+					entry.nsPerOp = iter.value().toDouble();
+				}
+				else
+				if (iter.name() == "allocs_per_op") {
+					entry.allocsPerOp = iter.value().toDouble();
+				}
+			}
+			if (name.length() == 0) {
+				printf("%s has a benchmark without a name\n", filename);
+				return false;
+			}
+			names.push_back(name);
+			entries[name] = entry;
+		}
+		return true;
+	}
+
+	printf("%s has no benchmarks array\n", filename);
+	return false;
+}
+
+// Reads the thresholds file. Returns false on error.
+bool readThresholds(const char *filename, std::map<String, double> &thresholds) {
+	char *data = readFile(filename);
+	if (!data) {
+		return false;
+	}
+	JSONValue outerObj = JSONValue::parseCopy(data);
+	free(data);
+
+	if (!outerObj.isObject()) {
+		printf("%s is not a JSON object\n", filename);
+		return false;
+	}
+
+	JSONObjectIterator iter(outerObj);
+	while(iter.next()) {
+		thresholds[(const char *) iter.name()] = iter.value().toDouble();
+	}
+	return true;
+}
+
+// Returns the slowdown allowed for the benchmark name
+double getThreshold(const std::map<String, double> &thresholds, const String &name) {
+	double result = DEFAULT_THRESHOLD;
+	size_t matchLen = 0;
+
+	for(auto it = thresholds.begin(); it != thresholds.end(); ++it) {
+		if (it->first == "default") {
+			if (matchLen == 0) {
+				result = it->second;
+			}
+		}
+		else
+		if (name.startsWith(it->first) && it->first.length() > matchLen) {
+			result = it->second;
+			matchLen = it->first.length();
+		}
+	}
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		printf("usage: BenchCompare baseline.json results.json [thresholds.json]\n");
+		return 2;
+	}
+
+	std::vector<String> baseNames, newNames;
+	std::map<String, BenchEntry> baseEntries, newEntries;
+	std::map<String, double> thresholds;
+	if (!readResults(argv[1], baseNames, baseEntries) || !readResults(argv[2], newNames, newEntries)) {
+		return 2;
+	}
+	if (argc >= 4 && !readThresholds(argv[3], thresholds)) {
+		return 2;
+	}
+
+	int regressions = 0;
+	printf("%-50s %12s %12s %8s %6s %11s %11s\n", "benchmark", "base ns/op", "new ns/op", "change", "limit", "base allocs", "new allocs");
+
+	for(auto it = newNames.begin(); it != newNames.end(); ++it) {
+		const BenchEntry &entry = newEntries[*it];
+		auto baseIt = baseEntries.find(*it);
+		if (baseIt == baseEntries.end()) {
+			// Not in the baseline, so not a regression unless it allocates
+			const char *status = "  new";
+			if (entry.allocsPerOp > ALLOC_TOLERANCE) {
+				status = "  new, ALLOCATES";
+				regressions++;
+			}
+			printf("%-50s %12s %12.1f %8s %6s %11s %11.2f%s\n", it->c_str(), "-", entry.nsPerOp, "", "", "-", entry.allocsPerOp, status);
+			continue;
+		}
+		const BenchEntry &base = baseIt->second;
+
+		double threshold = getThreshold(thresholds, *it);
+		double change = (base.nsPerOp > 0) ? (entry.nsPerOp - base.nsPerOp) / base.nsPerOp : 0;
+
+		const char *status = "";
+		if (change > threshold && entry.nsPerOp - base.nsPerOp >= MIN_NS_CHANGE) {
+			status = "  SLOWER";
+			regressions++;
+		}
+		else
+		if (entry.allocsPerOp > base.allocsPerOp + ALLOC_TOLERANCE) {
+			status = "  MORE ALLOCATIONS";
+			regressions++;
+		}
+		else
+		if (change < -threshold && base.nsPerOp - entry.nsPerOp >= MIN_NS_CHANGE) {
+			status = "  faster";
+		}
+
+		printf("%-50s %12.1f %12.1f %+7.1f%% %5.0f%% %11.2f %11.2f%s\n", it->c_str(), base.nsPerOp, entry.nsPerOp,
+			change * 100, threshold * 100, base.allocsPerOp, entry.allocsPerOp, status);
+	}
+
+	for(auto it = baseNames.begin(); it != baseNames.end(); ++it) {
+		if (newEntries.find(*it) == newEntries.end()) {
+			printf("%-50s MISSING from the results\n", it->c_str());
+			regressions++;
+		}
+	}
+
+	if (regressions) {
+		printf("%d regression%s\n", regressions, (regressions == 1) ? "" : "s");
+		return 1;
+	}
+	printf("no regressions\n");
+	return 0;
+}
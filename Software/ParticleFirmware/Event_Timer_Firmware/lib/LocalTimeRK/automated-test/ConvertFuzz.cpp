@@ -0,0 +1,314 @@
+#include "Particle.h"
+#include "LocalTimeRK.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <time.h>
+
+// Differential test of LocalTimeConvert against the C library: generates random POSIX timezone
+// strings and times from 1970 to 2100, and compares the local time, DST flag and zone name with
+// localtime_r() with TZ set to the same string. It also checks that converting the local time back
+// with LocalTimeValue::toUTC() gives the same local time, and that the local time only goes backwards
+// at a transition to standard time. Needs glibc, which implements POSIX TZ rules itself.
+//
+// ./ConvertFuzz [zones] [seed]
+//
+// Prints the seed so a failure can be repeated, the first mismatches, and the conversions per second
+// for LocalTimeConvert and localtime_r().
+
+const time_t MIN_TIME = 0; // 1970-01-01 00:00:00
+const time_t MAX_TIME = 4133980799; // 2100-12-31 23:59:59
+
+// Random times per zone, plus the seconds around the transitions in TRANSITION_YEARS random years
+const int RANDOM_TIMES = 200;
+const int TRANSITION_YEARS = 4;
+
+// Mismatches printed before only counting them
+const int MAX_PRINTED = 10;
+
+std::mt19937_64 rng;
+
+int randomInt(int min, int max) {
+	return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+// Three to five letters, like a timezone abbreviation
+String randomName() {
+	String result;
+	int len = randomInt(3, 5);
+	for(int ii = 0; ii < len; ii++) {
+		result += (char)('A' + randomInt(0, 25));
+	}
+	return result;
+}
+
+// An offset or a transition time: [+|-]hh[:mm[:ss]]. seconds is the value in seconds, with the POSIX sign.
+String randomHMS(int minHour, int maxHour, int &seconds) {
+	static const int minutes[] = { 0, 0, 0, 0, 15, 30, 30, 45 };
+	int hour = randomInt(minHour, maxHour);
+	int minute = minutes[randomInt(0, sizeof(minutes) / sizeof(minutes[0]) - 1)];
+	int second = (randomInt(0, 19) == 0) ? randomInt(1, 59) : 0;
+
+	if (hour == 0 && minHour < 0) {
+		// -0:30 is not the same as 0:30, but LocalTimeHMS keeps the sign in the hour
+		minute = second = 0;
+	}
+
+	String result;
+	if (hour >= 0 && randomInt(0, 3) == 0) {
+		result += "+";
+	}
+	result += String(hour);
+	if (minute || second || randomInt(0, 3) == 0) {
+		result += String::format(":%02d", minute);
+		if (second || randomInt(0, 3) == 0) {
+			result += String::format(":%02d", second);
+		}
+	}
+
+	int absSeconds = abs(hour) * 3600 + minute * 60 + second;
+	seconds = (hour < 0) ? -absSeconds : absSeconds;
+	return result;
+}
+
+// A transition rule, Mm.w.d[/time], in rule, and the same rule for the C library in libcRule.
+// LocalTimeRK documents a rule without a time as midnight, where POSIX says 2:00:00, so the C library
+// is given the time explicitly.
+void randomRule(String &rule, String &libcRule) {
+	rule = String::format("M%d.%d.%d", randomInt(1, 12), randomInt(1, 5), randomInt(0, 6));
+	if (randomInt(0, 4) != 0) {
+		int seconds;
+		rule += "/" + randomHMS(0, 23, seconds);
+		libcRule = rule;
+	}
+	else {
+		libcRule = rule + "/0";
+	}
+}
+
+// A timezone string that LocalTimePosixTimezone can parse: std offset [dst [offset] ,start[/time],end[/time]],
+// and the same timezone for the C library in libcTz
+String randomTimezone(String &libcTz) {
+	int stdSeconds, dstSeconds;
+	String result = randomName() + randomHMS(-12, 12, stdSeconds);
+	libcTz = result;
+
+	if (randomInt(0, 9) < 7) {
+		String dstName = randomName();
+		while(dstName == result.substring(0, dstName.length())) {
+			dstName = randomName();
+		}
+		result += dstName;
+
+		if (randomInt(0, 2) == 0) {
+			// Explicit DST offset, usually an hour ahead of standard time
+			int hours = (randomInt(0, 3) == 0) ? 2 : 1;
+			int dstHour = (stdSeconds >= 0 ? stdSeconds / 3600 : -((-stdSeconds) / 3600)) - hours;
+			if (dstHour == 0 && stdSeconds < 0) {
+				dstHour = -1;
+			}
+			result += randomHMS(dstHour, dstHour, dstSeconds);
+		}
+		libcTz = result;
+
+		String startRule, libcStartRule, endRule, libcEndRule;
+		randomRule(startRule, libcStartRule);
+		randomRule(endRule, libcEndRule);
+		while(endRule.substring(0, 3) == startRule.substring(0, 3)) {
+			// Both transitions in the same month is legal, but not a real timezone
+			randomRule(endRule, libcEndRule);
+		}
+		result += "," + startRule + "," + endRule;
+		libcTz += "," + libcStartRule + "," + libcEndRule;
+	}
+	return result;
+}
+
+// Seconds since the epoch of a broken-down time, as if it were UTC, to compare local times
+time_t localSeconds(const struct tm &tm) {
+	struct tm temp = tm;
+	return timegm(&temp);
+}
+
+// The results of converting one time
+class FuzzSample {
+public:
+	time_t time;
+	struct tm libc;
+	LocalTimeValue local;
+	bool isDST;
+	String zoneName;
+};
+
+// Counts and prints mismatches
+class FuzzFailures {
+public:
+	void add(const String &tz, time_t time, const char *what, const String &detail) {
+		if (count++ < MAX_PRINTED) {
+			printf("TZ=\"%s\" %s (%lld): %s: %s\n", tz.c_str(), LocalTime::timeToString(time).c_str(), (long long)time, what, detail.c_str());
+		}
+	}
+
+	int count = 0;
+};
+
+String tmToString(const struct tm &tm) {
+	return String::format("%04d-%02d-%02d %02d:%02d:%02d wday=%d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_wday);
+}
+
+bool sameLocalTime(const struct tm &a, const struct tm &b) {
+	return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday &&
+		a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec && a.tm_wday == b.tm_wday;
+}
+
+// Total time in each converter, for the throughput
+double convertNs = 0;
+double libcNs = 0;
+uint64_t conversions = 0;
+
+// Adds the times around each change of localtime_r()'s UTC offset in year, found by stepping through
+// the year 6 hours at a time and bisecting
+void addTransitionTimes(int year, std::vector<time_t> &times) {
+	struct tm tm = {};
+	tm.tm_year = year - 1900;
+	tm.tm_mday = 1;
+	time_t start = timegm(&tm);
+	tm.tm_year++;
+	time_t end = timegm(&tm);
+
+	struct tm prev, cur;
+	localtime_r(&start, &prev);
+	for(time_t t = start + 6 * 3600; t <= end; t += 6 * 3600) {
+		localtime_r(&t, &cur);
+		if (cur.tm_gmtoff != prev.tm_gmtoff) {
+			time_t lo = t - 6 * 3600, hi = t;
+			while(hi - lo > 1) {
+				time_t mid = lo + (hi - lo) / 2;
+				struct tm midTm;
+				localtime_r(&mid, &midTm);
+				if (midTm.tm_gmtoff == prev.tm_gmtoff) {
+					lo = mid;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			for(time_t tt = hi - 2; tt <= hi + 1; tt++) {
+				times.push_back(tt);
+			}
+		}
+		prev = cur;
+	}
+}
+
+void fuzzZone(const String &tz, const String &libcTz, FuzzFailures &failures) {
+	setenv("TZ", libcTz.c_str(), 1);
+	tzset();
+
+	LocalTimePosixTimezone config(tz.c_str());
+	if (!config.isValid()) {
+		failures.add(tz, 0, "parse", "not valid");
+		return;
+	}
+
+	std::vector<time_t> times;
+	for(int ii = 0; ii < RANDOM_TIMES; ii++) {
+		times.push_back(std::uniform_int_distribution<time_t>(MIN_TIME, MAX_TIME)(rng));
+	}
+	for(int ii = 0; ii < TRANSITION_YEARS; ii++) {
+		addTransitionTimes(randomInt(1971, 2099), times);
+	}
+	std::sort(times.begin(), times.end());
+
+	std::vector<FuzzSample> samples(times.size());
+	LocalTimeConvert conv;
+	conv.withConfig(config);
+
+	auto begin = std::chrono::steady_clock::now();
+	for(size_t ii = 0; ii < times.size(); ii++) {
+		conv.withTime(times[ii]).convert();
+		samples[ii].local = conv.localTimeValue;
+		samples[ii].isDST = conv.isDST();
+	}
+	auto middle = std::chrono::steady_clock::now();
+	for(size_t ii = 0; ii < times.size(); ii++) {
+		localtime_r(&times[ii], &samples[ii].libc);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	convertNs += std::chrono::duration<double, std::nano>(middle - begin).count();
+	libcNs += std::chrono::duration<double, std::nano>(end - middle).count();
+	conversions += times.size();
+
+	for(size_t ii = 0; ii < samples.size(); ii++) {
+		FuzzSample &sample = samples[ii];
+		sample.time = times[ii];
+
+		// Same local time, DST flag, and zone name as the C library
+		if (!sameLocalTime(sample.local, sample.libc)) {
+			failures.add(tz, sample.time, "local time", "LocalTimeConvert " + tmToString(sample.local) + " localtime_r " + tmToString(sample.libc));
+			continue;
+		}
+		if (config.hasDST() && sample.isDST != (sample.libc.tm_isdst > 0)) {
+			failures.add(tz, sample.time, "isDST", String::format("LocalTimeConvert %d localtime_r %d", sample.isDST, sample.libc.tm_isdst));
+			continue;
+		}
+		if (!config.isZ()) {
+			conv.withTime(sample.time).convert();
+			sample.zoneName = conv.zoneName();
+			if (sample.zoneName != sample.libc.tm_zone) {
+				failures.add(tz, sample.time, "zone name", "LocalTimeConvert " + sample.zoneName + " localtime_r " + sample.libc.tm_zone);
+				continue;
+			}
+		}
+
+		// Round trip: toUTC() gives this time, or the other one with the same local time when the
+		// clock goes back
+		time_t utc = sample.local.toUTC(config);
+		conv.withTime(utc).convert();
+		if (!sameLocalTime(conv.localTimeValue, sample.local)) {
+			failures.add(tz, sample.time, "toUTC", String::format("%s gave %lld, which is ", tmToString(sample.local).c_str(), (long long)utc) + tmToString(conv.localTimeValue));
+			continue;
+		}
+		if (utc != sample.time && (!config.hasDST() || labs(utc - sample.time) != labs(config.standardHMS.toSeconds() - config.dstHMS.toSeconds()))) {
+			failures.add(tz, sample.time, "toUTC", String::format("%s gave %lld", tmToString(sample.local).c_str(), (long long)utc));
+			continue;
+		}
+
+		// Monotonic: a later time has a later local time, except across a change to standard time
+		if (ii > 0 && samples[ii - 1].time < sample.time) {
+			const FuzzSample &prev = samples[ii - 1];
+			if (localSeconds(sample.local) <= localSeconds(prev.local) && !(prev.isDST && !sample.isDST)) {
+				failures.add(tz, sample.time, "monotonic", "after " + tmToString(prev.local) + " came " + tmToString(sample.local));
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int zones = (argc > 1) ? atoi(argv[1]) : 2000;
+	uint64_t seed = (argc > 2) ? strtoull(argv[2], 0, 10) : (uint64_t)time(0);
+	rng.seed(seed);
+	printf("%d zones, seed %llu\n", zones, (unsigned long long)seed);
+
+	FuzzFailures failures;
+	auto begin = std::chrono::steady_clock::now();
+	for(int ii = 0; ii < zones; ii++) {
+		String libcTz;
+		String tz = randomTimezone(libcTz);
+		fuzzZone(tz, libcTz, failures);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	printf("%llu times in %.1f s: LocalTimeConvert %.0f conversions/s, localtime_r %.0f conversions/s\n",
+		(unsigned long long)conversions, seconds, conversions / (convertNs / 1e9), conversions / (libcNs / 1e9));
+
+	if (failures.count) {
+		printf("%d mismatches\n", failures.count);
+		return 1;
+	}
+	printf("no mismatches\n");
+	return 0;
+}
@@ -0,0 +1,259 @@
+#include "Particle.h"
+#include "LocalTimeRK.h"
+#include "alloc_counter.h"
+
+#include <chrono>
+#include <functional>
+#include <time.h>
+
+// Microbenchmarks for the LocalTimeRK calls the firmware makes often. For each benchmark, prints the
+// time per call and the heap allocations and bytes allocated per call as JSON, for example to compare with a saved
+// baseline. Like TimeTest, run it with TZ set to "UTC":
+//
+// export TZ='UTC' && ./LocalTimeBench [name filter]
+//
+// Only the benchmarks whose name contains the filter are run, if one is given.
+
+// Each benchmark is run RUNS times for at least RUN_NS each, after finding the number of iterations
+// to use, and the fastest run is reported: the slower ones were interrupted or had a cold cache
+const double RUN_NS = 20e6;
+const int RUNS = 5;
+
+// The benchmarks that step through times repeat every CYCLE_ITERATIONS calls, and the iterations are
+// a multiple of it, so the allocations per call are the same every time
+const uint64_t CYCLE_ITERATIONS = 128;
+
+// Result of one benchmark
+class BenchResult {
+public:
+	String name;
+	uint64_t iterations;
+	double nsPerOp;
+	double allocsPerOp;
+	double bytesPerOp;
+};
+
+std::vector<BenchResult> results;
+const char *nameFilter = "";
+
+// Added to by the benchmarks so the calls being measured can't be optimized away
+volatile time_t sink;
+
+// Runs fn(ii) for ii from 0 to iterations - 1 and returns the elapsed nanoseconds, and the allocations
+// and bytes allocated in allocs and bytes
+double runIterations(const std::function<void(uint64_t ii)> &fn, uint64_t iterations, size_t &allocs, size_t &bytes) {
+	AllocCounter counter;
+	auto begin = std::chrono::steady_clock::now();
+	for(uint64_t ii = 0; ii < iterations; ii++) {
+		fn(ii);
+	}
+	auto end = std::chrono::steady_clock::now();
+	allocs = counter.getAllocations();
+	bytes = counter.getBytes();
+
+	return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+// Runs fn(ii) with increasing iterations until it takes long enough, and saves the result
+void bench(const char *name, const std::function<void(uint64_t ii)> &fn) {
+	if (!strstr(name, nameFilter)) {
+		return;
+	}
+
+	uint64_t iterations = CYCLE_ITERATIONS;
+	size_t allocs, bytes;
+	double ns = runIterations(fn, iterations, allocs, bytes);
+	while(ns < RUN_NS) {
+		// Aim for 20% over, growing by at most 100 times per round
+		uint64_t next = (ns > 0) ? (uint64_t)((double)iterations * RUN_NS * 1.2 / ns) : iterations * 100;
+		if (next > iterations * 100) {
+			next = iterations * 100;
+		}
+		next = (next + CYCLE_ITERATIONS - 1) / CYCLE_ITERATIONS * CYCLE_ITERATIONS;
+		if (next <= iterations) {
+			next = iterations + CYCLE_ITERATIONS;
+		}
+		iterations = next;
+		ns = runIterations(fn, iterations, allocs, bytes);
+	}
+
+	for(int run = 1; run < RUNS; run++) {
+		double runNs = runIterations(fn, iterations, allocs, bytes);
+		if (runNs < ns) {
+			ns = runNs;
+		}
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.nsPerOp = ns / (double)iterations;
+	result.allocsPerOp = (double)allocs / (double)iterations;
+	result.bytesPerOp = (double)bytes / (double)iterations;
+	results.push_back(result);
+
+	fprintf(stderr, "%-50s %12.1f ns/op %8.2f allocs/op %9.1f bytes/op\n", name, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+}
+
+const char *TIMEZONE = "PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00";
+
+// Spread the times over a year, and not on round seconds, so the benchmarks cover DST and all of the
+// days of the week and month
+time_t benchTime(uint64_t ii) {
+	static time_t start = LocalTime::stringToTime("2022-03-01 00:00:00");
+	return start + (time_t)(ii % CYCLE_ITERATIONS) * (365 * 24 * 3600 / CYCLE_ITERATIONS + 17);
+}
+
+void benchConversions() {
+	LocalTimeConvert conv;
+	conv.withConfig(LocalTimePosixTimezone(TIMEZONE));
+
+	bench("LocalTimeConvert::convert", [&](uint64_t ii) {
+		conv.withTime(benchTime(ii)).convert();
+		sink += conv.localTimeValue.hour();
+	});
+
+	conv.withTime(benchTime(0)).convert();
+	bench("LocalTimeConvert::format", [&](uint64_t ii) {
+		String s = conv.format(TIME_FORMAT_ISO8601_FULL);
+		sink += s.length();
+	});
+
+	bench("LocalTimePosixTimezone::parse", [&](uint64_t ii) {
+		LocalTimePosixTimezone tz;
+		tz.parse(TIMEZONE);
+		sink += tz.standardHMS.toSeconds();
+	});
+
+	bench("LocalTimeHMS::parse", [&](uint64_t ii) {
+		LocalTimeHMS hms;
+		hms.parse("21:30:00");
+		sink += hms.toSeconds();
+	});
+}
+
+void benchScheduleItem(const char *name, const LocalTimeSchedule &schedule) {
+	LocalTimeConvert conv;
+	conv.withConfig(LocalTimePosixTimezone(TIMEZONE));
+	const LocalTimeScheduleItem &item = schedule.scheduleItems[0];
+
+	bench(name, [&](uint64_t ii) {
+		conv.withTime(benchTime(ii)).convert();
+		if (item.getNextScheduledTime(conv)) {
+			sink += conv.time;
+		}
+	});
+}
+
+void benchScheduleItems() {
+	{
+		LocalTimeSchedule schedule;
+		schedule.withMinuteOfHour(15, LocalTimeRange(LocalTimeHMS("09:00:00"), LocalTimeHMS("16:59:59")));
+		benchScheduleItem("getNextScheduledTime/MINUTE_OF_HOUR", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withHourOfDay(4);
+		benchScheduleItem("getNextScheduledTime/HOUR_OF_DAY", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withDayOfWeekOfMonth(LocalTimeDayOfWeek::DAY_MONDAY, 1, LocalTimeHMS("09:00:00"));
+		benchScheduleItem("getNextScheduledTime/DAY_OF_WEEK_OF_MONTH", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withDayOfMonth(1, LocalTimeRange(LocalTimeHMS("12:00:00")));
+		benchScheduleItem("getNextScheduledTime/DAY_OF_MONTH", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withTime(LocalTimeHMSRestricted(LocalTimeHMS("21:30:00")));
+		benchScheduleItem("getNextScheduledTime/TIME", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withRecurrenceRule("20220104T190000", "FREQ=WEEKLY;INTERVAL=2;BYDAY=TU");
+		benchScheduleItem("getNextScheduledTime/RECURRENCE_RULE", schedule);
+	}
+	{
+		LocalTimeSchedule schedule;
+		schedule.withCron("*/15 9-16 * * MON-FRI");
+		benchScheduleItem("getNextScheduledTime/CRON", schedule);
+	}
+}
+
+// numSchedules daily schedules named "s0", "s1", ..., at times spread over the day
+void addSchedules(LocalTimeScheduleManager &manager, int numSchedules) {
+	for(int ii = 0; ii < numSchedules; ii++) {
+		int seconds = (ii * 7 * 60 + ii) % (24 * 60 * 60);
+		LocalTimeHMS hms(String::format("%02d:%02d:%02d", seconds / 3600, (seconds / 60) % 60, seconds % 60).c_str());
+
+		manager.getScheduleByName(String::format("s%d", ii).c_str())
+			.withTime(LocalTimeHMSRestricted(hms))
+			.withFlags(LocalTimeSchedule::FLAG_FULL_WAKE);
+	}
+}
+
+void benchScheduleManager() {
+	// UTC, so every day has each schedule once and the allocations don't depend on the number of
+	// iterations; the getNextScheduledTime benchmarks cover DST
+	LocalTime::instance().withConfig(LocalTimePosixTimezone("UTC0"));
+
+	const int sizes[] = { 1, 10, 100, 1000 };
+	for(size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++) {
+		int numSchedules = sizes[ss];
+		LocalTimeScheduleManager manager;
+		addSchedules(manager, numSchedules);
+		String lastName = String::format("s%d", numSchedules - 1);
+
+		// The time keeps going forward from run to run, a day each CYCLE_ITERATIONS calls, so each
+		// schedule fires once per cycle
+		LocalTimeConvert conv;
+		time_t checkTime = LocalTime::stringToTime("2022-03-01 00:00:00");
+		conv.withTime(checkTime).convert();
+		manager.checkSchedules(conv);
+		bench(String::format("LocalTimeScheduleManager::checkSchedules/%d", numSchedules).c_str(), [&](uint64_t ii) {
+			checkTime += 24 * 3600 / CYCLE_ITERATIONS;
+			conv.withTime(checkTime).convert();
+			if (manager.checkSchedules(conv)) {
+				sink += manager.getNextEventTime();
+			}
+		});
+
+		bench(String::format("LocalTimeScheduleManager::getNextWake/%d", numSchedules).c_str(), [&](uint64_t ii) {
+			conv.withTime(benchTime(ii)).convert();
+			sink += manager.getNextWake(conv);
+		});
+
+		bench(String::format("LocalTimeScheduleManager::getScheduleByName/%d", numSchedules).c_str(), [&](uint64_t ii) {
+			sink += manager.getScheduleByName(lastName.c_str()).nextTime;
+		});
+	}
+}
+
+void printResults() {
+	printf("{\n");
+	printf("  \"benchmarks\": [\n");
+	for(size_t ii = 0; ii < results.size(); ii++) {
+		const BenchResult &result = results[ii];
+		printf("    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}%s\n",
+			result.name.c_str(), (unsigned long long)result.iterations, result.nsPerOp, result.allocsPerOp, result.bytesPerOp,
+			(ii + 1 < results.size()) ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		nameFilter = argv[1];
+	}
+
+	benchConversions();
+	benchScheduleItems();
+	benchScheduleManager();
+
+	printResults();
+	return 0;
+}
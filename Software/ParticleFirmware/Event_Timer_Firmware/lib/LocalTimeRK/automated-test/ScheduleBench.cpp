@@ -0,0 +1,107 @@
+#include "Particle.h"
+#include "LocalTimeRK.h"
+
+#include <chrono>
+#include <time.h>
+
+// Compares the time to find the next scheduled time for cron expressions against an equivalent
+// set of the other schedule item types. Like TimeTest, run it with TZ set to "UTC":
+//
+// export TZ='UTC' && ./ScheduleBench
+//
+// It exits with 1 if the two sides of any comparison give different times.
+
+// Calls getNextScheduledTime on each item (uncached) from iterations start times, spaced stepSeconds apart.
+// Returns the average nanoseconds per call, and the sum of the results in checksum so the calls
+// can't be optimized away and the two sides can be compared.
+double benchItems(const LocalTimeSchedule &schedule, int iterations, int stepSeconds, time_t &checksum) {
+	LocalTimeConvert conv;
+	conv.withConfig(LocalTimePosixTimezone("PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
+	time_t start = LocalTime::stringToTime("2022-03-01 00:00:00");
+
+	checksum = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for(int ii = 0; ii < iterations; ii++) {
+		conv.withTime(start + (time_t)ii * stepSeconds).convert();
+
+		time_t closest = 0;
+		for(auto it = schedule.scheduleItems.begin(); it != schedule.scheduleItems.end(); ++it) {
+			LocalTimeConvert tempConv(conv);
+			if (it->getNextScheduledTime(tempConv) && (closest == 0 || tempConv.time < closest)) {
+				closest = tempConv.time;
+			}
+		}
+		checksum += closest;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+// Returns true if both schedules gave the same times
+bool compare(const char *title, const LocalTimeSchedule &cronSchedule, const LocalTimeSchedule &itemSchedule, int iterations, int stepSeconds) {
+	time_t cronChecksum, itemChecksum;
+	double cronNs = benchItems(cronSchedule, iterations, stepSeconds, cronChecksum);
+	double itemNs = benchItems(itemSchedule, iterations, stepSeconds, itemChecksum);
+
+	printf("%-40s cron %10.0f ns/op  items %10.0f ns/op  %s\n", title, cronNs, itemNs,
+		(cronChecksum == itemChecksum) ? "same times" : "DIFFERENT TIMES");
+	return cronChecksum == itemChecksum;
+}
+
+int main(int argc, char *argv[]) {
+	const int iterations = 2000;
+	int different = 0;
+
+	{
+		LocalTimeSchedule cronSchedule;
+		cronSchedule.withCron("*/15 9-16 * * MON-FRI");
+
+		LocalTimeSchedule itemSchedule;
+		itemSchedule.withMinuteOfHour(15, LocalTimeRange(LocalTimeHMS("09:00:00"), LocalTimeHMS("16:59:59"), LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_WEEKDAY)));
+
+		different += !compare("every 15 min 9-5 weekdays", cronSchedule, itemSchedule, iterations, 617);
+	}
+	{
+		LocalTimeSchedule cronSchedule;
+		cronSchedule.withCron("0 21 * * *");
+
+		LocalTimeSchedule itemSchedule;
+		itemSchedule.withTime(LocalTimeHMSRestricted(LocalTimeHMS("21:00:00")));
+
+		different += !compare("daily at 21:00", cronSchedule, itemSchedule, iterations, 617);
+	}
+	{
+		LocalTimeSchedule cronSchedule;
+		cronSchedule.withCron("30,45,55 21 * * *");
+
+		LocalTimeSchedule itemSchedule;
+		itemSchedule.withTimes({LocalTimeHMSRestricted(LocalTimeHMS("21:30:00")), LocalTimeHMSRestricted(LocalTimeHMS("21:45:00")), LocalTimeHMSRestricted(LocalTimeHMS("21:55:00"))});
+
+		different += !compare("daily at 21:30, 21:45, 21:55", cronSchedule, itemSchedule, iterations, 617);
+	}
+	{
+		LocalTimeSchedule cronSchedule;
+		cronSchedule.withCron("0 */4 * * *");
+
+		LocalTimeSchedule itemSchedule;
+		itemSchedule.withHourOfDay(4);
+
+		different += !compare("every 4 hours", cronSchedule, itemSchedule, iterations, 617);
+	}
+	{
+		LocalTimeSchedule cronSchedule;
+		cronSchedule.withCron("0 12 1 * *");
+
+		LocalTimeSchedule itemSchedule;
+		itemSchedule.withDayOfMonth(1, LocalTimeRange(LocalTimeHMS("12:00:00")));
+
+		different += !compare("monthly on the 1st at 12:00", cronSchedule, itemSchedule, iterations, 3617);
+	}
+
+	if (different) {
+		printf("%d comparisons gave different times\n", different);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,520 @@
+#include "Particle.h"
+#include "LocalTimeRK.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <time.h>
+#include <vector>
+
+// Soak test of the schedules over a century: runs a schedule of each item type through every
+// timezone in the testfiles fixtures from 2000 to 2105, which covers more than 200 DST changes, the
+// leap year in 2000 and the one that isn't in 2100, and more than 100 year boundaries. Each schedule
+// is followed with LocalTimeSchedule::getNextScheduledTime() from each event to the next, the cached
+// path the firmware uses, and the events are compared with a slow reference that lists the local
+// times each day and converts them to UTC with the C library. Needs glibc, which implements POSIX
+// TZ rules itself.
+//
+// ./ScheduleSoak [years] [filter]
+//
+// Prints the first mismatches, and the events per second for the schedules and the reference.
+
+const int START_YEAR = 2000;
+
+// Mismatches printed before only counting them
+const int MAX_PRINTED = 10;
+
+// The timezones of testfiles/test01.txt to test07.txt
+struct SoakZone {
+	const char *name;
+	const char *tz;
+};
+
+const SoakZone zones[] = {
+	{ "New York", "EST5EDT,M3.2.0/02:00:00,M11.1.0/02:00:00" },
+	{ "Chicago", "CST6CDT,M3.2.0/2:00:00,M11.1.0/2:00:00" },
+	{ "Denver", "MST7MDT,M3.2.0/2:00:00,M11.1.0/2:00:00" },
+	{ "Los Angeles", "PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00" },
+	{ "London", "BST0GMT,M3.5.0/1:00:00,M10.5.0/2:00:00" },
+	{ "Sydney", "AEST-10AEDT,M10.1.0/02:00:00,M4.1.0/03:00:00" },
+	{ "Adelaide", "ACST-9:30ACDT,M10.1.0/02:00:00,M4.1.0/03:00:00" },
+};
+
+//
+// Calendar for the reference, kept separate from the one in LocalTimeRK
+//
+bool isLeapYear(int year) {
+	return (year % 4) == 0 && ((year % 100) != 0 || (year % 400) == 0);
+}
+
+int daysInMonth(int year, int month) {
+	static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	return (month == 2 && isLeapYear(year)) ? 29 : days[month - 1];
+}
+
+// A local date. dayNumber is days since 1970-01-01, so a local time as if it were UTC is
+// dayNumber * 86400 + seconds of the day.
+struct SoakDay {
+	int dayNumber;
+	int year;
+	int month;
+	int day;
+	int dayOfWeek; // 0 = Sunday
+	int lastDay;
+};
+
+SoakDay firstDay(int year) {
+	SoakDay result = {};
+	for(int yy = 1970; yy < year; yy++) {
+		result.dayNumber += isLeapYear(yy) ? 366 : 365;
+	}
+	result.year = year;
+	result.month = 1;
+	result.day = 1;
+	result.dayOfWeek = (result.dayNumber + 4) % 7; // 1970-01-01 was a Thursday
+	result.lastDay = 31;
+	return result;
+}
+
+void nextDay(SoakDay &day) {
+	day.dayNumber++;
+	day.dayOfWeek = (day.dayOfWeek + 1) % 7;
+	if (++day.day > day.lastDay) {
+		day.day = 1;
+		if (++day.month > 12) {
+			day.month = 1;
+			day.year++;
+		}
+		day.lastDay = daysInMonth(day.year, day.month);
+	}
+}
+
+// Days since 1970-01-01 of the Monday of the week containing day
+int mondayOf(const SoakDay &day) {
+	return day.dayNumber - (day.dayOfWeek + 6) % 7;
+}
+
+//
+// UTC offsets for the reference, from localtime_r()
+//
+class SoakOffsets {
+public:
+	// Finds each change of localtime_r()'s UTC offset from start to end, stepping 6 hours at a time and bisecting
+	void load(const char *tz, time_t start, time_t end) {
+		setenv("TZ", tz, 1);
+		tzset();
+
+		struct tm prev, cur;
+		localtime_r(&start, &prev);
+		spans.push_back({ start, prev.tm_gmtoff, prev.tm_isdst > 0 });
+
+		for(time_t t = start + 6 * 3600; t <= end; t += 6 * 3600) {
+			localtime_r(&t, &cur);
+			if (cur.tm_gmtoff != prev.tm_gmtoff) {
+				time_t lo = t - 6 * 3600, hi = t;
+				while(hi - lo > 1) {
+					time_t mid = lo + (hi - lo) / 2;
+					struct tm midTm;
+					localtime_r(&mid, &midTm);
+					if (midTm.tm_gmtoff == prev.tm_gmtoff) {
+						lo = mid;
+					}
+					else {
+						hi = mid;
+					}
+				}
+				spans.push_back({ hi, cur.tm_gmtoff, cur.tm_isdst > 0 });
+			}
+			prev = cur;
+		}
+
+		standardOffset = dstOffset = spans[0].offset;
+		for(auto it = spans.begin(); it != spans.end(); ++it) {
+			if (it->isDST) {
+				dstOffset = it->offset;
+			}
+			else {
+				standardOffset = it->offset;
+			}
+		}
+	}
+
+	// Seconds east of UTC at time
+	long offsetAt(time_t time, bool *isDST = nullptr) const {
+		auto it = std::upper_bound(spans.begin(), spans.end(), time, [](time_t t, const Span &span) { return t < span.start; });
+		if (it != spans.begin()) {
+			--it;
+		}
+		if (isDST) {
+			*isDST = it->isDST;
+		}
+		return it->offset;
+	}
+
+	// As documented for LocalTimeValue::toUTC(): the local time is taken as standard time, unless that
+	// time is in DST, so a local time that happens twice when falling back is the second one
+	time_t wallToUTC(time_t local) const {
+		time_t standardTime = local - standardOffset;
+		bool isDST;
+		offsetAt(standardTime, &isDST);
+		return isDST ? (local - dstOffset) : standardTime;
+	}
+
+	// Every time that has this local time: none in the hour skipped when springing forward, and
+	// two in the hour repeated when falling back
+	void allUTC(time_t local, std::vector<time_t> &times) const {
+		time_t standardTime = local - standardOffset;
+		if (offsetAt(standardTime) == standardOffset) {
+			times.push_back(standardTime);
+		}
+		time_t dstTime = local - dstOffset;
+		if (dstOffset != standardOffset && offsetAt(dstTime) == dstOffset) {
+			times.push_back(dstTime);
+		}
+	}
+
+	int transitions() const {
+		return (int)spans.size() - 1;
+	}
+
+protected:
+	struct Span {
+		time_t start;
+		long offset;
+		bool isDST;
+	};
+	std::vector<Span> spans;
+	long standardOffset = 0;
+	long dstOffset = 0;
+};
+
+//
+// The schedules
+//
+
+// How the local times of the reference become UTC times
+enum class SoakKind {
+	WALL,     // Once, with LocalTimeValue::toUTC(), like atLocalTime(); used by most items
+	INSTANT   // Every time the clock shows that local time, because MINUTE_OF_HOUR steps in UTC
+};
+
+struct SoakSchedule {
+	const char *name;
+	SoakKind kind;
+	std::function<void(LocalTimeSchedule &schedule)> build;
+	std::function<void(const SoakDay &day, std::vector<int> &seconds)> reference; // Seconds of the day, local time
+};
+
+// Seconds of the day
+int hms(int hour, int minute, int second = 0) {
+	return hour * 3600 + minute * 60 + second;
+}
+
+bool isWeekday(const SoakDay &day) {
+	return day.dayOfWeek >= 1 && day.dayOfWeek <= 5;
+}
+
+// Days since 1970-01-01 of a DTSTART date
+int dtstartDay(int year, int month, int day) {
+	SoakDay result = firstDay(year);
+	while(result.month != month || result.day != day) {
+		nextDay(result);
+	}
+	return result.dayNumber;
+}
+
+std::vector<SoakSchedule> schedules = {
+	{ "minute of hour, every 15 min 9-5 weekdays", SoakKind::INSTANT,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withMinuteOfHour(15, LocalTimeRange(LocalTimeHMS("09:00:00"), LocalTimeHMS("16:59:59"), LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_WEEKDAY)));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			if (isWeekday(day)) {
+				for(int s = hms(9, 0); s < hms(16, 59, 59); s += 15 * 60) {
+					seconds.push_back(s);
+				}
+			}
+		}
+	},
+	{ "minute of hour, every 30 min at :10 and :40", SoakKind::INSTANT,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withMinuteOfHour(30, LocalTimeRange(LocalTimeHMS("00:10:00")));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			for(int s = hms(0, 10); s < hms(23, 59, 59); s += 30 * 60) {
+				seconds.push_back(s);
+			}
+		}
+	},
+	{ "hour of day, every 4 hours at :15", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withHourOfDay(4, LocalTimeRange(LocalTimeHMS("00:15:00")));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			for(int s = hms(0, 15); s <= hms(23, 59, 59); s += 4 * 3600) {
+				seconds.push_back(s);
+			}
+		}
+	},
+	{ "hour of day, hourly 00:30 to 04:30", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withHourOfDay(1, LocalTimeRange(LocalTimeHMS("00:30:00"), LocalTimeHMS("04:30:00")));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			for(int s = hms(0, 30); s <= hms(4, 30); s += 3600) {
+				seconds.push_back(s);
+			}
+		}
+	},
+	{ "day of week of month, 1st Mon and last Sun", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withDayOfWeekOfMonth(1, 1, LocalTimeRange(LocalTimeHMS("09:00:00")));
+			schedule.withDayOfWeekOfMonth(0, -1, LocalTimeRange(LocalTimeHMS("01:30:00")));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			if (day.dayOfWeek == 1 && day.day <= 7) {
+				seconds.push_back(hms(9, 0));
+			}
+			if (day.dayOfWeek == 0 && day.day + 7 > day.lastDay) {
+				seconds.push_back(hms(1, 30));
+			}
+		}
+	},
+	{ "day of month, 1st, 29th, and last", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withDayOfMonth(1, LocalTimeRange(LocalTimeHMS("12:00:00")));
+			schedule.withDayOfMonth(29, LocalTimeRange(LocalTimeHMS("06:00:00")));
+			schedule.withDayOfMonth(-1, LocalTimeRange(LocalTimeHMS("23:30:00")));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			if (day.day == 1) {
+				seconds.push_back(hms(12, 0));
+			}
+			if (day.day == 29) {
+				seconds.push_back(hms(6, 0));
+			}
+			if (day.day == day.lastDay) {
+				seconds.push_back(hms(23, 30));
+			}
+		}
+	},
+	{ "time, 01:30 and 02:30 daily, 08:00 weekends", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withTimes({ LocalTimeHMSRestricted(LocalTimeHMS("01:30:00")), LocalTimeHMSRestricted(LocalTimeHMS("02:30:00")) });
+			schedule.withTime(LocalTimeHMSRestricted(LocalTimeHMS("08:00:00"), LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_WEEKEND)));
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			seconds.push_back(hms(1, 30));
+			seconds.push_back(hms(2, 30));
+			if (!isWeekday(day)) {
+				seconds.push_back(hms(8, 0));
+			}
+		}
+	},
+	{ "recurrence rule, every other Mon/Wed/Fri", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withRecurrenceRule("20000103T073000", "FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE,FR");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			static const int start = dtstartDay(2000, 1, 3);
+			int week = (mondayOf(day) - start) / 7;
+			if (week >= 0 && (week % 2) == 0 && (day.dayOfWeek == 1 || day.dayOfWeek == 3 || day.dayOfWeek == 5)) {
+				seconds.push_back(hms(7, 30));
+			}
+		}
+	},
+	{ "recurrence rule, last weekday of month", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withRecurrenceRule("20000101T170000", "FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			static const int start = dtstartDay(2000, 1, 1);
+			if (day.dayNumber < start || !isWeekday(day)) {
+				return;
+			}
+			// No weekday after this one in the month
+			int dayOfWeek = day.dayOfWeek;
+			for(int dd = day.day + 1; dd <= day.lastDay; dd++) {
+				dayOfWeek = (dayOfWeek + 1) % 7;
+				if (dayOfWeek >= 1 && dayOfWeek <= 5) {
+					return;
+				}
+			}
+			seconds.push_back(hms(17, 0));
+		}
+	},
+	{ "recurrence rule, every 3 days at 02:30", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withRecurrenceRule("20000101T023000", "FREQ=DAILY;INTERVAL=3");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			static const int start = dtstartDay(2000, 1, 1);
+			int days = day.dayNumber - start;
+			if (days >= 0 && (days % 3) == 0) {
+				seconds.push_back(hms(2, 30));
+			}
+		}
+	},
+	{ "cron, every 15 min 9-5 weekdays", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withCron("*/15 9-16 * * MON-FRI");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			if (isWeekday(day)) {
+				for(int s = hms(9, 0); s <= hms(16, 45); s += 15 * 60) {
+					seconds.push_back(s);
+				}
+			}
+		}
+	},
+	{ "cron, 21:00 daily and 01:30 Sundays", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withCron("0 21 * * *");
+			schedule.withCron("30 1 * * SUN");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			seconds.push_back(hms(21, 0));
+			if (day.dayOfWeek == 0) {
+				seconds.push_back(hms(1, 30));
+			}
+		}
+	},
+	{ "cron, Feb 29, and the 13th or Fridays", SoakKind::WALL,
+		[](LocalTimeSchedule &schedule) {
+			schedule.withCron("0 12 29 2 *");
+			schedule.withCron("0 6 13 * FRI");
+		},
+		[](const SoakDay &day, std::vector<int> &seconds) {
+			if (day.month == 2 && day.day == 29) {
+				seconds.push_back(hms(12, 0));
+			}
+			// Both day of month and day of week restricted: either one
+			if (day.day == 13 || day.dayOfWeek == 5) {
+				seconds.push_back(hms(6, 0));
+			}
+		}
+	},
+};
+
+//
+// The soak
+//
+
+// Counts and prints mismatches
+class SoakFailures {
+public:
+	void add(const SoakZone &zone, const SoakSchedule &schedule, const String &detail) {
+		if (count++ < MAX_PRINTED) {
+			printf("%s, %s: %s\n", zone.name, schedule.name, detail.c_str());
+		}
+	}
+
+	int count = 0;
+};
+
+// A UTC time and the local time, for the mismatches
+String timeToString(const SoakOffsets &offsets, time_t time) {
+	return String::format("%s UTC (local %s)", LocalTime::timeToString(time).c_str(), LocalTime::timeToString(time + offsets.offsetAt(time)).c_str());
+}
+
+// Total time in each side, for the throughput
+double scheduleNs = 0;
+double referenceNs = 0;
+uint64_t events = 0;
+
+void soak(const SoakZone &zone, const SoakSchedule &soakSchedule, const SoakOffsets &offsets, int years, SoakFailures &failures) {
+	SoakDay day = firstDay(START_YEAR);
+	time_t startTime = (time_t)day.dayNumber * 86400;
+	time_t endTime = (time_t)firstDay(START_YEAR + years).dayNumber * 86400;
+
+	// Fast path: from each event to the next, as the firmware does
+	std::vector<time_t> actual;
+	auto begin = std::chrono::steady_clock::now();
+	{
+		LocalTimeSchedule schedule;
+		soakSchedule.build(schedule);
+
+		LocalTimeConvert conv;
+		conv.withConfig(LocalTimePosixTimezone(zone.tz)).withTime(startTime).convert();
+		while(schedule.getNextScheduledTime(conv) && conv.time < endTime) {
+			actual.push_back(conv.time);
+		}
+	}
+	auto middle = std::chrono::steady_clock::now();
+
+	// Reference: the local times of each day, starting the year before and ending the day after in
+	// case the UTC offset moves them into the range
+	std::vector<time_t> expected;
+	{
+		std::vector<int> seconds;
+		for(day = firstDay(START_YEAR - 1); (time_t)day.dayNumber * 86400 <= endTime; nextDay(day)) {
+			seconds.clear();
+			soakSchedule.reference(day, seconds);
+			for(auto it = seconds.begin(); it != seconds.end(); ++it) {
+				time_t local = (time_t)day.dayNumber * 86400 + *it;
+				if (soakSchedule.kind == SoakKind::WALL) {
+					expected.push_back(offsets.wallToUTC(local));
+				}
+				else {
+					offsets.allUTC(local, expected);
+				}
+			}
+		}
+		std::sort(expected.begin(), expected.end());
+		expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+		expected.erase(std::remove_if(expected.begin(), expected.end(), [&](time_t t) { return t <= startTime || t >= endTime; }), expected.end());
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	scheduleNs += std::chrono::duration<double, std::nano>(middle - begin).count();
+	referenceNs += std::chrono::duration<double, std::nano>(end - middle).count();
+	events += actual.size();
+
+	// Report where the two first differ
+	size_t ii = 0;
+	while(ii < actual.size() && ii < expected.size() && actual[ii] == expected[ii]) {
+		ii++;
+	}
+	if (ii < actual.size() || ii < expected.size()) {
+		String detail = String::format("event %u of %u (reference %u): ", (unsigned)ii, (unsigned)actual.size(), (unsigned)expected.size());
+		detail += (ii < actual.size()) ? ("schedule " + timeToString(offsets, actual[ii])) : String("schedule ended");
+		detail += ", ";
+		detail += (ii < expected.size()) ? ("reference " + timeToString(offsets, expected[ii])) : String("reference ended");
+		failures.add(zone, soakSchedule, detail);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int years = (argc > 1) ? atoi(argv[1]) : 105;
+	const char *filter = (argc > 2) ? argv[2] : nullptr;
+
+	time_t startTime = (time_t)firstDay(START_YEAR - 1).dayNumber * 86400;
+	time_t endTime = (time_t)firstDay(START_YEAR + years + 1).dayNumber * 86400;
+
+	SoakFailures failures;
+	auto begin = std::chrono::steady_clock::now();
+	for(const SoakZone &zone : zones) {
+		SoakOffsets offsets;
+		offsets.load(zone.tz, startTime, endTime);
+
+		uint64_t zoneEvents = events;
+		for(const SoakSchedule &schedule : schedules) {
+			if (filter && !strstr(schedule.name, filter)) {
+				continue;
+			}
+			soak(zone, schedule, offsets, years, failures);
+		}
+		printf("%-12s %4d DST changes %9llu events\n", zone.name, offsets.transitions(), (unsigned long long)(events - zoneEvents));
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	printf("%llu events over %d years in %.1f s: schedules %.0f events/s, reference %.0f events/s\n",
+		(unsigned long long)events, years, seconds, events / (scheduleNs / 1e9), events / (referenceNs / 1e9));
+
+	if (failures.count) {
+		printf("%d mismatches\n", failures.count);
+		return 1;
+	}
+	printf("no mismatches\n");
+	return 0;
+}
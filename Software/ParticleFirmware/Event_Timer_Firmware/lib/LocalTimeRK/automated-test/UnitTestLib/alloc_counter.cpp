@@ -0,0 +1,255 @@
+#include "alloc_counter.h"
+
+#include <errno.h>
+#include <new>
+#include <stdlib.h>
+
+// The sanitizers replace malloc themselves, and a program that replaces it again crashes, so only
+// operator new and delete are counted in those builds. Define ALLOC_COUNTER_NO_MALLOC to do the same
+// in another build.
+#if defined(__has_feature)
+#if __has_feature(thread_sanitizer) || __has_feature(address_sanitizer)
+#define ALLOC_COUNTER_NO_MALLOC
+#endif
+#endif
+
+#if defined(__GLIBC__) && !defined(ALLOC_COUNTER_NO_MALLOC) && !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+#define ALLOC_COUNTER_MALLOC
+#endif
+
+// Running totals for this thread. A trivial type, so it's zero-initialized and can be used from
+// malloc before anything else has been constructed.
+struct AllocTotals {
+	size_t allocations;
+	size_t frees;
+	size_t bytes;
+	size_t stringGrowths;
+};
+static thread_local AllocTotals totals;
+
+// In spark_wiring_string.cpp: called with the new capacity when a String buffer is allocated or grown
+extern void (*stringGrowthHook)(unsigned int capacity);
+
+static void countStringGrowth(unsigned int capacity) {
+	totals.stringGrowths++;
+}
+
+// Set before main() runs
+static struct StringGrowthHookSetter {
+	StringGrowthHookSetter() {
+		stringGrowthHook = countStringGrowth;
+	}
+} stringGrowthHookSetter;
+
+#ifdef ALLOC_COUNTER_MALLOC
+// glibc's own allocator, which the replacements for malloc, etc. below call
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void *p);
+
+extern "C" void *malloc(size_t size) {
+	totals.allocations++;
+	totals.bytes += size;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size) {
+	totals.allocations++;
+	totals.bytes += num * size;
+	return __libc_calloc(num, size);
+}
+
+// Counted as freeing the old block, if any, and allocating a new one, so the frees match the
+// allocations when nothing leaks
+extern "C" void *realloc(void *p, size_t size) {
+	if (p) {
+		totals.frees++;
+	}
+	totals.allocations++;
+	totals.bytes += size;
+	return __libc_realloc(p, size);
+}
+
+// Blocks from these are freed with free(), so they have to be counted too
+extern "C" void *memalign(size_t alignment, size_t size) {
+	totals.allocations++;
+	totals.bytes += size;
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+	return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **pp, size_t alignment, size_t size) {
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void *p = memalign(alignment, size);
+	if (!p) {
+		return ENOMEM;
+	}
+	*pp = p;
+	return 0;
+}
+
+extern "C" void free(void *p) {
+	if (p) {
+		totals.frees++;
+	}
+	__libc_free(p);
+}
+
+// operator new and delete call the replacements above
+static void *newMalloc(size_t size) {
+	return malloc(size);
+}
+
+static void *newAlignedMalloc(size_t size, size_t alignment) {
+	void *p = 0;
+	posix_memalign(&p, alignment, size);
+	return p;
+}
+
+static void newFree(void *p) {
+	free(p);
+}
+#else
+static void *newMalloc(size_t size) {
+	totals.allocations++;
+	totals.bytes += size;
+	return malloc(size);
+}
+
+static void *newAlignedMalloc(size_t size, size_t alignment) {
+	totals.allocations++;
+	totals.bytes += size;
+	void *p = 0;
+	posix_memalign(&p, alignment, size);
+	return p;
+}
+
+static void newFree(void *p) {
+	if (p) {
+		totals.frees++;
+	}
+	free(p);
+}
+#endif /* ALLOC_COUNTER_MALLOC */
+
+void *operator new(size_t size) {
+	void *p = newMalloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return newMalloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return newMalloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept {
+	newFree(p);
+}
+
+void operator delete[](void *p) noexcept {
+	newFree(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	newFree(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	newFree(p);
+}
+
+// The versions for types with more than the default alignment. posix_memalign() needs the alignment
+// to be at least the size of a pointer.
+static void *newAligned(size_t size, std::align_val_t alignment) {
+	size_t align = static_cast<size_t>(alignment);
+	return newAlignedMalloc(size ? size : 1, (align < sizeof(void *)) ? sizeof(void *) : align);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+	void *p = newAligned(size, alignment);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+	return operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	return newAligned(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	return newAligned(size, alignment);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+	newFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+	newFree(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+	newFree(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+	newFree(p);
+}
+
+AllocCounter::AllocCounter() {
+	reset();
+}
+
+void AllocCounter::reset() {
+	startAllocations = totals.allocations;
+	startFrees = totals.frees;
+	startBytes = totals.bytes;
+	startStringGrowths = totals.stringGrowths;
+}
+
+size_t AllocCounter::getAllocations() const {
+	return totals.allocations - startAllocations;
+}
+
+size_t AllocCounter::getFrees() const {
+	return totals.frees - startFrees;
+}
+
+size_t AllocCounter::getBytes() const {
+	return totals.bytes - startBytes;
+}
+
+size_t AllocCounter::getStringGrowths() const {
+	return totals.stringGrowths - startStringGrowths;
+}
+
+// [static]
+bool AllocCounter::isMallocCounted() {
+#ifdef ALLOC_COUNTER_MALLOC
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Counts heap allocations on the current thread, from when it's created or reset
+ *
+ * Linking alloc_counter.cpp into a test replaces operator new and delete, including the aligned
+ * versions, and on glibc hosts malloc, calloc, realloc, memalign, aligned_alloc, posix_memalign and
+ * free, with versions that count the calls and the bytes requested.
+ * String buffer growth is counted separately as well. The totals are kept per thread, so tests
+ * running in parallel don't see each other's allocations, and counters can be nested.
+ *
+ * ```
+ * AllocCounter counter;
+ * conv.withTime(now).convert();
+ * assertInt("", (int)counter.getAllocations(), 0);
+ * ```
+ *
+ * On other hosts only operator new and delete, and String growth, are counted; isMallocCounted()
+ * returns false. The same goes for builds with ThreadSanitizer or AddressSanitizer, which replace
+ * malloc themselves, and builds with ALLOC_COUNTER_NO_MALLOC defined.
+ */
+class AllocCounter {
+public:
+	/**
+	 * @brief Starts counting from now
+	 */
+	AllocCounter();
+
+	/**
+	 * @brief Starts counting again from now
+	 */
+	void reset();
+
+	/**
+	 * @brief Calls to malloc, calloc, realloc, the aligned allocation functions and operator new since
+	 * the counter was reset
+	 */
+	size_t getAllocations() const;
+
+	/**
+	 * @brief Calls to free and operator delete with a pointer that isn't null since the counter was reset,
+	 * and calls to realloc that replace an existing block. When nothing leaks, this is the same as
+	 * getAllocations().
+	 */
+	size_t getFrees() const;
+
+	/**
+	 * @brief Bytes requested by the allocations since the counter was reset. For realloc, this is the
+	 * new size.
+	 */
+	size_t getBytes() const;
+
+	/**
+	 * @brief Number of times a String buffer was allocated or grown since the counter was reset. These
+	 * are also included in getAllocations() and getBytes() if isMallocCounted().
+	 */
+	size_t getStringGrowths() const;
+
+	/**
+	 * @brief Returns true if malloc, calloc, realloc and free are counted on this host
+	 */
+	static bool isMallocCounted();
+
+protected:
+	size_t startAllocations;
+	size_t startFrees;
+	size_t startBytes;
+	size_t startStringGrowths;
+};
@@ -233,10 +233,17 @@ unsigned char String::reserve(unsigned int size)
     return 0;
 }
 
+// Called with the new capacity each time a buffer is allocated or grown, if set. alloc_counter.cpp
+// sets it to count String growth.
+void (*stringGrowthHook)(unsigned int capacity) = nullptr;
+
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
     char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
     if (newbuffer) {
+        if (stringGrowthHook) {
+            stringGrowthHook(maxStrLen);
+        }
         buffer = newbuffer;
         capacity_ = maxStrLen;
         return 1;
@@ -1,5 +1,14 @@
 #include "LocalTimeRK.h"
 
+#include <algorithm>
+
+#ifdef UNITTEST
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 LocalTime *LocalTime::_instance;
 
 //
@@ -92,6 +101,12 @@ bool LocalTimeYMD::parse(const char *s) {
     }
 }
 
+void LocalTimeYMD::toJson(JSONWriter &writer) const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02d", (int)ymd.year + 1900, (int)ymd.month, (int)ymd.day);
+    writer.value(buf);
+}
+
 
 //
 // LocalTimeHMS
@@ -190,6 +205,12 @@ void LocalTimeHMS::fromJson(JSONValue jsonObj) {
     parse(jsonObj.toString().data());
 }
 
+void LocalTimeHMS::toJson(JSONWriter &writer) const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d", (int)hour, (int)minute, (int)second);
+    writer.value(buf);
+}
+
 
 //
 // LocalTimeRestrictedDate
@@ -277,6 +298,11 @@ bool LocalTimeRestrictedDate::inExceptDates(LocalTimeYMD ymd) const {
 LocalTimeYMD LocalTimeRestrictedDate::getExpirationDate() const {
     LocalTimeYMD result;
 
+    if (onlyOnDays.getMask() != 0) {
+        // Also valid on days of the week, so this never expires
+        return result;
+    }
+
     for(auto it = onlyOnDates.begin(); it != onlyOnDates.end(); ++it) {
         if (result.isEmpty() || *it > result) {
             result = *it;
@@ -314,6 +340,25 @@ void LocalTimeRestrictedDate::fromJson(JSONValue jsonObj) {
     }
 }
 
+void LocalTimeRestrictedDate::toJson(JSONWriter &writer) const {
+    writer.name("y").value((int)onlyOnDays.getMask());
+
+    if (!onlyOnDates.empty()) {
+        writer.name("a").beginArray();
+        for(auto it = onlyOnDates.begin(); it != onlyOnDates.end(); ++it) {
+            it->toJson(writer);
+        }
+        writer.endArray();
+    }
+    if (!exceptDates.empty()) {
+        writer.name("x").beginArray();
+        for(auto it = exceptDates.begin(); it != exceptDates.end(); ++it) {
+            it->toJson(writer);
+        }
+        writer.endArray();
+    }
+}
+
 // 
 // LocalTimeHMSRestricted
 //
@@ -332,6 +377,13 @@ void LocalTimeHMSRestricted::fromJson(JSONValue jsonObj) {
     LocalTimeRestrictedDate::fromJson(jsonObj);
 }
 
+void LocalTimeHMSRestricted::toJson(JSONWriter &writer) const {
+    writer.name("t");
+    LocalTimeHMS::toJson(writer);
+
+    LocalTimeRestrictedDate::toJson(writer);
+}
+
 
 
 //
@@ -448,6 +500,33 @@ void LocalTimePosixTimezone::clear() {
     standardHMS.clear();
 }
 
+// Parses a timezone name, either letters (EST) or quoted in angle brackets (<+0330>), and returns a
+// pointer to what follows it
+static char *parseZoneName(char *cp, String &name) {
+    char *start, *end, *next;
+    if (*cp == '<') {
+        start = ++cp;
+        while(*cp && *cp != '>') {
+            cp++;
+        }
+        end = cp;
+        next = *cp ? cp + 1 : cp;
+    }
+    else {
+        start = cp;
+        while(*cp >= 'A') {
+            cp++;
+        }
+        end = next = cp;
+    }
+
+    char save = *end;
+    *end = 0;
+    name = start;
+    *end = save;
+    return next;
+}
+
 bool LocalTimePosixTimezone::parse(const char *str) {
     char *mutableCopy = strdup(str);
 
@@ -457,19 +536,12 @@ bool LocalTimePosixTimezone::parse(const char *str) {
         switch(ii++) {
             case 0: {
                 // Timezone specifier
-                char *cp = token, *start = token, save2;
-                while(*cp >= 'A') {
-                    cp++;
-                }
-                save2 = *cp;
-                *cp = 0;
-                standardName = start;
-                *cp = save2;
+                char *cp = parseZoneName(token, standardName), *start, save2;
                 valid = true;
 
                 if (*cp) {
                     start = cp;
-                    while(*cp && *cp < 'A') {
+                    while(*cp && *cp < 'A' && *cp != '<') {
                         cp++;
                     }
                     save2 = *cp;
@@ -478,18 +550,10 @@ bool LocalTimePosixTimezone::parse(const char *str) {
                     *cp = save2;
 
                     if (*cp) {
-                        start = cp;
-                        while(*cp && *cp >= 'A') {
-                            cp++;
-                        }
-                        save2 = *cp;
-                        *cp = 0;
-                        dstName = start;
-                        *cp = save2;
+                        cp = parseZoneName(cp, dstName);
 
                         if (*cp) {
-                            start = cp;
-                            dstHMS.parse(start);
+                            dstHMS.parse(cp);
                         }
                         else {
                             // Default dst is 1 hour later
@@ -596,211 +660,1265 @@ int LocalTimeValue::ordinal() const {
 }
 
 //
-// LocalTimeScheduleItem
+// LocalTimeZoneInfo
 //
-bool LocalTimeScheduleItem::getNextScheduledTime(LocalTimeConvert &conv) const {
 
-    LocalTimeConvert tempConv(conv);
-    
-    LocalTimeYMD endYMD;
-    
-    LocalTimeYMD expirationDate = getExpirationDate();
-    if (expirationDate.isEmpty()) {
-        endYMD = tempConv.getLocalTimeYMD();
+// TZif files are big-endian
+static int32_t readInt32(const uint8_t *p) {
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
 
-        // Maximum number of days to look ahead in the schedule for the next scheduled time (default: 32 days)
-        endYMD.addDay(LocalTime::instance().getScheduleLookaheadDays());
-    }
-    else {
-        endYMD = expirationDate;
-    }
-    
-    for(;; tempConv.nextDay(LocalTimeHMS::startOfDay)) {
-        LocalTimeYMD curYMD = tempConv.getLocalTimeYMD();
-        if (curYMD > endYMD) {
-            break;
-        }
+static int64_t readInt64(const uint8_t *p) {
+    return (int64_t)(((uint64_t)(uint32_t)readInt32(p) << 32) | (uint64_t)(uint32_t)readInt32(p + 4));
+}
 
-        if (!timeRange.isValidDate(curYMD)) {
-            // This is a time range restricted that excludes this date, so skip this date
-            continue;
-        }
+// Size of a TZif header, and the offsets of its counts
+static const size_t TZIF_HEADER_SIZE = 44;
+static const size_t TZIF_ISUTCNT = 20;
+static const size_t TZIF_ISSTDCNT = 24;
+static const size_t TZIF_LEAPCNT = 28;
+static const size_t TZIF_TIMECNT = 32;
+static const size_t TZIF_TYPECNT = 36;
+static const size_t TZIF_CHARCNT = 40;
 
-        switch(scheduleItemType) {
-        case ScheduleItemType::NONE:
-            break;
+// Size of the data block after a header, with 4 byte times for version 1 and 8 byte times after that
+static size_t tzifDataSize(const uint8_t *header, size_t timeSize) {
+    return (size_t)readInt32(header + TZIF_TIMECNT) * (timeSize + 1) + (size_t)readInt32(header + TZIF_TYPECNT) * 6 +
+        (size_t)readInt32(header + TZIF_CHARCNT) + (size_t)readInt32(header + TZIF_LEAPCNT) * (timeSize + 4) +
+        (size_t)readInt32(header + TZIF_ISSTDCNT) + (size_t)readInt32(header + TZIF_ISUTCNT);
+}
 
-        case ScheduleItemType::HOUR_OF_DAY:
-        case ScheduleItemType::MINUTE_OF_HOUR:
-            {
-                bool bResult = false;
+LocalTimeZoneInfo::LocalTimeZoneInfo() {
+}
 
-                int cmp = timeRange.compareTo(tempConv.localTimeValue.hms());
-                if (cmp < 0) {
-                    // Before time range, return beginning of time range
-                    tempConv.atLocalTime(timeRange.hmsStart);
-                    conv.time = tempConv.time;
-                    conv.convert();
-                    return true;
-                }
-                else 
-                if (cmp == 0) {
-                    // In time range hmsStart <= hms <= hmsEnd
-                    // Handle multiples here
-                    struct tm timeInfo;
-                    int startingModulo;
-                     
-                    switch(scheduleItemType) {
-                    case ScheduleItemType::HOUR_OF_DAY:
-                        // Loop here instead of doing the modulo math to correctly handle timezone and daylight saving switch
-                        for(LocalTimeHMS tempHMS = timeRange.hmsStart; tempHMS <= timeRange.hmsEnd; tempHMS.hour += increment) {
-                            tempConv.atLocalTime(tempHMS);
-                            if (tempConv.time > conv.time) {
-                                // Found match
-                                bResult = true;
-                                break;
-                            }
-                        }
-                        break;
+LocalTimeZoneInfo::~LocalTimeZoneInfo() {
+}
 
-                    case ScheduleItemType::MINUTE_OF_HOUR:
-                        // TODO: I think this is wrong for timezones with a minute offset
-                        startingModulo = timeRange.hmsStart.minute % increment;
+void LocalTimeZoneInfo::clear() {
+    transitionTimes.clear();
+    transitionTypes.clear();
+    types.clear();
+    names.clear();
+    footer = LocalTimePosixTimezone();
+    valid = false;
+}
 
-                        tempConv.time += increment * 60;
-                        tempConv.convert();
+bool LocalTimeZoneInfo::load(const uint8_t *data, size_t size) {
+    clear();
 
-                        LocalTime::timeToTm(tempConv.time, &timeInfo);
-                        timeInfo.tm_min -= ((tempConv.localTimeValue.minute() - startingModulo) % increment);
-                        timeInfo.tm_sec = timeRange.hmsStart.second;
-                        tempConv.time = LocalTime::tmToTime(&timeInfo);
-                        tempConv.convert();
-                        if (tempConv.getLocalTimeHMS() < timeRange.hmsEnd) {
-                            bResult = true;
-                        }
-                        break;
+    if (size < TZIF_HEADER_SIZE || memcmp(data, "TZif", 4) != 0) {
+        return false;
+    }
+    for(size_t ii = TZIF_ISUTCNT; ii < TZIF_HEADER_SIZE; ii += 4) {
+        if ((uint32_t)readInt32(data + ii) > size) {
+            // Can't fit, and would overflow the sizes below
+            return false;
+        }
+    }
 
-                    default:
-                        break;
-                    }
+    // Version 2 and later repeat the data with 64-bit times after the version 1 data, then add the footer
+    const uint8_t *header = data;
+    size_t timeSize = 4;
+    if (data[4] >= '2') {
+        size_t offset = TZIF_HEADER_SIZE + tzifDataSize(data, 4);
+        if (size < offset + TZIF_HEADER_SIZE || memcmp(data + offset, "TZif", 4) != 0) {
+            return false;
+        }
+        header = data + offset;
+        timeSize = 8;
+        for(size_t ii = TZIF_ISUTCNT; ii < TZIF_HEADER_SIZE; ii += 4) {
+            if ((uint32_t)readInt32(header + ii) > size) {
+                return false;
+            }
+        }
+    }
 
-                    if (bResult) {
-                        if (!timeRange.isValidDate(tempConv.getLocalTimeYMD())) {
-                            bResult = false;
-                        }
-                    }
+    size_t isutcnt = (size_t)readInt32(header + TZIF_ISUTCNT);
+    size_t isstdcnt = (size_t)readInt32(header + TZIF_ISSTDCNT);
+    size_t timecnt = (size_t)readInt32(header + TZIF_TIMECNT);
+    size_t typecnt = (size_t)readInt32(header + TZIF_TYPECNT);
+    size_t charcnt = (size_t)readInt32(header + TZIF_CHARCNT);
 
-                    if (bResult) {
-                        conv.time = tempConv.time;
-                        conv.convert();
-                        return true;
+    if (readInt32(header + TZIF_LEAPCNT) != 0) {
+        // Leap second corrections (the "right" zones) are not supported
+        return false;
+    }
+    if (typecnt == 0 || typecnt > 256 || charcnt == 0 || charcnt > 256 || (isutcnt != 0 && isutcnt != typecnt) || (isstdcnt != 0 && isstdcnt != typecnt)) {
+        return false;
+    }
+
+    const uint8_t *block = header + TZIF_HEADER_SIZE;
+    const uint8_t *end = data + size;
+    if ((size_t)(end - block) < tzifDataSize(header, timeSize)) {
+        return false;
+    }
+
+    const uint8_t *times = block;
+    const uint8_t *typeIndexes = times + timecnt * timeSize;
+    const uint8_t *ttinfos = typeIndexes + timecnt;
+    const uint8_t *chars = ttinfos + typecnt * 6;
+
+    transitionTimes.reserve(timecnt);
+    transitionTypes.reserve(timecnt);
+    for(size_t ii = 0; ii < timecnt; ii++) {
+        time_t time = (time_t)((timeSize == 8) ? readInt64(times + ii * 8) : readInt32(times + ii * 4));
+        if ((!transitionTimes.empty() && time <= transitionTimes.back()) || typeIndexes[ii] >= typecnt) {
+            clear();
+            return false;
+        }
+        transitionTimes.push_back(time);
+        transitionTypes.push_back(typeIndexes[ii]);
+    }
+
+    types.reserve(typecnt);
+    for(size_t ii = 0; ii < typecnt; ii++) {
+        const uint8_t *ttinfo = ttinfos + ii * 6;
+        if (ttinfo[4] > 1 || ttinfo[5] >= charcnt) {
+            clear();
+            return false;
+        }
+        types.push_back({ readInt32(ttinfo), ttinfo[4] != 0, ttinfo[5] });
+    }
+
+    names.assign((const char *)chars, (const char *)chars + charcnt);
+    names.push_back(0);
+
+    if (timeSize == 8) {
+        // The footer is a POSIX timezone string between newlines, and may be empty
+        const char *footerStart = (const char *)block + tzifDataSize(header, timeSize);
+        const char *footerEnd = (footerStart < (const char *)end && *footerStart == '\n') ? (const char *)memchr(footerStart + 1, '\n', (const char *)end - footerStart - 1) : nullptr;
+        if (footerEnd && footerEnd > footerStart + 1) {
+            // POSIX changes at 2:00 when a rule has no time, where LocalTimeChange changes at midnight
+            String rule;
+            int commas = 0;
+            for(const char *cp = footerStart + 1; cp < footerEnd; cp++) {
+                if (*cp == ',') {
+                    if (commas++ > 0 && rule.indexOf('/', rule.lastIndexOf(',')) < 0) {
+                        rule += "/2";
                     }
                 }
-                else {
-                    // cmp > 0, after time range, don't check and try next day
-                }
+                rule += *cp;
             }
-            break;            
-            
-        case ScheduleItemType::DAY_OF_WEEK_OF_MONTH:
-            // "dayOfWeek" specifies the day of the week (0 = Sunday, 1 = Monday, ...)
-            // "increment" specifies which one (1 = first, 2 = second, ... or -1 = last, -2 = second to last, ...)
-            // Time is at the HMS of the hmsStart (local time)
-            {
-                int day = LocalTime::dayOfWeekOfMonth(tempConv.localTimeValue.year(), tempConv.localTimeValue.month(), dayOfWeek, increment);
-                if (day == tempConv.localTimeValue.day()) {
-                    tempConv.atLocalTime(timeRange.hmsStart);
-                    if (tempConv.time > conv.time) {
-                        conv.time = tempConv.time;
-                        conv.convert();
-                        return true;
-                    }
-                }
+            if (commas > 0 && rule.indexOf('/', rule.lastIndexOf(',')) < 0) {
+                rule += "/2";
             }
-            break;
-            
-        case ScheduleItemType::DAY_OF_MONTH:
-            {
-                int tempIncrement = increment;
-                if (tempIncrement < 0) {
-                    tempIncrement = LocalTime::lastDayOfMonth(tempConv.localTimeValue.year(), tempConv.localTimeValue.month()) + tempIncrement + 1;
-                }
-                // "increment" specifies which day of month (1, 2, 3, ...) or 
-                // Time is at the HMS of the hmsStart (local time)
-                if (tempConv.localTimeValue.ymd().getDay() == tempIncrement) {
-                    int cmp = timeRange.compareTo(tempConv.localTimeValue.hms());
-                    if (cmp <= 0) {
-                        // Before the beginning of time range, return beginning of time range
-                        tempConv.atLocalTime(timeRange.hmsStart);
-                        if (tempConv.time > conv.time) {
-                            conv.time = tempConv.time;
-                            conv.convert();
-                            return true;
-                        }
-                    }
-                }
 
+            // A rule LocalTimePosixTimezone doesn't support (Jn or n days) is not used, and the last local
+            // time type is used after the last change instead
+            if (!footer.parse(rule.c_str()) || (footer.dstName.length() && !footer.hasDST())) {
+                footer = LocalTimePosixTimezone();
             }
-            break;
+        }
+    }
 
-        case ScheduleItemType::TIME: 
-            // At a specific time, optionally with day of week or date restrictions            
-            // The first test must be <= otherwise you can't schedule at midnight.
-            // The second test for conv.time must be > to advance to the next schedule.
-            if (tempConv.localTimeValue.hms() <= timeRange.hmsStart) {
-                tempConv.atLocalTime(timeRange.hmsStart);
-                if (tempConv.time > conv.time) {
-                    conv.time = tempConv.time;
-                    conv.convert();
-                    return true;
-                }
-            }
-            break;
+    valid = true;
+    return true;
+}
 
+#ifdef UNITTEST
+bool LocalTimeZoneInfo::loadFile(const char *path) {
+    clear();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool result = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            result = load((const uint8_t *)data, (size_t)st.st_size);
+            munmap(data, (size_t)st.st_size);
         }
+    }
+    close(fd);
 
-        
+    return result;
+}
+#endif /* UNITTEST */
+
+const LocalTimeZoneInfo::LocalTimeType *LocalTimeZoneInfo::findType(time_t time) const {
+    if (!valid) {
+        return nullptr;
     }
 
-    // No next time found (no schedule, or all days excluded within the next getScheduleLookaheadDays() days)
-    return false;
+    // The first change after time
+    auto it = std::upper_bound(transitionTimes.begin(), transitionTimes.end(), time);
+    if (it == transitionTimes.end() && footer.isValid()) {
+        return nullptr;
+    }
+    if (it == transitionTimes.begin()) {
+        return &types[0];
+    }
+    return &types[transitionTypes[it - transitionTimes.begin() - 1]];
 }
 
+time_t LocalTimeZoneInfo::toUTC(const LocalTimeValue &value) const {
+    // The local time as if it were UTC
+    struct tm timeInfo = value;
+    time_t local = LocalTime::tmToTime(&timeInfo);
 
-void LocalTimeScheduleItem::fromJson(JSONValue jsonObj) {
-    JSONObjectIterator iter(jsonObj);
-    while(iter.next()) {
-        String key = (const char *) iter.name();
-        if (key == "m") {
-            scheduleItemType = (ScheduleItemType) iter.value().toInt();
-        }
-        else
-        if (key == "i") {
-            increment = iter.value().toInt();
+    // Number of changes that apply to local. A change applies from the earlier of the local times just
+    // before and after it, so a skipped local time gets the offset after the change, and a repeated local
+    // time the second time it happens.
+    size_t lo = 0, hi = transitionTimes.size();
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int32_t before = types[(mid == 0) ? 0 : transitionTypes[mid - 1]].utcOffset;
+        int32_t after = types[transitionTypes[mid]].utcOffset;
+        if (transitionTimes[mid] + std::min(before, after) <= local) {
+            lo = mid + 1;
         }
-        else
-        if (key == "d") {
-            dayOfWeek = iter.value().toInt();
+        else {
+            hi = mid;
         }
-        else
-        if (key == "f") {
-            flags = iter.value().toInt();
+    }
+
+    if (lo == transitionTimes.size() && footer.isValid()) {
+        return value.toUTC(footer);
+    }
+    return local - types[(lo == 0) ? 0 : transitionTypes[lo - 1]].utcOffset;
+}
+
+//
+// LocalTimeRecurrenceRule
+//
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar
+static int ymdToDayNumber(int year, int month, int day) {
+    year -= (month <= 2);
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+static int ymdToDayNumber(const LocalTimeYMD &ymd) {
+    return ymdToDayNumber(ymd.getYear(), ymd.getMonth(), ymd.getDay());
+}
+
+// Inverse of ymdToDayNumber
+static void dayNumberToYMD(int dayNumber, int &year, int &month, int &day) {
+    dayNumber += 719468;
+    int era = (dayNumber >= 0 ? dayNumber : dayNumber - 146096) / 146097;
+    int dayOfEra = dayNumber - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int mp = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yearOfEra + era * 400 + (month <= 2);
+}
+
+// Day of week for a day number, 0 = Sunday
+static int dayNumberToDayOfWeek(int dayNumber) {
+    int dayOfWeek = (dayNumber + 4) % 7; // 1970-01-01 was a Thursday
+    return (dayOfWeek < 0) ? dayOfWeek + 7 : dayOfWeek;
+}
+
+// Parses an iCalendar date or date-time (YYYYMMDD, YYYYMMDDTHHMMSS, or YYYYMMDDTHHMMSSZ)
+static bool parseICalendarTime(const char *str, LocalTimeYMD &ymd, LocalTimeHMS &hms, bool &isUTC) {
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    char utc = 0;
+    size_t len = strlen(str);
+
+    isUTC = false;
+    if (len == 8) {
+        if (sscanf(str, "%4d%2d%2d", &year, &month, &day) != 3) {
+            return false;
         }
-        else
-        if (key == "n") {
-            name = iter.value().toString().data();
+    }
+    else
+    if (len == 15 || len == 16) {
+        if (sscanf(str, "%4d%2d%2dT%2d%2d%2d%c", &year, &month, &day, &hour, &minute, &second, &utc) < 6) {
+            return false;
         }
-        else
-        if (key == "mh") {
-            // Shortcut for setting item
-            scheduleItemType = ScheduleItemType::MINUTE_OF_HOUR;
-            increment = iter.value().toInt();
+        if (len == 16) {
+            if (utc != 'Z') {
+                return false;
+            }
+            isUTC = true;
         }
-        else
-        if (key == "hd") {
-            // Shortcut for setting item
-            scheduleItemType = ScheduleItemType::HOUR_OF_DAY;
-            increment = iter.value().toInt();
+    }
+    else {
+        return false;
+    }
+
+    if (month < 1 || month > 12 || day < 1 || day > LocalTime::lastDayOfMonth(year, month) || 
+        hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+
+    ymd.setYear(year);
+    ymd.setMonth(month);
+    ymd.setDay(day);
+    hms.hour = hour;
+    hms.minute = minute;
+    hms.second = second;
+    return true;
+}
+
+// Parses a two letter day of week (SU, MO, ...). Returns 0 - 6 or -1 if not valid.
+static int parseDayOfWeek(const char *str) {
+    static const char *days[7] = { "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+    for(int ii = 0; ii < 7; ii++) {
+        if (strcmp(str, days[ii]) == 0) {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+// Parses a comma separated list of values from -max to max, excluding 0, into positive and negative bit masks
+static bool parseSignedList(char *str, int max, uint32_t &positive, uint32_t &negative) {
+    char *save = nullptr;
+    for(char *value = strtok_r(str, ",", &save); value; value = strtok_r(nullptr, ",", &save)) {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (*end != 0 || n == 0 || n > max || n < -max) {
+            return false;
+        }
+        if (n > 0) {
+            positive |= (1UL << (n - 1));
+        }
+        else {
+            negative |= (1UL << (-n - 1));
+        }
+    }
+    return true;
+}
+
+bool LocalTimeRecurrenceRule::parse(const char *dtstart, const char *rule) {
+    *this = LocalTimeRecurrenceRule();
+    dtstartStr = dtstart;
+    ruleStr = rule;
+
+    if (strncmp(dtstart, "DTSTART:", 8) == 0) {
+        dtstart += 8;
+    }
+    if (strncmp(rule, "RRULE:", 6) == 0) {
+        rule += 6;
+    }
+
+    bool isUTC;
+    if (!parseICalendarTime(dtstart, dtstartYMD, dtstartHMS, isUTC) || isUTC) {
+        // DTSTART must be local time
+        return false;
+    }
+
+    Frequency parsedFreq = Frequency::NONE;
+    bool hasUntil = false;
+
+    String copy(rule);
+    char *save = nullptr;
+    for(char *part = strtok_r(const_cast<char *>(copy.c_str()), ";", &save); part; part = strtok_r(nullptr, ";", &save)) {
+        char *value = strchr(part, '=');
+        if (!value) {
+            return false;
+        }
+        *value++ = 0;
+
+        if (strcmp(part, "FREQ") == 0) {
+            if (strcmp(value, "DAILY") == 0) {
+                parsedFreq = Frequency::DAILY;
+            }
+            else
+            if (strcmp(value, "WEEKLY") == 0) {
+                parsedFreq = Frequency::WEEKLY;
+            }
+            else
+            if (strcmp(value, "MONTHLY") == 0) {
+                parsedFreq = Frequency::MONTHLY;
+            }
+            else {
+                return false;
+            }
+        }
+        else
+        if (strcmp(part, "INTERVAL") == 0) {
+            interval = atoi(value);
+            if (interval < 1) {
+                return false;
+            }
+        }
+        else
+        if (strcmp(part, "COUNT") == 0) {
+            count = atoi(value);
+            if (count < 1) {
+                return false;
+            }
+        }
+        else
+        if (strcmp(part, "UNTIL") == 0) {
+            LocalTimeYMD ymd;
+            LocalTimeHMS hms;
+            if (!parseICalendarTime(value, ymd, hms, isUTC)) {
+                return false;
+            }
+            if (isUTC) {
+                struct tm timeInfo = {0};
+                timeInfo.tm_year = ymd.getYear() - 1900;
+                timeInfo.tm_mon = ymd.getMonth() - 1;
+                timeInfo.tm_mday = ymd.getDay();
+                timeInfo.tm_hour = hms.hour;
+                timeInfo.tm_min = hms.minute;
+                timeInfo.tm_sec = hms.second;
+                untilUTC = LocalTime::tmToTime(&timeInfo);
+            }
+            else {
+                untilYMD = ymd;
+                // A date without a time includes the whole day
+                untilHMS = (strlen(value) == 8) ? LocalTimeHMS::endOfDay : hms;
+            }
+            hasUntil = true;
+        }
+        else
+        if (strcmp(part, "WKST") == 0) {
+            weekStart = parseDayOfWeek(value);
+            if (weekStart < 0) {
+                return false;
+            }
+        }
+        else
+        if (strcmp(part, "BYDAY") == 0) {
+            char *save2 = nullptr;
+            for(char *day = strtok_r(value, ",", &save2); day; day = strtok_r(nullptr, ",", &save2)) {
+                char *end;
+                long ordinal = strtol(day, &end, 10);
+                int dayOfWeek = parseDayOfWeek(end);
+                if (dayOfWeek < 0 || ordinal > 5 || ordinal < -5) {
+                    return false;
+                }
+                if (end == day) {
+                    byDayMask |= (1 << dayOfWeek);
+                }
+                else
+                if (ordinal > 0) {
+                    byDayOrdinals[dayOfWeek] |= (1 << (ordinal - 1));
+                }
+                else
+                if (ordinal < 0) {
+                    byDayOrdinals[dayOfWeek] |= (1 << (-ordinal - 1 + 5));
+                }
+                else {
+                    return false;
+                }
+            }
+        }
+        else
+        if (strcmp(part, "BYMONTHDAY") == 0) {
+            if (!parseSignedList(value, 31, byMonthDay, byMonthDayFromEnd)) {
+                return false;
+            }
+        }
+        else
+        if (strcmp(part, "BYSETPOS") == 0) {
+            if (!parseSignedList(value, 31, bySetPos, bySetPosFromEnd)) {
+                return false;
+            }
+        }
+        else {
+            // Unsupported part, such as BYMONTH or BYHOUR
+            return false;
+        }
+    }
+
+    if (parsedFreq == Frequency::NONE || (count != 0 && hasUntil)) {
+        // FREQ is required and COUNT and UNTIL can't both be used
+        return false;
+    }
+    if (parsedFreq != Frequency::MONTHLY) {
+        for(int ii = 0; ii < 7; ii++) {
+            if (byDayOrdinals[ii]) {
+                // Ordinals like 2TU are only valid for MONTHLY
+                return false;
+            }
+        }
+        if (parsedFreq == Frequency::WEEKLY && (byMonthDay || byMonthDayFromEnd)) {
+            return false;
+        }
+    }
+
+    freq = parsedFreq;
+    return true;
+}
+
+uint32_t LocalTimeRecurrenceRule::getMatchingDays(int start, int len) const {
+    bool hasByDay = byDayMask != 0;
+    for(int ii = 0; ii < 7; ii++) {
+        if (byDayOrdinals[ii]) {
+            hasByDay = true;
+        }
+    }
+    bool hasByMonthDay = byMonthDay != 0 || byMonthDayFromEnd != 0;
+
+    int dtstartDay = ymdToDayNumber(dtstartYMD);
+    int year, month, day;
+    dayNumberToYMD(start, year, month, day);
+    int lastDay = LocalTime::lastDayOfMonth(year, month);
+
+    uint32_t result = 0;
+    for(int ii = 0; ii < len; ii++) {
+        if (ii > 0) {
+            if (++day > lastDay) {
+                // Weekly period crosses into the next month
+                dayNumberToYMD(start + ii, year, month, day);
+                lastDay = LocalTime::lastDayOfMonth(year, month);
+            }
+        }
+        int dayOfWeek = dayNumberToDayOfWeek(start + ii);
+        bool match = true;
+
+        if (hasByDay) {
+            match = (byDayMask & (1 << dayOfWeek)) != 0;
+            if (!match && byDayOrdinals[dayOfWeek]) {
+                // Which of this weekday in the month, counting from the start and the end
+                int ordinal = (day - 1) / 7;
+                int ordinalFromEnd = (lastDay - day) / 7;
+                match = (byDayOrdinals[dayOfWeek] & ((1 << ordinal) | (1 << (ordinalFromEnd + 5)))) != 0;
+            }
+        }
+        if (match && hasByMonthDay) {
+            match = (byMonthDay & (1UL << (day - 1))) != 0 || (byMonthDayFromEnd & (1UL << (lastDay - day))) != 0;
+        }
+        if (!hasByDay && !hasByMonthDay) {
+            // Without BYDAY or BYMONTHDAY, the day comes from DTSTART
+            if (freq == Frequency::WEEKLY) {
+                match = dayOfWeek == dayNumberToDayOfWeek(dtstartDay);
+            }
+            else
+            if (freq == Frequency::MONTHLY) {
+                match = day == dtstartYMD.getDay();
+            }
+        }
+
+        if (match) {
+            result |= (1UL << ii);
+        }
+    }
+
+    if (result && (bySetPos || bySetPosFromEnd)) {
+        int numSet = 0;
+        for(uint32_t tmp = result; tmp; tmp &= tmp - 1) {
+            numSet++;
+        }
+
+        uint32_t selected = 0;
+        int pos = 0;
+        for(int ii = 0; ii < len; ii++) {
+            if (result & (1UL << ii)) {
+                if ((bySetPos & (1UL << pos)) || (bySetPosFromEnd & (1UL << (numSet - pos - 1)))) {
+                    selected |= (1UL << ii);
+                }
+                pos++;
+            }
+        }
+        result = selected;
+    }
+
+    // BYSETPOS counts all of the days in the period, but days before DTSTART aren't occurrences
+    if (start < dtstartDay) {
+        int before = dtstartDay - start;
+        result &= (before < 32) ? ~((1UL << before) - 1) : 0;
+    }
+
+    return result;
+}
+
+bool LocalTimeRecurrenceRule::getNextOccurrence(const LocalTimeConvert &conv, int lookaheadDays, const LocalTimeRestrictedDate &restrictions, time_t &nextTime) const {
+    if (!isValid()) {
+        return false;
+    }
+
+    int dtstartDay = ymdToDayNumber(dtstartYMD);
+    int today = ymdToDayNumber(conv.getLocalTimeYMD());
+    int endDay = today + lookaheadDays;
+    int untilDay = untilYMD.isEmpty() ? 0 : ymdToDayNumber(untilYMD);
+
+    // With COUNT, every occurrence since DTSTART must be counted
+    int firstDay = (count > 0 || today < dtstartDay) ? dtstartDay : today;
+
+    // Periods are numbered from the period containing DTSTART
+    int dtstartWeek = dtstartDay - (dayNumberToDayOfWeek(dtstartDay) - weekStart + 7) % 7;
+    int period;
+    switch(freq) {
+    case Frequency::DAILY:
+        period = firstDay - dtstartDay;
+        break;
+
+    case Frequency::WEEKLY:
+        period = (firstDay - (dayNumberToDayOfWeek(firstDay) - weekStart + 7) % 7 - dtstartWeek) / 7;
+        break;
+
+    default: {
+            int year, month, day;
+            dayNumberToYMD(firstDay, year, month, day);
+            period = (year * 12 + month) - (dtstartYMD.getYear() * 12 + dtstartYMD.getMonth());
+        }
+        break;
+    }
+    if (period % interval) {
+        period += interval - (period % interval);
+    }
+
+    int occurrences = 0;
+    for(;; period += interval) {
+        int start, len;
+        switch(freq) {
+        case Frequency::DAILY:
+            start = dtstartDay + period;
+            len = 1;
+            break;
+
+        case Frequency::WEEKLY:
+            start = dtstartWeek + period * 7;
+            len = 7;
+            break;
+
+        default: {
+                int monthIndex = dtstartYMD.getYear() * 12 + dtstartYMD.getMonth() - 1 + period;
+                start = ymdToDayNumber(monthIndex / 12, monthIndex % 12 + 1, 1);
+                len = LocalTime::lastDayOfMonth(monthIndex / 12, monthIndex % 12 + 1);
+            }
+            break;
+        }
+
+        if (start > endDay) {
+            return false;
+        }
+
+        uint32_t days = getMatchingDays(start, len);
+        for(int ii = 0; days != 0; ii++, days >>= 1) {
+            if ((days & 1) == 0) {
+                continue;
+            }
+            int day = start + ii;
+
+            if (count > 0 && ++occurrences > count) {
+                return false;
+            }
+            if (untilDay != 0 && (day > untilDay || (day == untilDay && dtstartHMS > untilHMS))) {
+                return false;
+            }
+            if (day < today) {
+                continue;
+            }
+            if (day > endDay) {
+                return false;
+            }
+
+            int year, month, dayOfMonth;
+            dayNumberToYMD(day, year, month, dayOfMonth);
+
+            LocalTimeValue value;
+            value.tm_year = year - 1900;
+            value.tm_mon = month - 1;
+            value.tm_mday = dayOfMonth;
+            value.setHMS(dtstartHMS);
+            time_t time = conv.localToUTC(value);
+
+            if (untilUTC != 0 && time > untilUTC) {
+                return false;
+            }
+            if (time <= conv.time || !restrictions.isValid(value.ymd())) {
+                continue;
+            }
+
+            nextTime = time;
+            return true;
+        }
+    }
+}
+
+//
+// LocalTimeCronExpression
+//
+
+// Returns the first set bit at or after from, or -1 if there are none
+static int nextSetBit(uint64_t mask, int from) {
+    if (from >= 64) {
+        return -1;
+    }
+    mask &= (~0ULL) << from;
+    return (mask != 0) ? __builtin_ctzll(mask) : -1;
+}
+
+// Parses a cron value, either a number or a three letter name from names (the first name is min)
+static bool parseCronValue(const char *str, int min, int max, const char * const *names, int &value) {
+    char *end;
+    long n = strtol(str, &end, 10);
+    if (end != str && *end == 0) {
+        value = (int) n;
+        return value >= min && value <= max;
+    }
+    if (names) {
+        for(int ii = 0; ii <= max - min && names[ii]; ii++) {
+            if (strcasecmp(str, names[ii]) == 0) {
+                value = min + ii;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Parses one cron field (a comma separated list of *, values, ranges, and steps) into a bit mask
+static bool parseCronField(char *field, int min, int max, const char * const *names, uint64_t &mask, bool &any) {
+    // As in Vixie cron, a field that starts with * (including */2) counts as unrestricted for the
+    // day-of-month and day-of-week rule
+    any = (field[0] == '*' || strcmp(field, "?") == 0);
+    mask = 0;
+
+    char *save = nullptr;
+    for(char *part = strtok_r(field, ",", &save); part; part = strtok_r(nullptr, ",", &save)) {
+        int step = 1;
+        char *slash = strchr(part, '/');
+        if (slash) {
+            *slash++ = 0;
+            char *end;
+            step = (int) strtol(slash, &end, 10);
+            if (*end != 0 || step < 1) {
+                return false;
+            }
+        }
+
+        int lo, hi;
+        if (strcmp(part, "*") == 0 || strcmp(part, "?") == 0) {
+            lo = min;
+            hi = max;
+        }
+        else {
+            char *dash = strchr(part, '-');
+            if (dash) {
+                *dash++ = 0;
+                if (!parseCronValue(part, min, max, names, lo) || !parseCronValue(dash, min, max, names, hi) || lo > hi) {
+                    return false;
+                }
+            }
+            else {
+                if (!parseCronValue(part, min, max, names, lo)) {
+                    return false;
+                }
+                // A single value with a step (5/15) means from the value to the maximum
+                hi = slash ? max : lo;
+            }
+        }
+
+        for(int ii = lo; ii <= hi; ii += step) {
+            mask |= (1ULL << ii);
+        }
+    }
+    return mask != 0;
+}
+
+bool LocalTimeCronExpression::parse(const char *expressionParam) {
+    static const char * const monthNames[] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC", nullptr };
+    static const char * const dayNames[] = { "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT", nullptr };
+
+    *this = LocalTimeCronExpression();
+    expression = expressionParam;
+
+    String copy(expressionParam);
+    char *fields[6];
+    int numFields = 0;
+    char *save = nullptr;
+    for(char *field = strtok_r(const_cast<char *>(copy.c_str()), " \t", &save); field; field = strtok_r(nullptr, " \t", &save)) {
+        if (numFields == 6) {
+            return false;
+        }
+        fields[numFields++] = field;
+    }
+    if (numFields != 5 && numFields != 6) {
+        return false;
+    }
+
+    uint64_t mask;
+    bool any;
+    int index = 0;
+
+    uint64_t secondsMask = 1;
+    if (numFields == 6) {
+        if (!parseCronField(fields[index++], 0, 59, nullptr, secondsMask, any)) {
+            return false;
+        }
+    }
+
+    uint64_t minutesMask;
+    if (!parseCronField(fields[index++], 0, 59, nullptr, minutesMask, any)) {
+        return false;
+    }
+
+    if (!parseCronField(fields[index++], 0, 23, nullptr, mask, any)) {
+        return false;
+    }
+    hours = (uint32_t) mask;
+
+    if (!parseCronField(fields[index++], 1, 31, nullptr, mask, anyDayOfMonth)) {
+        return false;
+    }
+    daysOfMonth = (uint32_t) mask;
+
+    if (!parseCronField(fields[index++], 1, 12, monthNames, mask, any)) {
+        return false;
+    }
+    months = (uint16_t) mask;
+
+    if (!parseCronField(fields[index++], 0, 7, dayNames, mask, anyDayOfWeek)) {
+        return false;
+    }
+    // 7 is also Sunday
+    daysOfWeek = (uint8_t) ((mask | (mask >> 7)) & 0x7f);
+
+    // Set minutes last because it's what isValid() checks
+    seconds = secondsMask;
+    minutes = minutesMask;
+    return true;
+}
+
+bool LocalTimeCronExpression::matchesDate(LocalTimeYMD ymd) const {
+    return matchesDate(ymd.getMonth(), ymd.getDay(), ymd.getDayOfWeek());
+}
+
+bool LocalTimeCronExpression::matchesDate(int month, int dayOfMonth, int dayOfWeek) const {
+    if ((months & (1 << month)) == 0) {
+        return false;
+    }
+
+    bool dayOfMonthMatch = (daysOfMonth & (1UL << dayOfMonth)) != 0;
+    bool dayOfWeekMatch = (daysOfWeek & (1 << dayOfWeek)) != 0;
+
+    if (!anyDayOfMonth && !anyDayOfWeek) {
+        // Both restricted: either one matching is enough
+        return dayOfMonthMatch || dayOfWeekMatch;
+    }
+    return dayOfMonthMatch && dayOfWeekMatch;
+}
+
+bool LocalTimeCronExpression::getNextOccurrence(const LocalTimeConvert &conv, int lookaheadDays, const LocalTimeRestrictedDate &restrictions, time_t &nextTime) const {
+    if (!isValid()) {
+        return false;
+    }
+
+    int today = ymdToDayNumber(conv.getLocalTimeYMD());
+    int endDay = today + lookaheadDays;
+
+    // Matches must be after conv.time, so start one second later. In the first pass through local
+    // times that repeat as DST ends, earlier times on the clock are still to come in their second
+    // pass, which is the one toUTC() picks, so start from midnight then.
+    int startSecond = conv.isRepeatedLocalTime() ? 0 : (conv.getLocalTimeHMS().toSeconds() + 1);
+
+    for(int day = today; day <= endDay; day++, startSecond = 0) {
+        int year, month, dayOfMonth;
+        dayNumberToYMD(day, year, month, dayOfMonth);
+
+        if ((months & (1 << month)) == 0) {
+            // Skip the rest of this month
+            day += LocalTime::lastDayOfMonth(year, month) - dayOfMonth;
+            continue;
+        }
+        if (!matchesDate(month, dayOfMonth, dayNumberToDayOfWeek(day))) {
+            continue;
+        }
+
+        LocalTimeValue value;
+        value.tm_year = year - 1900;
+        value.tm_mon = month - 1;
+        value.tm_mday = dayOfMonth;
+        if (!restrictions.isValid(value.ymd())) {
+            continue;
+        }
+
+        while(startSecond < 86400) {
+            int startHour = startSecond / 3600;
+            int startMinute = (startSecond / 60) % 60;
+            int found = -1;
+
+            for(int hour = nextSetBit(hours, startHour); hour >= 0 && found < 0; hour = nextSetBit(hours, hour + 1)) {
+                int minute = nextSetBit(minutes, (hour == startHour) ? startMinute : 0);
+                for(; minute >= 0; minute = nextSetBit(minutes, minute + 1)) {
+                    int second = nextSetBit(seconds, (hour == startHour && minute == startMinute) ? startSecond % 60 : 0);
+                    if (second >= 0) {
+                        found = hour * 3600 + minute * 60 + second;
+                        break;
+                    }
+                }
+            }
+            if (found < 0) {
+                break;
+            }
+
+            value.tm_hour = found / 3600;
+            value.tm_min = (found / 60) % 60;
+            value.tm_sec = found % 60;
+            time_t time = conv.localToUTC(value);
+            if (time > conv.time) {
+                nextTime = time;
+                return true;
+            }
+
+            // When falling back from DST the local time can repeat; keep looking later in the day
+            startSecond = found + 1;
+        }
+    }
+    return false;
+}
+
+//
+// LocalTimeScheduleItem
+//
+
+// Hash of the timezone rules used to validate cached next scheduled times (FNV-1a)
+static uint32_t configHash(const LocalTimeConvert &conv) {
+    const LocalTimePosixTimezone &config = conv.config;
+    uint64_t zoneInfo = (uint64_t)(uintptr_t)conv.zoneInfo;
+    int32_t values[] = {
+        config.valid, config.standardHMS.toSeconds(), config.dstHMS.toSeconds(),
+        config.dstStart.valid, config.dstStart.month, config.dstStart.week, config.dstStart.dayOfWeek, config.dstStart.hms.toSeconds(),
+        config.standardStart.valid, config.standardStart.month, config.standardStart.week, config.standardStart.dayOfWeek, config.standardStart.hms.toSeconds(),
+        (int32_t)zoneInfo, (int32_t)(zoneInfo >> 32)
+    };
+
+    uint32_t hash = 2166136261UL;
+    const uint8_t *p = (const uint8_t *)values;
+    for(size_t ii = 0; ii < sizeof(values); ii++) {
+        hash ^= p[ii];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// Returns true if hms is a valid time of day
+static bool isHMSInRange(const LocalTimeHMS &hms) {
+    return hms.hour >= 0 && hms.hour <= 23 && hms.minute >= 0 && hms.minute <= 59 && hms.second >= 0 && hms.second <= 59;
+}
+
+bool LocalTimeScheduleItem::isInRange() const {
+    if (!isHMSInRange(timeRange.hmsStart) || !isHMSInRange(timeRange.hmsEnd)) {
+        return false;
+    }
+
+    switch(scheduleItemType) {
+    case ScheduleItemType::MINUTE_OF_HOUR:
+    case ScheduleItemType::HOUR_OF_DAY:
+        return increment >= 1;
+
+    case ScheduleItemType::DAY_OF_WEEK_OF_MONTH:
+        return dayOfWeek >= 0 && dayOfWeek <= 6 && increment != 0 && increment >= -5 && increment <= 5;
+
+    case ScheduleItemType::DAY_OF_MONTH:
+        return increment != 0 && increment >= -31 && increment <= 31;
+
+    case ScheduleItemType::TIME:
+        return true;
+
+    case ScheduleItemType::RECURRENCE_RULE:
+        return recurrence.isValid();
+
+    case ScheduleItemType::CRON:
+        return cron.isValid();
+
+    default:
+        return false;
+    }
+}
+
+void LocalTimeScheduleItem::validate(const LocalTimeConvert &conv, int horizonDays, const char *scheduleName, int itemIndex, LocalTimeScheduleValidation &result) const {
+    LocalTimeScheduleIssue issue;
+    issue.scheduleName = scheduleName;
+    issue.itemIndex = itemIndex;
+
+    result.itemsChecked++;
+
+    LocalTimeYMD expirationDate = getExpirationDate();
+
+    neverFires = true;
+    if (!isInRange()) {
+        issue.type = LocalTimeScheduleIssue::IssueType::OUT_OF_RANGE;
+    }
+    else
+    if (timeRange.onlyOnDays.getMask() == 0 && timeRange.onlyOnDates.empty()) {
+        issue.type = LocalTimeScheduleIssue::IssueType::NO_VALID_DATES;
+    }
+    else
+    if (!expirationDate.isEmpty() && expirationDate < conv.getLocalTimeYMD()) {
+        issue.type = LocalTimeScheduleIssue::IssueType::EXPIRED;
+    }
+    else {
+        neverFires = false;
+
+        // Items with only on dates are checked up to the last date, which can be past the horizon
+        LocalTimeConvert tempConv(conv);
+        if (getNextScheduledTime(tempConv, horizonDays) && tempConv.time <= conv.time + (time_t)horizonDays * 86400) {
+            return;
+        }
+        issue.type = LocalTimeScheduleIssue::IssueType::NO_OCCURRENCE;
+    }
+
+    if (neverFires) {
+        result.itemsExcluded++;
+    }
+    result.issues.push_back(issue);
+}
+
+bool LocalTimeScheduleItem::getNextScheduledTimeCached(const LocalTimeConvert &conv, time_t &nextTime) const {
+    uint32_t hash = configHash(conv);
+
+    if (cacheNextTime != 0 && cacheConfigHash == hash && cacheFromTime <= conv.time && conv.time < cacheNextTime) {
+        nextTime = cacheNextTime;
+        return true;
+    }
+
+    LocalTimeConvert tempConv(conv);
+    if (!getNextScheduledTime(tempConv)) {
+        // Not found within the lookahead window; not cached because the window moves with conv.time
+        cacheNextTime = 0;
+        return false;
+    }
+
+    cacheFromTime = conv.time;
+    cacheNextTime = nextTime = tempConv.time;
+    cacheConfigHash = hash;
+    return true;
+}
+
+bool LocalTimeScheduleItem::getNextScheduledTime(LocalTimeConvert &conv) const {
+    return getNextScheduledTime(conv, LocalTime::instance().getScheduleLookaheadDays());
+}
+
+bool LocalTimeScheduleItem::getNextScheduledTime(LocalTimeConvert &conv, int lookaheadDays) const {
+
+    if (scheduleItemType == ScheduleItemType::RECURRENCE_RULE || scheduleItemType == ScheduleItemType::CRON) {
+        // Recurrence rules and cron expressions find their next occurrence directly instead of checking each day
+        time_t nextTime;
+        bool found;
+        if (scheduleItemType == ScheduleItemType::RECURRENCE_RULE) {
+            found = recurrence.getNextOccurrence(conv, lookaheadDays, timeRange, nextTime);
+        }
+        else {
+            found = cron.getNextOccurrence(conv, lookaheadDays, timeRange, nextTime);
+        }
+        if (!found) {
+            return false;
+        }
+        conv.time = nextTime;
+        conv.convert();
+        return true;
+    }
+
+    LocalTimeConvert tempConv(conv);
+    
+    LocalTimeYMD endYMD;
+    
+    LocalTimeYMD expirationDate = getExpirationDate();
+    if (expirationDate.isEmpty()) {
+        endYMD = tempConv.getLocalTimeYMD();
+
+        // Maximum number of days to look ahead in the schedule for the next scheduled time
+        endYMD.addDay(lookaheadDays);
+    }
+    else {
+        endYMD = expirationDate;
+    }
+    
+    for(;; tempConv.nextDay(LocalTimeHMS::startOfDay)) {
+        LocalTimeYMD curYMD = tempConv.getLocalTimeYMD();
+        if (curYMD > endYMD) {
+            break;
+        }
+
+        if (!timeRange.isValidDate(curYMD)) {
+            // This is a time range restricted that excludes this date, so skip this date
+            continue;
+        }
+
+        switch(scheduleItemType) {
+        case ScheduleItemType::NONE:
+            break;
+
+        case ScheduleItemType::HOUR_OF_DAY:
+        case ScheduleItemType::MINUTE_OF_HOUR:
+            {
+                bool bResult = false;
+
+                int cmp = timeRange.compareTo(tempConv.localTimeValue.hms());
+                if (cmp < 0) {
+                    // Before time range, return beginning of time range
+                    tempConv.atLocalTime(timeRange.hmsStart);
+                    conv.time = tempConv.time;
+                    conv.convert();
+                    return true;
+                }
+                else 
+                if (cmp == 0) {
+                    // In time range hmsStart <= hms <= hmsEnd
+                    // Handle multiples here
+                    struct tm timeInfo;
+                    int startingModulo;
+                    int minuteOffset;
+                     
+                    switch(scheduleItemType) {
+                    case ScheduleItemType::HOUR_OF_DAY:
+                        // Loop here instead of doing the modulo math to correctly handle timezone and daylight saving switch
+                        for(LocalTimeHMS tempHMS = timeRange.hmsStart; tempHMS <= timeRange.hmsEnd; tempHMS.hour += increment) {
+                            tempConv.atLocalTime(tempHMS);
+                            if (tempConv.time > conv.time) {
+                                // Found match
+                                bResult = true;
+                                break;
+                            }
+                        }
+                        break;
+
+                    case ScheduleItemType::MINUTE_OF_HOUR:
+                        // TODO: I think this is wrong for timezones with a minute offset
+                        startingModulo = timeRange.hmsStart.minute % increment;
+
+                        tempConv.time += increment * 60;
+                        tempConv.convert();
+
+                        LocalTime::timeToTm(tempConv.time, &timeInfo);
+                        minuteOffset = (tempConv.localTimeValue.minute() - startingModulo) % increment;
+                        if (minuteOffset < 0) {
+                            // Minute is before startingModulo in the hour; C++ % keeps the sign of the dividend
+                            minuteOffset += increment;
+                        }
+                        timeInfo.tm_min -= minuteOffset;
+                        timeInfo.tm_sec = timeRange.hmsStart.second;
+                        tempConv.time = LocalTime::tmToTime(&timeInfo);
+                        tempConv.convert();
+                        if (tempConv.getLocalTimeHMS() < timeRange.hmsEnd) {
+                            bResult = true;
+                        }
+                        break;
+
+                    default:
+                        break;
+                    }
+
+                    if (bResult) {
+                        if (!timeRange.isValidDate(tempConv.getLocalTimeYMD())) {
+                            bResult = false;
+                        }
+                    }
+
+                    if (bResult) {
+                        conv.time = tempConv.time;
+                        conv.convert();
+                        return true;
+                    }
+                }
+                else {
+                    // cmp > 0, after time range, don't check and try next day
+                }
+            }
+            break;            
+            
+        case ScheduleItemType::DAY_OF_WEEK_OF_MONTH:
+            // "dayOfWeek" specifies the day of the week (0 = Sunday, 1 = Monday, ...)
+            // "increment" specifies which one (1 = first, 2 = second, ... or -1 = last, -2 = second to last, ...)
+            // Time is at the HMS of the hmsStart (local time)
+            {
+                int day = LocalTime::dayOfWeekOfMonth(tempConv.localTimeValue.year(), tempConv.localTimeValue.month(), dayOfWeek, increment);
+                if (day == tempConv.localTimeValue.day()) {
+                    tempConv.atLocalTime(timeRange.hmsStart);
+                    if (tempConv.time > conv.time) {
+                        conv.time = tempConv.time;
+                        conv.convert();
+                        return true;
+                    }
+                }
+            }
+            break;
+            
+        case ScheduleItemType::DAY_OF_MONTH:
+            {
+                int tempIncrement = increment;
+                if (tempIncrement < 0) {
+                    tempIncrement = LocalTime::lastDayOfMonth(tempConv.localTimeValue.year(), tempConv.localTimeValue.month()) + tempIncrement + 1;
+                }
+                // "increment" specifies which day of month (1, 2, 3, ...) or 
+                // Time is at the HMS of the hmsStart (local time)
+                if (tempConv.localTimeValue.ymd().getDay() == tempIncrement) {
+                    int cmp = timeRange.compareTo(tempConv.localTimeValue.hms());
+                    if (cmp <= 0) {
+                        // Before the beginning of time range, return beginning of time range
+                        tempConv.atLocalTime(timeRange.hmsStart);
+                        if (tempConv.time > conv.time) {
+                            conv.time = tempConv.time;
+                            conv.convert();
+                            return true;
+                        }
+                    }
+                }
+
+            }
+            break;
+
+        case ScheduleItemType::TIME: 
+            // At a specific time, optionally with day of week or date restrictions            
+            // The first test must be <= otherwise you can't schedule at midnight.
+            // The second test for conv.time must be > to advance to the next schedule.
+            if (tempConv.localTimeValue.hms() <= timeRange.hmsStart) {
+                tempConv.atLocalTime(timeRange.hmsStart);
+                if (tempConv.time > conv.time) {
+                    conv.time = tempConv.time;
+                    conv.convert();
+                    return true;
+                }
+            }
+            break;
+
+        case ScheduleItemType::RECURRENCE_RULE:
+        case ScheduleItemType::CRON:
+            // Handled before the loop, which these types never reach
+            break;
+        }
+
+        
+    }
+
+    // No next time found (no schedule, or all days excluded within the next getScheduleLookaheadDays() days)
+    return false;
+}
+
+
+void LocalTimeScheduleItem::fromJson(JSONValue jsonObj) {
+    JSONObjectIterator iter(jsonObj);
+    while(iter.next()) {
+        String key = (const char *) iter.name();
+        if (key == "m") {
+            scheduleItemType = (ScheduleItemType) iter.value().toInt();
+        }
+        else
+        if (key == "i") {
+            increment = iter.value().toInt();
+        }
+        else
+        if (key == "d") {
+            dayOfWeek = iter.value().toInt();
+        }
+        else
+        if (key == "f") {
+            flags = iter.value().toInt();
+        }
+        else
+        if (key == "n") {
+            name = iter.value().toString().data();
+        }
+        else
+        if (key == "mh") {
+            // Shortcut for setting item
+            scheduleItemType = ScheduleItemType::MINUTE_OF_HOUR;
+            increment = iter.value().toInt();
+        }
+        else
+        if (key == "hd") {
+            // Shortcut for setting item
+            scheduleItemType = ScheduleItemType::HOUR_OF_DAY;
+            increment = iter.value().toInt();
         }
         else
         if (key == "dw") {
@@ -821,11 +1939,81 @@ void LocalTimeScheduleItem::fromJson(JSONValue jsonObj) {
             timeRange.hmsStart = LocalTimeHMS(iter.value().toString().data());
             timeRange.onlyOnDays = LocalTimeDayOfWeek::MASK_ALL;
         }
+        else
+        if (key == "rr") {
+            // Recurrence rule, with the start in "ds"
+            scheduleItemType = ScheduleItemType::RECURRENCE_RULE;
+            recurrence.ruleStr = iter.value().toString().data();
+            timeRange.onlyOnDays = LocalTimeDayOfWeek::MASK_ALL;
+        }
+        else
+        if (key == "ds") {
+            recurrence.dtstartStr = iter.value().toString().data();
+        }
+        else
+        if (key == "cr") {
+            // Cron expression
+            scheduleItemType = ScheduleItemType::CRON;
+            cron.parse(iter.value().toString().data());
+            timeRange.onlyOnDays = LocalTimeDayOfWeek::MASK_ALL;
+        }
+    }
+
+    if (scheduleItemType == ScheduleItemType::RECURRENCE_RULE) {
+        String dtstart = recurrence.dtstartStr;
+        String rule = recurrence.ruleStr;
+        recurrence.parse(dtstart.c_str(), rule.c_str());
     }
 
     timeRange.fromJson(jsonObj);
 }
 
+void LocalTimeScheduleItem::toJson(JSONWriter &writer) const {
+    writer.beginObject();
+
+    if (scheduleItemType == ScheduleItemType::TIME) {
+        // The tm key sets both the type and the start time
+        writer.name("tm");
+        timeRange.hmsStart.toJson(writer);
+    }
+    else
+    if (scheduleItemType == ScheduleItemType::RECURRENCE_RULE) {
+        // The rr key sets the type; the time of day comes from the start
+        writer.name("rr").value(recurrence.ruleStr.c_str());
+        writer.name("ds").value(recurrence.dtstartStr.c_str());
+    }
+    else
+    if (scheduleItemType == ScheduleItemType::CRON) {
+        writer.name("cr").value(cron.expression.c_str());
+    }
+    else {
+        writer.name("m").value((int)scheduleItemType);
+        writer.name("i").value(increment);
+        if (scheduleItemType == ScheduleItemType::DAY_OF_WEEK_OF_MONTH || dayOfWeek != 0) {
+            writer.name("d").value(dayOfWeek);
+        }
+        if (timeRange.hmsStart != LocalTimeHMS::startOfDay) {
+            writer.name("s");
+            timeRange.hmsStart.toJson(writer);
+        }
+    }
+    if (timeRange.hmsEnd != LocalTimeHMS::endOfDay) {
+        writer.name("e");
+        timeRange.hmsEnd.toJson(writer);
+    }
+
+    timeRange.LocalTimeRestrictedDate::toJson(writer);
+
+    if (flags != 0) {
+        writer.name("f").value(flags);
+    }
+    if (name.length() > 0) {
+        writer.name("n").value(name.c_str());
+    }
+
+    writer.endObject();
+}
+
 //
 // LocalTimeSchedule
 //
@@ -836,7 +2024,7 @@ LocalTimeSchedule &LocalTimeSchedule::withMinuteOfHour(int increment, LocalTimeR
     item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::MINUTE_OF_HOUR;
     item.increment = increment;
     item.timeRange = timeRange;
-    scheduleItems.push_back(item);
+    addItem(item);
     return *this;
 }
 
@@ -846,7 +2034,7 @@ LocalTimeSchedule &LocalTimeSchedule::withHourOfDay(int hourMultiple, LocalTimeR
     item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::HOUR_OF_DAY;
     item.increment = hourMultiple;
     item.timeRange = timeRange;
-    scheduleItems.push_back(item);
+    addItem(item);
     return *this;
 }
 
@@ -856,7 +2044,7 @@ LocalTimeSchedule &LocalTimeSchedule::withDayOfWeekOfMonth(int dayOfWeek, int in
     item.dayOfWeek = dayOfWeek;
     item.increment = instance;
     item.timeRange = timeRange;
-    scheduleItems.push_back(item);
+    addItem(item);
     return *this;
 }
 
@@ -865,7 +2053,7 @@ LocalTimeSchedule &LocalTimeSchedule::withDayOfMonth(int dayOfMonth, LocalTimeRa
     item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::DAY_OF_MONTH;
     item.increment = dayOfMonth;
     item.timeRange = timeRange;
-    scheduleItems.push_back(item);
+    addItem(item);
     return *this;
 }
 
@@ -874,7 +2062,7 @@ LocalTimeSchedule &LocalTimeSchedule::withTime(LocalTimeHMSRestricted hms) {
     LocalTimeScheduleItem item;
     item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::TIME;
     item.timeRange.fromTime(hms);
-    scheduleItems.push_back(item);
+    addItem(item);
     
     return *this;
 }
@@ -890,6 +2078,30 @@ LocalTimeSchedule &LocalTimeSchedule::withTimes(std::initializer_list<LocalTimeH
 }
 
 
+LocalTimeSchedule &LocalTimeSchedule::withRecurrenceRule(const char *dtstart, const char *rule, LocalTimeRestrictedDate dateRestriction) {
+    LocalTimeScheduleItem item;
+    item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::RECURRENCE_RULE;
+    if (item.recurrence.parse(dtstart, rule)) {
+        static_cast<LocalTimeRestrictedDate &>(item.timeRange) = dateRestriction;
+        addItem(item);
+    }
+
+    return *this;
+}
+
+
+LocalTimeSchedule &LocalTimeSchedule::withCron(const char *expression, LocalTimeRestrictedDate dateRestriction) {
+    LocalTimeScheduleItem item;
+    item.scheduleItemType = LocalTimeScheduleItem::ScheduleItemType::CRON;
+    if (item.cron.parse(expression)) {
+        static_cast<LocalTimeRestrictedDate &>(item.timeRange) = dateRestriction;
+        addItem(item);
+    }
+
+    return *this;
+}
+
+
 void LocalTimeSchedule::fromJson(const char *jsonStr) {
     JSONValue outerObj = JSONValue::parseCopy(jsonStr);
 
@@ -901,28 +2113,196 @@ void LocalTimeSchedule::fromJson(JSONValue jsonArray) {
     while(iter.next()) {
         LocalTimeScheduleItem item;
         item.fromJson(iter.value());
-        scheduleItems.push_back(item);
+        addItem(item);
+    }
+}
+
+uint32_t LocalTimeSchedule::addItem(const LocalTimeScheduleItem &item) {
+    scheduleItems.push_back(item);
+    nextTimeStale = true;
+    return CHANGE_ITEM_ADDED;
+}
+
+uint32_t LocalTimeSchedule::removeItem(size_t index) {
+    if (index >= scheduleItems.size()) {
+        return CHANGE_NONE;
+    }
+    scheduleItems.erase(scheduleItems.begin() + index);
+    nextTimeStale = true;
+    return CHANGE_ITEM_REMOVED;
+}
+
+uint32_t LocalTimeSchedule::replaceItem(size_t index, const LocalTimeScheduleItem &item) {
+    if (index >= scheduleItems.size() || scheduleItems[index] == item) {
+        return CHANGE_NONE;
+    }
+    scheduleItems[index] = item;
+    scheduleItems[index].invalidateCache();
+    nextTimeStale = true;
+    return CHANGE_ITEM_REPLACED;
+}
+
+int LocalTimeSchedule::findItem(const LocalTimeScheduleItem &item) const {
+    for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
+        if (*it == item) {
+            return (int)(it - scheduleItems.begin());
+        }
+    }
+    return -1;
+}
+
+// Adds ymd to dates if not already present. Returns true if added.
+static bool addDate(std::vector<LocalTimeYMD> &dates, LocalTimeYMD ymd) {
+    for(auto it = dates.begin(); it != dates.end(); ++it) {
+        if (*it == ymd) {
+            return false;
+        }
+    }
+    dates.push_back(ymd);
+    return true;
+}
+
+// Removes ymd from dates. Returns true if it was present.
+static bool removeDate(std::vector<LocalTimeYMD> &dates, LocalTimeYMD ymd) {
+    for(auto it = dates.begin(); it != dates.end(); ++it) {
+        if (*it == ymd) {
+            dates.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t LocalTimeSchedule::addExceptDate(size_t index, LocalTimeYMD ymd) {
+    if (index >= scheduleItems.size() || !addDate(scheduleItems[index].timeRange.exceptDates, ymd)) {
+        return CHANGE_NONE;
+    }
+    scheduleItems[index].invalidateCache();
+    nextTimeStale = true;
+    return CHANGE_DATES;
+}
+
+uint32_t LocalTimeSchedule::addExceptDate(LocalTimeYMD ymd) {
+    uint32_t changes = CHANGE_NONE;
+    for(size_t ii = 0; ii < scheduleItems.size(); ii++) {
+        changes |= addExceptDate(ii, ymd);
+    }
+    return changes;
+}
+
+uint32_t LocalTimeSchedule::removeExceptDate(size_t index, LocalTimeYMD ymd) {
+    if (index >= scheduleItems.size() || !removeDate(scheduleItems[index].timeRange.exceptDates, ymd)) {
+        return CHANGE_NONE;
+    }
+    scheduleItems[index].invalidateCache();
+    nextTimeStale = true;
+    return CHANGE_DATES;
+}
+
+uint32_t LocalTimeSchedule::removeExceptDate(LocalTimeYMD ymd) {
+    uint32_t changes = CHANGE_NONE;
+    for(size_t ii = 0; ii < scheduleItems.size(); ii++) {
+        changes |= removeExceptDate(ii, ymd);
+    }
+    return changes;
+}
+
+uint32_t LocalTimeSchedule::addOnlyOnDate(size_t index, LocalTimeYMD ymd) {
+    if (index >= scheduleItems.size() || !addDate(scheduleItems[index].timeRange.onlyOnDates, ymd)) {
+        return CHANGE_NONE;
+    }
+    scheduleItems[index].invalidateCache();
+    nextTimeStale = true;
+    return CHANGE_DATES;
+}
+
+uint32_t LocalTimeSchedule::removeOnlyOnDate(size_t index, LocalTimeYMD ymd) {
+    if (index >= scheduleItems.size() || !removeDate(scheduleItems[index].timeRange.onlyOnDates, ymd)) {
+        return CHANGE_NONE;
+    }
+    scheduleItems[index].invalidateCache();
+    nextTimeStale = true;
+    return CHANGE_DATES;
+}
+
+void LocalTimeSchedule::invalidate() {
+    for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
+        it->invalidateCache();
+    }
+    nextTimeStale = true;
+}
+
+void LocalTimeSchedule::validate(const LocalTimeConvert &conv, LocalTimeScheduleValidation &result, int horizonDays) {
+    if (horizonDays <= 0) {
+        horizonDays = LocalTime::instance().getScheduleLookaheadDays();
+    }
+    result.horizonDays = horizonDays;
+    result.schedulesChecked++;
+
+    for(size_t ii = 0; ii < scheduleItems.size(); ii++) {
+        scheduleItems[ii].validate(conv, horizonDays, name.c_str(), (int)ii, result);
+    }
+    nextTimeStale = true;
+}
+
+bool LocalTimeSchedule::canFire() const {
+    for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
+        if (!it->neverFires) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LocalTimeSchedule::toJson(JSONWriter &writer) const {
+    writer.beginArray();
+    for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
+        it->toJson(writer);
     }
+    writer.endArray();
+}
+
+size_t LocalTimeSchedule::toJson(char *buf, size_t bufSize) const {
+    if (bufSize == 0) {
+        return 0;
+    }
+
+    // Leave room for the null terminator, which JSONBufferWriter does not add
+    JSONBufferWriter writer(buf, bufSize - 1);
+    toJson(writer);
+
+    size_t size = writer.dataSize();
+    buf[(size < bufSize) ? size : (bufSize - 1)] = 0;
+
+    return size;
 }
 
 
 bool LocalTimeSchedule::getNextScheduledTime(LocalTimeConvert &conv) const {
 
-    return getNextScheduledTime(conv, [](LocalTimeScheduleItem &item) {
-        return true;
-    });
+    return getNextScheduledTime(conv, nullptr);
 }
 
 bool LocalTimeSchedule::getNextScheduledTime(LocalTimeConvert &conv, std::function<bool(LocalTimeScheduleItem &item)> filter) const {
     time_t closestTime = 0;
 
     for(auto it = scheduleItems.begin(); it != scheduleItems.end(); ++it) {
-        LocalTimeScheduleItem item = *it;
-        if (filter(item)) {
-            LocalTimeConvert tmpConvert(conv);
-            bool bResult = item.getNextScheduledTime(tmpConvert);
-            if (bResult && closestTime == 0 || tmpConvert.time < closestTime) {
-                closestTime = tmpConvert.time;
+        if (it->neverFires) {
+            // validate() found that this item can never fire
+            continue;
+        }
+        if (filter) {
+            // The filter gets a copy, so changes it makes are not kept
+            LocalTimeScheduleItem item = *it;
+            if (!filter(item)) {
+                continue;
+            }
+        }
+
+        time_t itemTime;
+        if (it->getNextScheduledTimeCached(conv, itemTime)) {
+            if (closestTime == 0 || itemTime < closestTime) {
+                closestTime = itemTime;
             }
         }
     }
@@ -949,24 +2329,71 @@ bool LocalTimeSchedule::isScheduledTime() {
     return isScheduledTime(conv, Time.now());
 }
 
+void LocalTimeSchedule::updateStaleNextTime(const LocalTimeConvert &conv) {
+    if (nextTimeStale) {
+        // Items changed since nextTime was calculated. Recalculate it from the same starting point
+        // so an added time that is already due still fires and a removed time does not.
+        nextTimeStale = false;
+        if (nextTimeFrom != 0) {
+            LocalTimeConvert tempConv(conv);
+            tempConv.withTime(nextTimeFrom).convert();
+            nextTime = getNextScheduledTime(tempConv) ? tempConv.time : 0;
+        }
+    }
+}
+
 bool LocalTimeSchedule::isScheduledTime(LocalTimeConvert &conv, time_t timeNow) {
     bool result = false;
 
+    updateStaleNextTime(conv);
+
     if (nextTime != 0 && nextTime <= timeNow) {
         result = true;
         nextTime = 0;
+        lastFired = timeNow;
     }
 
+    nextTimeFrom = conv.time;
     if (getNextScheduledTime(conv)) {
         nextTime = conv.time;
     }
     
     return result;
 }
+void LocalTimeSchedule::resumeFrom(time_t checkedTime) {
+    nextTime = 0;
+    nextTimeFrom = checkedTime;
+    nextTimeStale = true;
+}
+
 //
 // LocalTimeScheduleManager
 //
 
+// CRC-32 (IEEE 802.3), bitwise to avoid a 1K table; the state record is only a few dozen bytes
+static uint32_t stateCrc32(const uint8_t *data, size_t len, uint32_t crc = 0) {
+    crc = ~crc;
+    for(size_t ii = 0; ii < len; ii++) {
+        crc ^= data[ii];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void statePut32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+    buf[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t stateGet32(const uint8_t *buf) {
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
 time_t LocalTimeScheduleManager::getNextTimeByName(const char *name, const LocalTimeConvert &conv) {
     for(auto it = schedules.begin(); it != schedules.end(); ++it) {
         if (it->name.equals(name)) {
@@ -1034,6 +2461,146 @@ void LocalTimeScheduleManager::forEach(std::function<void(LocalTimeSchedule &sch
     }
 }
 
+time_t LocalTimeScheduleManager::getEarliestNextTime() const {
+    time_t nextTime = 0;
+
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        if (it->nextTime != 0 && (nextTime == 0 || it->nextTime < nextTime)) {
+            nextTime = it->nextTime;
+        }
+    }
+    return nextTime;
+}
+
+bool LocalTimeScheduleManager::checkSchedules(const LocalTimeConvert &conv, ScheduledCallback callback) {
+    uint32_t configCount = LocalTime::instance().getConfigChangeCount();
+    if (configCount != nextEventConfigCount) {
+        // The next times were calculated with the previous timezone
+        invalidateNextEvent();
+        nextEventConfigCount = configCount;
+    }
+
+    bool result = false;
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        LocalTimeConvert tempConv(conv);
+        it->updateStaleNextTime(conv);
+        time_t scheduledTime = it->nextTime;
+        if (it->isScheduledTime(tempConv, conv.time)) {
+            result = true;
+            if (callback) {
+                callback(*it, scheduledTime);
+            }
+        }
+    }
+
+    updateNextEvent();
+    return result;
+}
+
+const LocalTimeSchedule *LocalTimeScheduleManager::getNextEventSchedule() const {
+    if (nextEventIndex >= 0 && nextEventIndex < (int)schedules.size()) {
+        return &schedules[nextEventIndex];
+    }
+    else {
+        return NULL;
+    }
+}
+
+bool LocalTimeScheduleManager::isNextEventStale() const {
+    if (!nextEventValid || nextEventConfigCount != LocalTime::instance().getConfigChangeCount()) {
+        return true;
+    }
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        if (it->nextTimeStale) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t LocalTimeScheduleManager::saveState(uint8_t *buf, size_t bufSize) const {
+    size_t size = getStateSize(schedules.size());
+    if (bufSize < size || schedules.size() > 0xffff) {
+        return 0;
+    }
+
+    statePut32(&buf[0], STATE_MAGIC);
+    statePut32(&buf[4], (uint32_t)schedules.size());
+
+    uint8_t *entry = &buf[STATE_HEADER_SIZE];
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        statePut32(&entry[0], stateCrc32((const uint8_t *)it->name.c_str(), it->name.length()));
+        statePut32(&entry[4], (uint32_t)it->nextTimeFrom);
+        statePut32(&entry[8], (uint32_t)it->lastFired);
+        entry += STATE_ENTRY_SIZE;
+    }
+    statePut32(entry, stateCrc32(buf, entry - buf));
+
+    return size;
+}
+
+bool LocalTimeScheduleManager::restoreState(const uint8_t *buf, size_t len, time_t notBefore) {
+    if (len < getStateSize(0) || stateGet32(&buf[0]) != STATE_MAGIC) {
+        return false;
+    }
+    uint32_t count = stateGet32(&buf[4]);
+    if (count > 0xffff || len < getStateSize(count)) {
+        return false;
+    }
+    size_t checksumOffset = getStateSize(count) - STATE_CHECKSUM_SIZE;
+    if (stateGet32(&buf[checksumOffset]) != stateCrc32(buf, checksumOffset)) {
+        return false;
+    }
+
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        uint32_t nameCrc = stateCrc32((const uint8_t *)it->name.c_str(), it->name.length());
+
+        const uint8_t *entry = &buf[STATE_HEADER_SIZE];
+        for(uint32_t ii = 0; ii < count; ii++, entry += STATE_ENTRY_SIZE) {
+            if (stateGet32(&entry[0]) == nameCrc) {
+                time_t checkedTime = (time_t)stateGet32(&entry[4]);
+                if (checkedTime != 0) {
+                    it->resumeFrom((checkedTime < notBefore) ? notBefore : checkedTime);
+                }
+                it->lastFired = (time_t)stateGet32(&entry[8]);
+                break;
+            }
+        }
+    }
+    nextEventValid = false;
+
+    return true;
+}
+
+void LocalTimeScheduleManager::invalidateNextEvent() {
+    // isScheduledTime() recalculates nextTime from the time it was last calculated from
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        it->nextTimeStale = true;
+    }
+    nextEventValid = false;
+}
+
+void LocalTimeScheduleManager::updateNextEvent() {
+    time_t nextTime = 0;
+    int nextIndex = -1;
+
+    for(size_t ii = 0; ii < schedules.size(); ii++) {
+        if (schedules[ii].nextTime != 0 && (nextTime == 0 || schedules[ii].nextTime < nextTime)) {
+            nextTime = schedules[ii].nextTime;
+            nextIndex = (int)ii;
+        }
+    }
+
+    if (!nextEventValid || nextTime != nextEventTime || nextIndex != nextEventIndex) {
+        nextEventValid = true;
+        nextEventTime = nextTime;
+        nextEventIndex = nextIndex;
+        if (nextEventCallback) {
+            nextEventCallback(nextEventTime, getNextEventSchedule());
+        }
+    }
+}
+
 LocalTimeSchedule &LocalTimeScheduleManager::getScheduleByName(const char *name) {
 
     for(auto it = schedules.begin(); it != schedules.end(); ++it) {
@@ -1063,6 +2630,162 @@ void LocalTimeScheduleManager::setFromJsonObject(const JSONValue &jsonObj) {
     }
 }
 
+void LocalTimeScheduleManager::toJsonObject(JSONWriter &writer) const {
+    writer.beginObject();
+    for(auto it = schedules.begin(); it != schedules.end(); ++it) {
+        writer.name(it->name.c_str());
+        it->toJson(writer);
+    }
+    writer.endObject();
+}
+
+void LocalTimeScheduleManager::validate(const LocalTimeConvert &conv, LocalTimeScheduleValidation &result, int horizonDays) {
+    result.clear();
+
+    if (horizonDays <= 0) {
+        horizonDays = LocalTime::instance().getScheduleLookaheadDays();
+    }
+    result.horizonDays = horizonDays;
+
+    // List the times each schedule fires within the horizon, in ascending order
+    std::vector<std::vector<time_t>> times(schedules.size());
+    time_t endTime = conv.time + (time_t)horizonDays * 86400;
+
+    for(size_t ii = 0; ii < schedules.size(); ii++) {
+        schedules[ii].validate(conv, result, horizonDays);
+        if (!schedules[ii].canFire()) {
+            continue;
+        }
+
+        LocalTimeConvert tempConv(conv);
+        while(schedules[ii].getNextScheduledTime(tempConv) && tempConv.time <= endTime) {
+            times[ii].push_back(tempConv.time);
+        }
+    }
+
+    // Compare each pair of schedules
+    for(size_t ii = 0; ii < schedules.size(); ii++) {
+        for(size_t jj = ii + 1; jj < schedules.size(); jj++) {
+            LocalTimeScheduleIssue issue;
+            issue.type = LocalTimeScheduleIssue::IssueType::DUPLICATE_TIME;
+
+            auto it1 = times[ii].begin();
+            auto it2 = times[jj].begin();
+            while(it1 != times[ii].end() && it2 != times[jj].end()) {
+                if (*it1 < *it2) {
+                    ++it1;
+                }
+                else
+                if (*it2 < *it1) {
+                    ++it2;
+                }
+                else {
+                    if (issue.count++ == 0) {
+                        issue.time = *it1;
+                    }
+                    ++it1;
+                    ++it2;
+                }
+            }
+
+            if (issue.count > 0) {
+                issue.scheduleName = schedules[ii].name;
+                issue.otherScheduleName = schedules[jj].name;
+                result.issues.push_back(issue);
+            }
+        }
+    }
+}
+
+//
+// LocalTimeScheduleIssue
+//
+
+const char *LocalTimeScheduleIssue::typeName(IssueType type) {
+    switch(type) {
+    case IssueType::OUT_OF_RANGE:
+        return "outOfRange";
+
+    case IssueType::NO_VALID_DATES:
+        return "noValidDates";
+
+    case IssueType::EXPIRED:
+        return "expired";
+
+    case IssueType::NO_OCCURRENCE:
+        return "noOccurrence";
+
+    case IssueType::DUPLICATE_TIME:
+        return "duplicateTime";
+
+    default:
+        return "unknown";
+    }
+}
+
+void LocalTimeScheduleIssue::toJson(JSONWriter &writer) const {
+    writer.beginObject();
+    writer.name("type").value(typeName(type));
+    writer.name("schedule").value(scheduleName.c_str());
+    if (itemIndex >= 0) {
+        writer.name("item").value(itemIndex);
+    }
+    if (type == IssueType::DUPLICATE_TIME) {
+        writer.name("other").value(otherScheduleName.c_str());
+        writer.name("time").value((unsigned int)time);
+        writer.name("count").value(count);
+    }
+    writer.endObject();
+}
+
+//
+// LocalTimeScheduleValidation
+//
+
+size_t LocalTimeScheduleValidation::countIssues(LocalTimeScheduleIssue::IssueType type) const {
+    size_t count = 0;
+    for(auto it = issues.begin(); it != issues.end(); ++it) {
+        if (it->type == type) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void LocalTimeScheduleValidation::clear() {
+    horizonDays = 0;
+    schedulesChecked = itemsChecked = itemsExcluded = 0;
+    issues.clear();
+}
+
+void LocalTimeScheduleValidation::toJson(JSONWriter &writer) const {
+    writer.beginObject();
+    writer.name("horizon").value(horizonDays);
+    writer.name("schedules").value((int)schedulesChecked);
+    writer.name("items").value((int)itemsChecked);
+    writer.name("excluded").value((int)itemsExcluded);
+    writer.name("issues").beginArray();
+    for(auto it = issues.begin(); it != issues.end(); ++it) {
+        it->toJson(writer);
+    }
+    writer.endArray();
+    writer.endObject();
+}
+
+size_t LocalTimeScheduleValidation::toJson(char *buf, size_t bufSize) const {
+    if (bufSize == 0) {
+        return 0;
+    }
+
+    // Leave room for the null terminator, which JSONBufferWriter does not add
+    JSONBufferWriter writer(buf, bufSize - 1);
+    toJson(writer);
+
+    size_t size = writer.dataSize();
+    buf[(size < bufSize) ? size : (bufSize - 1)] = 0;
+
+    return size;
+}
 
 //
 // LocalTimeRange
@@ -1106,28 +2829,62 @@ void LocalTimeRange::fromJson(JSONValue jsonObj) {
     LocalTimeRestrictedDate::fromJson(jsonObj);
 }
 
+void LocalTimeRange::toJson(JSONWriter &writer) const {
+    writer.name("s");
+    hmsStart.toJson(writer);
+
+    writer.name("e");
+    hmsEnd.toJson(writer);
+
+    LocalTimeRestrictedDate::toJson(writer);
+}
+
 
 
 //
 // LocalTimeConvert
 //
+#ifdef UNITTEST
+std::atomic<uint32_t> LocalTimeConvert::convertCount(0);
+#endif
+
 void LocalTimeConvert::convert() {
+#ifdef UNITTEST
+    convertCount++;
+#endif
     if (!config.isValid()) {
         config = LocalTime::instance().getConfig();
+        if (!zoneInfo) {
+            zoneInfo = LocalTime::instance().getZoneInfo();
+        }
     }
 
-    if (config.hasDST()) {
+    zoneType = nullptr;
+    if (zoneInfo && zoneInfo->isValid()) {
+        zoneType = zoneInfo->findType(time);
+        if (zoneType) {
+            // Covered by the transition table
+            position = zoneType->isDST ? Position::IN_DST : Position::NO_DST;
+            LocalTime::timeToTm(time + zoneType->utcOffset, &localTimeValue);
+            return;
+        }
+    }
+
+    // After the last transition in the table, its footer rule applies
+    const LocalTimePosixTimezone &rules = posixRules();
+
+    if (rules.hasDST()) {
         // We need to worry about daylight saving time
         LocalTime::timeToTm(time, &dstStartTimeInfo);
         standardStartTimeInfo = dstStartTimeInfo;
 
         // Calculate start of DST. Note that the second parameter is standardHMS because when you enter DST at 
         // a local standard time; you have not yet entered DST.
-        dstStart = config.dstStart.calculate(&dstStartTimeInfo, config.standardHMS);
+        dstStart = rules.dstStart.calculate(&dstStartTimeInfo, rules.standardHMS);
 
         // Calculate start of standard time. Same for the second parameter here, when entering standard time
         // you are leaving DST. For example you leave DST at 2 AM EDT (-0400) so that's the adjustment to UTC.
-        standardStart = config.standardStart.calculate(&standardStartTimeInfo, config.dstHMS);
+        standardStart = rules.standardStart.calculate(&standardStartTimeInfo, rules.dstHMS);
 
         if (dstStart < standardStart) {
             // Northern Hemisphere, DST is in summer
@@ -1168,10 +2925,10 @@ void LocalTimeConvert::convert() {
         position = Position::NO_DST;
     }
     if (!isDST()) {
-        LocalTime::timeToTm(time - config.standardHMS.toSeconds(), &localTimeValue);
+        LocalTime::timeToTm(time - rules.standardHMS.toSeconds(), &localTimeValue);
     }
     else {
-        LocalTime::timeToTm(time - config.dstHMS.toSeconds(), &localTimeValue);
+        LocalTime::timeToTm(time - rules.dstHMS.toSeconds(), &localTimeValue);
     }
 
 }
@@ -1229,13 +2986,13 @@ void LocalTimeConvert::nextTime(LocalTimeHMS hms) {
     time_t origTime = time;
 
     localTimeValue.setHMS(hms);
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
 
     if (time <= origTime) {
         // Day rolled backwards, so move back forward
         localTimeValue.tm_mday++;
-        time = localTimeValue.toUTC(config);
+        time = localToUTC(localTimeValue);
         convert();
     }
 }
@@ -1246,7 +3003,7 @@ void LocalTimeConvert::prevDay(LocalTimeHMS hms) {
     localTimeValue.setHMS(hms);
     localTimeValue.tm_mday--;
 
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
 }
 
@@ -1257,7 +3014,7 @@ void LocalTimeConvert::nextDay(LocalTimeHMS hms) {
     localTimeValue.setHMS(hms);
     localTimeValue.tm_mday++;
 
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
 }
 
@@ -1308,13 +3065,13 @@ bool LocalTimeConvert::nextDayOfMonth(int dayOfMonth, LocalTimeHMS hms) {
 
     localTimeValue.tm_mday = (dayOfMonth > 0) ? dayOfMonth : (lastDayOfMonth() + dayOfMonth);
     localTimeValue.setHMS(hms);
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
 
     if (time <= origTime) {
         // The target dayOfMonth and time is before the original time, so move to next month
         localTimeValue.tm_mon++;
-        time = localTimeValue.toUTC(config);
+        time = localToUTC(localTimeValue);
         convert();
     }
     return true;
@@ -1325,7 +3082,7 @@ bool LocalTimeConvert::nextDayOfNextMonth(int dayOfMonth, LocalTimeHMS hms) {
     localTimeValue.tm_mon++;
     localTimeValue.tm_mday = (dayOfMonth > 0) ? dayOfMonth : (lastDayOfMonth() + dayOfMonth);
     localTimeValue.setHMS(hms);
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
     return true;
 }
@@ -1344,7 +3101,7 @@ bool LocalTimeConvert::nextDayOfWeekOrdinal(int dayOfWeek, int ordinal, LocalTim
 void LocalTimeConvert::nextLocalTime(LocalTimeHMS hms) {
     time_t origTime = time;
     localTimeValue.setHMS(hms);
-    time = localTimeValue.toUTC(config);
+    time = localToUTC(localTimeValue);
     convert();
 
     if (time <= origTime) {
@@ -1362,7 +3119,7 @@ bool LocalTimeConvert::nextSchedule(const LocalTimeSchedule &schedule) {
 void LocalTimeConvert::atLocalTime(LocalTimeHMS hms) {
     if (!hms.ignore) {
         localTimeValue.setHMS(hms);
-        time = localTimeValue.toUTC(config);
+        time = localToUTC(localTimeValue);
         convert();
     }
 }
@@ -1393,12 +3150,15 @@ String LocalTimeConvert::format(const char* format_spec) {
     // while we are not using stdlib for managing the timezone, we have to do this manually
     String zoneNameStr = zoneName();
 
+    const LocalTimePosixTimezone &rules = posixRules();
+
+    // A zone info file names its UTC zones, so "Z" is only used with config
     char time_zone_str[16];
-    if (config.isZ()) {
+    if (&rules == &config && rules.isZ()) {
         strcpy(time_zone_str, "Z");
     }
     else {
-        int time_zone = isDST() ? config.dstHMS.toSeconds() : config.standardHMS.toSeconds();
+        int time_zone = zoneType ? -zoneType->utcOffset : (isDST() ? rules.dstHMS.toSeconds() : rules.standardHMS.toSeconds());
 
         snprintf(time_zone_str, sizeof(time_zone_str), "%+03d:%02u", -time_zone/3600, abs(time_zone/60)%60);
     }
@@ -1429,18 +3189,46 @@ String LocalTimeConvert::format(const char* format_spec) {
 }
 
 String LocalTimeConvert::zoneName() const { 
-    if (config.isZ()) {
+    if (zoneType) {
+        return zoneInfo->getName(*zoneType);
+    }
+
+    const LocalTimePosixTimezone &rules = posixRules();
+    if (&rules == &config && rules.isZ()) {
         return "Z";
     }
     else
     if (isDST()) {
-        return config.dstName;
+        return rules.dstName;
     }
     else {
-        return config.standardName;
+        return rules.standardName;
     }
 };
 
+bool LocalTimeConvert::isRepeatedLocalTime() const {
+    if (zoneType) {
+        // The next change in the table
+        auto it = std::upper_bound(zoneInfo->transitionTimes.begin(), zoneInfo->transitionTimes.end(), time);
+        if (it == zoneInfo->transitionTimes.end()) {
+            return false;
+        }
+        int32_t nextOffset = zoneInfo->types[zoneInfo->transitionTypes[it - zoneInfo->transitionTimes.begin()]].utcOffset;
+        return nextOffset < zoneType->utcOffset && *it - time <= zoneType->utcOffset - nextOffset;
+    }
+
+    // Within the length of the DST offset before the start of standard time
+    const LocalTimePosixTimezone &rules = posixRules();
+    return isDST() && standardStart > time && standardStart - time <= rules.standardHMS.toSeconds() - rules.dstHMS.toSeconds();
+}
+
+time_t LocalTimeConvert::localToUTC(const LocalTimeValue &value) const {
+    if (zoneInfo && zoneInfo->isValid()) {
+        return zoneInfo->toUTC(value);
+    }
+    return value.toUTC(config);
+}
+
 int LocalTimeConvert::lastDayOfMonth() const {
     return LocalTime::lastDayOfMonth(localTimeValue.tm_year + 1900, (localTimeValue.tm_mon % 12) + 1);
 }
@@ -1535,7 +3323,8 @@ int LocalTime::lastDayOfMonth(int year, int month) {
 
         case 2:
             if ((year % 4) == 0) {
-                if ((year % 100) == 0) {
+                if ((year % 100) == 0 && (year % 400) != 0) {
+                    // 1900 and 2100 are not leap years, but 2000 is
                     return 28;
                 }
                 else {
@@ -1614,3 +3403,219 @@ int LocalTime::dayOfWeekOfMonth(int year, int month, int dayOfWeek, int ordinal)
     
     return 0;
 }
+
+
+//
+// LocalTimeRangeIndex
+//
+
+// One end of a window, used when sweeping the windows to build the index
+struct LocalTimeRangeIndexEvent {
+    time_t time;
+    int id;
+    int delta; // +1 for the start of a window, -1 for the end
+
+    bool operator<(const LocalTimeRangeIndexEvent &other) const { return time < other.time; };
+};
+
+// Adds a window [start, end) clipped to [spanStart, spanEnd) as a pair of events
+static void addRangeIndexEvents(std::vector<LocalTimeRangeIndexEvent> &events, int id, time_t start, time_t end, time_t spanStart, time_t spanEnd) {
+    if (start < spanStart) {
+        start = spanStart;
+    }
+    if (end > spanEnd) {
+        end = spanEnd;
+    }
+    if (start < end) {
+        events.push_back({start, id, 1});
+        events.push_back({end, id, -1});
+    }
+}
+
+int LocalTimeRangeIndex::add(const LocalTimeRange &range) {
+    timeRanges.push_back(range);
+    timeRangeIds.push_back(nextId);
+    invalidate();
+    return nextId++;
+}
+
+int LocalTimeRangeIndex::add(const LocalDateTimeRange &range) {
+    dateTimeRanges.push_back(range);
+    dateTimeRangeIds.push_back(nextId);
+    invalidate();
+    return nextId++;
+}
+
+void LocalTimeRangeIndex::clear() {
+    timeRanges.clear();
+    dateTimeRanges.clear();
+    timeRangeIds.clear();
+    dateTimeRangeIds.clear();
+    nextId = 0;
+    invalidate();
+}
+
+void LocalTimeRangeIndex::build(time_t t) {
+    LocalTimePosixTimezone tempConfig = config.isValid() ? config : LocalTime::instance().getConfig();
+
+    coverStart = t;
+    coverEnd = t + (time_t)horizonDays * 86400;
+
+    std::vector<LocalTimeRangeIndexEvent> events;
+
+    // Split the horizon into spans with a constant UTC offset. The DST transitions are calculated
+    // for the UTC year, so a span also ends at the start of the next UTC year.
+    LocalTimeConvert conv;
+    conv.withConfig(tempConfig);
+
+    time_t spanStart = coverStart;
+    while(spanStart < coverEnd) {
+        conv.withTime(spanStart).convert();
+        time_t offset = LocalTime::tmToTime(&conv.localTimeValue) - spanStart;
+
+        struct tm timeInfo;
+        LocalTime::timeToTm(spanStart, &timeInfo);
+        timeInfo.tm_year++;
+        timeInfo.tm_mon = 0;
+        timeInfo.tm_mday = 1;
+        timeInfo.tm_hour = timeInfo.tm_min = timeInfo.tm_sec = 0;
+        time_t spanEnd = LocalTime::tmToTime(&timeInfo);
+        if (tempConfig.hasDST()) {
+            if (conv.dstStart > spanStart && conv.dstStart < spanEnd) {
+                spanEnd = conv.dstStart;
+            }
+            if (conv.standardStart > spanStart && conv.standardStart < spanEnd) {
+                spanEnd = conv.standardStart;
+            }
+        }
+        if (spanEnd > coverEnd) {
+            spanEnd = coverEnd;
+        }
+
+        // Each local day that overlaps this span. Local times are expressed as seconds from the
+        // epoch as if local time were UTC, so local time minus offset is UTC.
+        time_t localStart = spanStart + offset;
+        time_t localEnd = spanEnd + offset;
+        time_t dayStart = localStart - (((localStart % 86400) + 86400) % 86400);
+        for(; dayStart < localEnd; dayStart += 86400) {
+            LocalTimeValue localTimeValue;
+            LocalTime::timeToTm(dayStart, &localTimeValue);
+
+            for(size_t ii = 0; ii < timeRanges.size(); ii++) {
+                const LocalTimeRange &range = timeRanges[ii];
+                if (!range.isValidDate(localTimeValue)) {
+                    continue;
+                }
+                // The end time is inclusive, so the window ends one second after it
+                time_t start = dayStart + range.hmsStart.toSeconds() - offset;
+                time_t end = dayStart + range.hmsEnd.toSeconds() + 1 - offset;
+                if (!range.rangeCrossesMidnight()) {
+                    addRangeIndexEvents(events, timeRangeIds[ii], start, end, spanStart, spanEnd);
+                }
+                else {
+                    // Like inRange(), uses the date restrictions of the local date, so the window
+                    // is the beginning and end of the same day
+                    addRangeIndexEvents(events, timeRangeIds[ii], dayStart - offset, end, spanStart, spanEnd);
+                    addRangeIndexEvents(events, timeRangeIds[ii], start, dayStart + 86400 - offset, spanStart, spanEnd);
+                }
+            }
+        }
+        spanStart = spanEnd;
+    }
+
+    for(size_t ii = 0; ii < dateTimeRanges.size(); ii++) {
+        const LocalDateTimeRange &range = dateTimeRanges[ii];
+        if (range.isValid()) {
+            addRangeIndexEvents(events, dateTimeRangeIds[ii], range.startTime, range.endTime, coverStart, coverEnd);
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end());
+
+    // Sweep the events in time order. Pieces of the same window can touch (a range crossing
+    // midnight on consecutive days) so a count is kept for each window.
+    boundaries.clear();
+    segmentOffsets.clear();
+    activeIds.clear();
+
+    std::vector<int> counts(nextId, 0);
+    std::vector<int> active;
+
+    size_t ii = 0;
+    time_t segmentStart = coverStart;
+    while(true) {
+        for(; ii < events.size() && events[ii].time == segmentStart; ii++) {
+            int &count = counts[events[ii].id];
+            count += events[ii].delta;
+            if (count == 1 && events[ii].delta > 0) {
+                active.insert(std::lower_bound(active.begin(), active.end(), events[ii].id), events[ii].id);
+            }
+            else
+            if (count == 0) {
+                active.erase(std::lower_bound(active.begin(), active.end(), events[ii].id));
+            }
+        }
+
+        // Only add a boundary if the set of active windows changed
+        bool same = false;
+        if (!boundaries.empty()) {
+            size_t prevOffset = segmentOffsets.back();
+            same = (activeIds.size() - prevOffset == active.size()) && std::equal(active.begin(), active.end(), activeIds.begin() + prevOffset);
+        }
+        if (!same) {
+            boundaries.push_back(segmentStart);
+            segmentOffsets.push_back((uint32_t) activeIds.size());
+            activeIds.insert(activeIds.end(), active.begin(), active.end());
+        }
+
+        if (ii >= events.size() || events[ii].time >= coverEnd) {
+            break;
+        }
+        segmentStart = events[ii].time;
+    }
+    segmentOffsets.push_back((uint32_t) activeIds.size());
+}
+
+size_t LocalTimeRangeIndex::findSegment(time_t t) {
+    if (coverEnd == 0 || t < coverStart || t >= coverEnd) {
+        build(t);
+    }
+    return (std::upper_bound(boundaries.begin(), boundaries.end(), t) - boundaries.begin()) - 1;
+}
+
+size_t LocalTimeRangeIndex::getActive(time_t t, std::vector<int> &ids) {
+    size_t seg = findSegment(t);
+
+    ids.assign(activeIds.begin() + segmentOffsets[seg], activeIds.begin() + segmentOffsets[seg + 1]);
+    return ids.size();
+}
+
+bool LocalTimeRangeIndex::isActive(time_t t) {
+    size_t seg = findSegment(t);
+
+    return segmentOffsets[seg] != segmentOffsets[seg + 1];
+}
+
+bool LocalTimeRangeIndex::isActive(int id, time_t t) {
+    size_t seg = findSegment(t);
+
+    return std::binary_search(activeIds.begin() + segmentOffsets[seg], activeIds.begin() + segmentOffsets[seg + 1], id);
+}
+
+time_t LocalTimeRangeIndex::getNextBoundary(time_t t) {
+    size_t seg = findSegment(t);
+    if (seg + 1 < boundaries.size()) {
+        return boundaries[seg + 1];
+    }
+    if (coverStart == t) {
+        // Index already starts at t, so nothing changes within the horizon
+        return 0;
+    }
+
+    // The change may be after the end of the index, so rebuild starting at t and check again
+    build(t);
+    if (boundaries.size() > 1) {
+        return boundaries[1];
+    }
+    return 0;
+}
@@ -6,6 +6,9 @@
 #include <time.h>
 #include <initializer_list>
 #include <vector>
+#ifdef UNITTEST
+#include <atomic>
+#endif
 
 class LocalTimeValue;
 
@@ -256,6 +259,15 @@ public:
         return String::format("%04d-%02d-%02d", ymd.year + 1900, ymd.month, ymd.day);
     }
 
+    /**
+     * @brief Writes the value as a JSON string in YYYY-MM-DD format
+     * 
+     * @param writer The JSONWriter to write to (JSONBufferWriter, for example)
+     * 
+     * Does not allocate a String; the value is formatted into a small stack buffer.
+     */
+    void toJson(JSONWriter &writer) const;
+
     YMD ymd;    //!< Packed value for year, month, and day of month (4 bytes)
 };
 
@@ -521,6 +533,15 @@ public:
      */
     void fromJson(JSONValue jsonObj);
 
+    /**
+     * @brief Writes the value as a JSON string in HH:MM:SS format
+     * 
+     * @param writer The JSONWriter to write to (JSONBufferWriter, for example)
+     * 
+     * This is the inverse of fromJson(). Does not allocate a String.
+     */
+    void toJson(JSONWriter &writer) const;
+
 
     /**
      * @brief Sets this object to be the specified hour, with minute and second set to 0
@@ -871,6 +892,30 @@ public:
      */
     LocalTimeYMD getExpirationDate() const;
 
+    /**
+     * @brief Returns true if this object has the same mask, only on dates, and except dates as other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     * 
+     * The date lists are compared in order.
+     */
+    bool operator==(const LocalTimeRestrictedDate &other) const {
+        return onlyOnDays == other.onlyOnDays && onlyOnDates == other.onlyOnDates && exceptDates == other.exceptDates;
+    }
+
+    /**
+     * @brief Returns true if this object is not equal to other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(const LocalTimeRestrictedDate &other) const {
+        return !(*this == other);
+    }
+
     /**
      * @brief Fills in this object from JSON data
      * 
@@ -883,6 +928,17 @@ public:
      */
     void fromJson(JSONValue jsonObj);
 
+    /**
+     * @brief Writes the keys for this object into the JSON object currently being written
+     * 
+     * @param writer The JSONWriter to write to. An object must have been started with beginObject().
+     * 
+     * The keys are the same as fromJson(). The y key is always written; the a and x keys are only written
+     * if the corresponding lists are not empty. This does not call beginObject() or endObject() so the
+     * keys can be combined with the keys of a containing object, the same way fromJson() reads them.
+     */
+    void toJson(JSONWriter &writer) const;
+
     LocalTimeDayOfWeek onlyOnDays;             //!< Allow on that day of week if mask bit is set
     std::vector<LocalTimeYMD> onlyOnDates;     //!< Dates to allow
     std::vector<LocalTimeYMD> exceptDates;     //!< Dates to exclude
@@ -929,6 +985,15 @@ public:
      */
     void fromJson(JSONValue jsonObj);
 
+    /**
+     * @brief Writes the keys for this object into the JSON object currently being written
+     * 
+     * @param writer The JSONWriter to write to. An object must have been started with beginObject().
+     * 
+     * Writes the t key, then the keys from LocalTimeRestrictedDate.
+     */
+    void toJson(JSONWriter &writer) const;
+
 };
 
 
@@ -1057,6 +1122,8 @@ public:
      * 
      * @param str The string, for example: "EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00"
      * 
+     * Names that aren't only letters can be quoted in angle brackets, as in "<+0330>-3:30".
+     * 
      * If the string is not valid this function returns false and the valid flag will
      * be clear. You can call isValid() to check the validity at any time (such as
      * if you are using the constructor with a string that does not return a boolean).
@@ -1218,6 +1285,124 @@ public:
 };
 
 
+/**
+ * @brief A timezone from a compiled TZif (zoneinfo) file, with every change of UTC offset in its history
+ * 
+ * LocalTimePosixTimezone only has the current rule, so times from before the rule started convert with
+ * the wrong offset (before 2007 in the United States, for example), and zones that changed their rules
+ * can't be represented. A TZif file, like the ones in /usr/share/zoneinfo on Linux and Mac, lists each
+ * change. Version 2 and later files end with a POSIX timezone string for the times after the last one.
+ * 
+ * load() copies the changes into a sorted table of UTC times and local time types, 9 bytes per change,
+ * and the UTC to local time conversion is a binary search of the table. Pass the object to
+ * LocalTimeConvert::withZoneInfo() or LocalTime::withZoneInfo(); it must exist as long as they use it.
+ * 
+ * In host builds, loadFile() memory maps a file:
+ * 
+ * ```
+ * LocalTimeZoneInfo zoneInfo;
+ * zoneInfo.loadFile("/usr/share/zoneinfo/America/New_York");
+ * conv.withZoneInfo(&zoneInfo).withTime(time).convert();
+ * ```
+ * 
+ * On a device, embed the file as a byte array and pass it to load(). To keep it small, have zic leave
+ * out the old changes and the ones the POSIX string covers, then convert the file to C:
+ * 
+ * ```
+ * zic -b slim -r @1577836800 -d out tzdata/northamerica
+ * xxd -i out/America/New_York > NewYorkZoneInfo.h
+ * ```
+ * 
+ * Files with leap seconds (the "right" zones) are not supported.
+ */
+class LocalTimeZoneInfo {
+public:
+    /**
+     * @brief A local time type from the file: the UTC offset, whether it's DST, and the abbreviation
+     */
+    struct LocalTimeType {
+        int32_t utcOffset; //!< Seconds east of UTC (-18000 for EST). This is the opposite sign from LocalTimePosixTimezone.
+        bool isDST; //!< true if this is daylight saving time
+        uint8_t nameIndex; //!< Offset of the abbreviation in names
+    };
+
+    /**
+     * @brief Default constructor (no zone loaded)
+     */
+    LocalTimeZoneInfo();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~LocalTimeZoneInfo();
+
+    /**
+     * @brief Clears the loaded zone
+     */
+    void clear();
+
+    /**
+     * @brief Loads a zone from the contents of a TZif file
+     * 
+     * @param data The file contents. They are copied, so they don't need to be kept.
+     * @param size The size of data in bytes
+     * @return true if the file was valid
+     * 
+     * Versions 1, 2, 3 and 4 are accepted; for version 2 and later the 64-bit data and the POSIX footer
+     * are used. If the file is not valid, false is returned and isValid() will return false.
+     * 
+     * A footer rule without a time changes at 2:00, as in POSIX. A footer this library can't parse, such as
+     * one with Jn day numbers, is left out and the last local time type is used after the table.
+     */
+    bool load(const uint8_t *data, size_t size);
+
+#ifdef UNITTEST
+    /**
+     * @brief Loads a zone from a TZif file, memory mapping it to read it (host builds only)
+     * 
+     * @param path The path to the file, such as "/usr/share/zoneinfo/America/New_York"
+     * @return true if the file could be read and was valid
+     */
+    bool loadFile(const char *path);
+#endif
+
+    /**
+     * @brief Returns true if a zone has been loaded
+     */
+    bool isValid() const { return valid; };
+
+    /**
+     * @brief Gets the local time type at a time
+     * 
+     * @param time The time, Unix time at UTC
+     * @return The local time type, or nullptr if the time is after the last change in the table and the
+     * footer rule applies
+     */
+    const LocalTimeType *findType(time_t time) const;
+
+    /**
+     * @brief Converts a local time into a UTC time
+     * 
+     * This works like LocalTimeValue::toUTC() with a LocalTimePosixTimezone. When a local time happens
+     * twice, as the offset goes back, the second one is returned. A local time skipped as the offset goes
+     * forward is converted with the offset from after the change.
+     */
+    time_t toUTC(const LocalTimeValue &value) const;
+
+    /**
+     * @brief Gets the abbreviation of a local time type, such as "EST"
+     */
+    const char *getName(const LocalTimeType &type) const { return names.data() + type.nameIndex; };
+
+    std::vector<time_t> transitionTimes; //!< UTC times that the local time type changes, in ascending order
+    std::vector<uint8_t> transitionTypes; //!< Index in types of the local time type from each change
+    std::vector<LocalTimeType> types; //!< Local time types. The first is used for times before the first change.
+    std::vector<char> names; //!< Abbreviations for the local time types, each null terminated
+    LocalTimePosixTimezone footer; //!< Rule for times after the last change. Not valid for version 1 files or if the file has none.
+    bool valid = false; //!< true if a zone has been loaded
+};
+
+
 class LocalTimeConvert; // Forward declaration
 
 /**
@@ -1407,6 +1592,28 @@ public:
         hmsStart = hms;
     }
 
+    /**
+     * @brief Returns true if the start, end, and date restrictions are the same as other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator==(const LocalTimeRange &other) const {
+        return hmsStart == other.hmsStart && hmsEnd == other.hmsEnd && LocalTimeRestrictedDate::operator==(other);
+    }
+
+    /**
+     * @brief Returns true if this object is not equal to other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(const LocalTimeRange &other) const {
+        return !(*this == other);
+    }
+
     /**
      * @brief Fills in the time range from a JSON object
      * 
@@ -1418,11 +1625,323 @@ public:
      */
     void fromJson(JSONValue jsonObj);
 
+    /**
+     * @brief Writes the keys for this object into the JSON object currently being written
+     * 
+     * @param writer The JSONWriter to write to. An object must have been started with beginObject().
+     * 
+     * Writes the s and e keys, then the keys from LocalTimeRestrictedDate.
+     */
+    void toJson(JSONWriter &writer) const;
+
     LocalTimeHMS hmsStart; //!< Starting time, inclusive
     LocalTimeHMS hmsEnd; //!< Ending time, inclusive
 };
 
 
+/**
+ * @brief One problem found by LocalTimeScheduleManager::validate() or LocalTimeSchedule::validate()
+ */
+class LocalTimeScheduleIssue {
+public:
+    /**
+     * @brief Kind of problem
+     */
+    enum class IssueType : int {
+        OUT_OF_RANGE,       //!< An hour, minute, second, increment, day, or day of week is out of range (item can never fire)
+        NO_VALID_DATES,     //!< No days of the week and no only on dates are set (item can never fire)
+        EXPIRED,            //!< All of the only on dates are in the past (item can never fire again)
+        NO_OCCURRENCE,      //!< The item does not fire within the horizon, but might fire later
+        DUPLICATE_TIME,     //!< Two schedules fire at the same time
+    };
+
+    /**
+     * @brief Returns a short lowercase name for an issue type, such as "expired"
+     * 
+     * @param type 
+     * @return const char* 
+     */
+    static const char *typeName(IssueType type);
+
+    /**
+     * @brief Write this issue as a JSON object
+     * 
+     * @param writer JSONWriter to write to
+     * 
+     * Keys are "type", "schedule", "item" (if the issue is for a single item), and for DUPLICATE_TIME,
+     * "other" (the other schedule name), "time" (first duplicate time, UTC), and "count".
+     */
+    void toJson(JSONWriter &writer) const;
+
+    IssueType type = IssueType::OUT_OF_RANGE; //!< Kind of problem
+    String scheduleName; //!< Name of the schedule the issue is in
+    int itemIndex = -1; //!< Index into scheduleItems, or -1 if the issue is not for a single item
+    String otherScheduleName; //!< For DUPLICATE_TIME, the name of the other schedule
+    time_t time = 0; //!< For DUPLICATE_TIME, the first duplicate time (UTC)
+    int count = 0; //!< For DUPLICATE_TIME, the number of duplicate times within the horizon
+};
+
+/**
+ * @brief Result of validating schedules when they are built or loaded
+ * 
+ * Items that can never fire (OUT_OF_RANGE, NO_VALID_DATES, EXPIRED) are marked by validation and are
+ * skipped by getNextScheduledTime() from then on, so they don't cost a lookahead scan on every call.
+ * NO_OCCURRENCE and DUPLICATE_TIME are informational and don't change scheduling.
+ */
+class LocalTimeScheduleValidation {
+public:
+    /**
+     * @brief Returns true if no issues were found
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isValid() const { return issues.empty(); };
+
+    /**
+     * @brief Returns the number of issues of a given type
+     * 
+     * @param type 
+     * @return size_t 
+     */
+    size_t countIssues(LocalTimeScheduleIssue::IssueType type) const;
+
+    /**
+     * @brief Clear the results
+     */
+    void clear();
+
+    /**
+     * @brief Write the result as a JSON object
+     * 
+     * @param writer JSONWriter to write to
+     * 
+     * Keys are "horizon" (days), "schedules", "items", "excluded" (items that can never fire), and
+     * "issues", an array of LocalTimeScheduleIssue objects.
+     */
+    void toJson(JSONWriter &writer) const;
+
+    /**
+     * @brief Write the result as JSON to a buffer
+     * 
+     * @param buf Buffer to write to. Always null terminated if bufSize > 0.
+     * @param bufSize Size of buf in bytes
+     * @return size_t Length of the full JSON output, which may be larger than bufSize - 1 if truncated
+     */
+    size_t toJson(char *buf, size_t bufSize) const;
+
+    int horizonDays = 0; //!< Number of days checked for occurrences and duplicates
+    size_t schedulesChecked = 0; //!< Number of schedules checked
+    size_t itemsChecked = 0; //!< Number of schedule items checked
+    size_t itemsExcluded = 0; //!< Number of schedule items that can never fire
+    std::vector<LocalTimeScheduleIssue> issues; //!< Problems found
+};
+
+/**
+ * @brief An iCalendar (RFC 5545) recurrence rule, compiled for finding the next occurrence
+ * 
+ * A subset of RRULE is supported: FREQ (DAILY, WEEKLY, or MONTHLY), INTERVAL, BYDAY (with ordinals 
+ * like 2TU or -1FR for MONTHLY), BYMONTHDAY, BYSETPOS, UNTIL, COUNT, and WKST. The time of day and
+ * the anchor for INTERVAL come from DTSTART, which is in local time. For example, every other Tuesday
+ * at 7:00 PM starting 2022-01-04 is DTSTART 20220104T190000 and RRULE FREQ=WEEKLY;INTERVAL=2;BYDAY=TU.
+ * 
+ * The rule is compiled into bit masks. Finding the next occurrence jumps directly to the first period
+ * (day, week, or month) allowed by INTERVAL, then checks at most 31 candidate days per period, instead
+ * of checking every day. With COUNT, periods are counted from DTSTART.
+ */
+class LocalTimeRecurrenceRule {
+public:
+    /**
+     * @brief The FREQ of the rule
+     */
+    enum class Frequency : int {
+        NONE = 0,   //!< Not set, or the rule could not be parsed
+        DAILY,      //!< FREQ=DAILY
+        WEEKLY,     //!< FREQ=WEEKLY
+        MONTHLY,    //!< FREQ=MONTHLY
+    };
+
+    /**
+     * @brief Parse a DTSTART and RRULE
+     * 
+     * @param dtstart Local start date and time in iCalendar format (20220104T190000 or 20220104). The
+     * "DTSTART:" prefix is optional.
+     * @param rule The rule, for example "FREQ=WEEKLY;INTERVAL=2;BYDAY=TU". The "RRULE:" prefix is optional.
+     * @return true if the rule was parsed, false if it has an error or uses an unsupported part of RRULE
+     * 
+     * If false is returned, isValid() will return false and the rule never fires.
+     */
+    bool parse(const char *dtstart, const char *rule);
+
+    /**
+     * @brief Returns true if parse() succeeded
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isValid() const { return freq != Frequency::NONE; };
+
+    /**
+     * @brief Find the next occurrence after conv.time
+     * 
+     * @param conv The time to start from and the timezone configuration. Not modified.
+     * @param lookaheadDays Number of days after the local date of conv to check
+     * @param restrictions Occurrences on dates not valid for these restrictions are skipped (EXDATE). They
+     * still count toward COUNT.
+     * @param nextTime Filled in with the next occurrence (UTC) if true is returned
+     * @return true if an occurrence was found
+     */
+    bool getNextOccurrence(const LocalTimeConvert &conv, int lookaheadDays, const LocalTimeRestrictedDate &restrictions, time_t &nextTime) const;
+
+    /**
+     * @brief Returns true if the DTSTART and RRULE strings are the same as other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator==(const LocalTimeRecurrenceRule &other) const {
+        return dtstartStr == other.dtstartStr && ruleStr == other.ruleStr;
+    }
+
+    /**
+     * @brief Returns true if this object is not equal to other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(const LocalTimeRecurrenceRule &other) const {
+        return !(*this == other);
+    }
+
+    String dtstartStr; //!< DTSTART as passed to parse(), used for toJson
+    String ruleStr; //!< RRULE as passed to parse(), used for toJson
+
+    Frequency freq = Frequency::NONE; //!< FREQ
+    int interval = 1; //!< INTERVAL, 1 or larger
+    int count = 0; //!< COUNT, or 0 if not set
+    int weekStart = 1; //!< WKST, 0 = Sunday, 1 = Monday (default), ...
+    uint8_t byDayMask = 0; //!< BYDAY days without an ordinal, bit 0 = Sunday
+    uint16_t byDayOrdinals[7] = {0}; //!< BYDAY days with an ordinal, by day of week. Bits 0-4 are 1 to 5, bits 5-9 are -1 to -5.
+    uint32_t byMonthDay = 0; //!< BYMONTHDAY, bit 0 = 1st of the month
+    uint32_t byMonthDayFromEnd = 0; //!< BYMONTHDAY negative values, bit 0 = -1 (last day of the month)
+    uint32_t bySetPos = 0; //!< BYSETPOS, bit 0 = 1 (first)
+    uint32_t bySetPosFromEnd = 0; //!< BYSETPOS negative values, bit 0 = -1 (last)
+    LocalTimeYMD dtstartYMD; //!< Local date of DTSTART
+    LocalTimeHMS dtstartHMS; //!< Local time of DTSTART, the time of day of every occurrence
+    LocalTimeYMD untilYMD; //!< UNTIL date (local), or empty if not set or UNTIL is UTC
+    LocalTimeHMS untilHMS; //!< UNTIL time (local)
+    time_t untilUTC = 0; //!< UNTIL if specified in UTC (ending in Z), otherwise 0
+
+protected:
+    /**
+     * @brief Get the days in a period that match the rule, before BYSETPOS
+     * 
+     * @param start Day number of the first day of the period
+     * @param len Number of days in the period, 1 to 31
+     * @return uint32_t Bit 0 is start, bit 1 is the next day, ...
+     */
+    uint32_t getMatchingDays(int start, int len) const;
+};
+
+/**
+ * @brief A cron expression, compiled into bit masks for each field
+ * 
+ * Both 5-field (minute hour day-of-month month day-of-week) and 6-field (second first) expressions
+ * are supported. Each field can be *, a number, a range (9-17), a list (1,15), or a step (9-17/2, or * 
+ * followed by /15 for every 15).
+ * Months can be JAN-DEC and days of the week SUN-SAT (0 or 7 is Sunday). As in Vixie cron, if both 
+ * day-of-month and day-of-week are restricted, a day matches if either one matches. A field that starts
+ * with * (such as * followed by /2) is not restricted, so both must match. Times are local time.
+ * 
+ * Finding the next match skips months and days whose bits are not set, then finds the next set bit in 
+ * the hour, minute, and second masks, instead of checking each candidate time.
+ */
+class LocalTimeCronExpression {
+public:
+    /**
+     * @brief Parse a cron expression
+     * 
+     * @param expression For example "0,15,30,45 9-16 * * MON-FRI" (every 15 minutes from 9:00 AM to 4:45 PM on weekdays)
+     * @return true if the expression was parsed, false if it has an error
+     * 
+     * If false is returned, isValid() will return false and the expression never fires.
+     */
+    bool parse(const char *expression);
+
+    /**
+     * @brief Returns true if parse() succeeded
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isValid() const { return minutes != 0; };
+
+    /**
+     * @brief Returns true if the expression matches a local date (not including time)
+     * 
+     * @param ymd Local date
+     * @return true 
+     * @return false 
+     */
+    bool matchesDate(LocalTimeYMD ymd) const;
+
+    /**
+     * @brief Returns true if the expression matches a local date (not including time)
+     * 
+     * @param month Month 1 - 12
+     * @param dayOfMonth Day of the month 1 - 31
+     * @param dayOfWeek Day of the week, 0 = Sunday
+     * @return true 
+     * @return false 
+     */
+    bool matchesDate(int month, int dayOfMonth, int dayOfWeek) const;
+
+    /**
+     * @brief Find the next match after conv.time
+     * 
+     * @param conv The time to start from and the timezone configuration. Not modified.
+     * @param lookaheadDays Number of days after the local date of conv to check
+     * @param restrictions Matches on dates not valid for these restrictions are skipped
+     * @param nextTime Filled in with the next match (UTC) if true is returned
+     * @return true if a match was found
+     */
+    bool getNextOccurrence(const LocalTimeConvert &conv, int lookaheadDays, const LocalTimeRestrictedDate &restrictions, time_t &nextTime) const;
+
+    /**
+     * @brief Returns true if the expression string is the same as other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator==(const LocalTimeCronExpression &other) const {
+        return expression == other.expression;
+    }
+
+    /**
+     * @brief Returns true if this object is not equal to other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(const LocalTimeCronExpression &other) const {
+        return !(*this == other);
+    }
+
+    String expression; //!< Expression as passed to parse(), used for toJson
+    uint64_t seconds = 0; //!< Bit n set for second n (only bit 0 for 5-field expressions)
+    uint64_t minutes = 0; //!< Bit n set for minute n
+    uint32_t hours = 0; //!< Bit n set for hour n
+    uint32_t daysOfMonth = 0; //!< Bit n set for day of month n (1 - 31)
+    uint16_t months = 0; //!< Bit n set for month n (1 - 12)
+    uint8_t daysOfWeek = 0; //!< Bit n set for day of week n (0 = Sunday)
+    bool anyDayOfMonth = true; //!< Day-of-month field started with *
+    bool anyDayOfWeek = true; //!< Day-of-week field started with *
+};
+
 
 /**
  * @brief A single item in a schedule, such as minute of hour, hour of day, or a specific time.
@@ -1438,7 +1957,9 @@ public:
         HOUR_OF_DAY,            //!< Hour of day (2)
         DAY_OF_WEEK_OF_MONTH,   //!< The nth day of week of the month (3)
         DAY_OF_MONTH,           //!< Day of the month (4)
-        TIME                    //!< Specific time (5)    
+        TIME,                   //!< Specific time (5)    
+        RECURRENCE_RULE,        //!< iCalendar RRULE (6)
+        CRON                    //!< Cron expression (7)
     };
 
     /**
@@ -1487,9 +2008,69 @@ public:
     bool getNextScheduledTime(LocalTimeConvert &conv) const;
 
     /**
-     * @brief For restricted time ranges, get the last date (YMD) that this time range could be valid
+     * @brief Update the conv object to point at the next schedule item, with a specific lookahead
      * 
-     * @return LocalTimeYMD 
+     * @param conv LocalTimeConvert object, may be modified
+     * @param lookaheadDays Number of days after the date in conv to check
+     * @return true if there is an item available or false if not. if false, conv will be unchanged.
+     */
+    bool getNextScheduledTime(LocalTimeConvert &conv, int lookaheadDays) const;
+
+    /**
+     * @brief Returns true if the hours, minutes, seconds, increment, and day of week are in range for this item type
+     * 
+     * @return true 
+     * @return false 
+     * 
+     * An item that is out of range can never fire, and some out of range values (an increment of 0) would
+     * not terminate, so these items are skipped once validate() has been called.
+     */
+    bool isInRange() const;
+
+    /**
+     * @brief Check this item and set neverFires if it can never fire
+     * 
+     * @param conv The current time and timezone configuration
+     * @param horizonDays Number of days to look ahead for an occurrence
+     * @param scheduleName Name of the schedule, used in the issues
+     * @param itemIndex Index of this item in the schedule, used in the issues
+     * @param result Issues are appended to this object
+     */
+    void validate(const LocalTimeConvert &conv, int horizonDays, const char *scheduleName, int itemIndex, LocalTimeScheduleValidation &result) const;
+
+    /**
+     * @brief Get the next scheduled time, using the cached value from a previous call if it's still valid
+     * 
+     * @param conv LocalTimeConvert object with the time to start from and the timezone configuration. Not modified.
+     * @param nextTime Filled in with the next scheduled time (UTC) if true is returned
+     * @return true if there is an item available or false if not.
+     * 
+     * The cached value is used if it was calculated with the same timezone rules, from a time at or before
+     * conv.time, and the cached next time is still after conv.time. Since there are no scheduled times
+     * between the time the value was calculated from and the cached next time, it's still the next time.
+     * 
+     * Unlike getNextScheduledTime(), this does not convert the result to local time, which saves a
+     * conversion for each item when a LocalTimeSchedule with many items is checked.
+     * 
+     * If you modify the public members of this object directly, call invalidateCache() afterwards. The
+     * LocalTimeSchedule methods such as replaceItem() do this for you.
+     */
+    bool getNextScheduledTimeCached(const LocalTimeConvert &conv, time_t &nextTime) const;
+
+    /**
+     * @brief Discard the cached next scheduled time so it will be recalculated on the next call
+     * 
+     * This also clears neverFires, since the item may have been changed so it can fire.
+     */
+    void invalidateCache() const {
+        cacheNextTime = 0;
+        neverFires = false;
+    }
+
+    /**
+     * @brief For restricted time ranges, get the last date (YMD) that this time range could be valid
+     * 
+     * @return LocalTimeYMD 
      * 
      * This will return the empty date for most cases. A valid value is returned if the LocalTimeRestrictedDate
      * is used, and an only on date is set. In this case, there's as point in time where this range will 
@@ -1499,6 +2080,31 @@ public:
         return timeRange.getExpirationDate();
     }
 
+    /**
+     * @brief Returns true if this item has the same schedule settings as other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     * 
+     * The cached next scheduled time is not compared.
+     */
+    bool operator==(const LocalTimeScheduleItem &other) const {
+        return scheduleItemType == other.scheduleItemType && increment == other.increment && dayOfWeek == other.dayOfWeek &&
+            flags == other.flags && name == other.name && timeRange == other.timeRange && recurrence == other.recurrence && cron == other.cron;
+    }
+
+    /**
+     * @brief Returns true if this item is not equal to other
+     * 
+     * @param other 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(const LocalTimeScheduleItem &other) const {
+        return !(*this == other);
+    }
+
     /**
      * @brief Creates an object from JSON
      * 
@@ -1518,6 +2124,18 @@ public:
      */
     void fromJson(JSONValue jsonObj);
 
+    /**
+     * @brief Writes this item as a JSON object
+     * 
+     * @param writer The JSONWriter to write to (JSONBufferWriter, for example)
+     * 
+     * The output uses the same short keys that fromJson() accepts. TIME items are written using the tm key
+     * and other items using the m and i keys. The s and e keys are only written when they differ from the
+     * whole day, and d, f, and n are only written when set, so reading the output with fromJson() and 
+     * writing it again produces identical output.
+     */
+    void toJson(JSONWriter &writer) const;
+
 
     LocalTimeRange timeRange; //!< Range of local time, inclusive
     int increment = 0; //!< Increment value, or sometimes ordinal value
@@ -1525,6 +2143,13 @@ public:
     int flags = 0; //!< Optional scheduling flags
     String name; //!< Optional name
     ScheduleItemType scheduleItemType = ScheduleItemType::NONE; //!< The type of schedule item
+
+    LocalTimeRecurrenceRule recurrence; //!< The rule for RECURRENCE_RULE items
+    LocalTimeCronExpression cron; //!< The expression for CRON items
+    mutable time_t cacheFromTime = 0; //!< Time the cached next scheduled time was calculated from (used by getNextScheduledTimeCached)
+    mutable time_t cacheNextTime = 0; //!< Cached next scheduled time, or 0 if there is no cached value
+    mutable uint32_t cacheConfigHash = 0; //!< Hash of the timezone rules the cached value was calculated with
+    mutable bool neverFires = false; //!< Set by validate() if this item can never fire; it's then skipped by LocalTimeSchedule
 };
 
 /**
@@ -1636,6 +2261,31 @@ public:
      */
     LocalTimeSchedule &withTimes(std::initializer_list<LocalTimeHMSRestricted> timesParam);
 
+    /**
+     * @brief Adds an iCalendar recurrence rule (RRULE) to the schedule
+     * 
+     * @param dtstart Local start date and time in iCalendar format, for example "20220104T190000"
+     * @param rule The rule, for example "FREQ=WEEKLY;INTERVAL=2;BYDAY=TU"
+     * @param dateRestriction Optional date restrictions, for example except dates (EXDATE)
+     * @return LocalTimeSchedule& 
+     * 
+     * See LocalTimeRecurrenceRule for the supported subset of RRULE. If the rule can't be parsed, nothing
+     * is added. (A rule from fromJson() that can't be parsed is kept so validate() can report it.)
+     */
+    LocalTimeSchedule &withRecurrenceRule(const char *dtstart, const char *rule, LocalTimeRestrictedDate dateRestriction = LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_ALL));
+
+    /**
+     * @brief Adds a cron expression to the schedule
+     * 
+     * @param expression 5-field or 6-field cron expression in local time, for example "0 21 * * *" for 9:00 PM daily
+     * @param dateRestriction Optional date restrictions, for example except dates
+     * @return LocalTimeSchedule& 
+     * 
+     * See LocalTimeCronExpression. If the expression can't be parsed, nothing is added. (An expression from
+     * fromJson() that can't be parsed is kept so validate() can report it.)
+     */
+    LocalTimeSchedule &withCron(const char *expression, LocalTimeRestrictedDate dateRestriction = LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_ALL));
+
     /**
      * @brief Sets the name of this schedule (optional)
      * 
@@ -1674,8 +2324,129 @@ public:
      */
     void clear() {
         scheduleItems.clear();   
+        nextTimeStale = true;
     }
 
+    /**
+     * @brief Add a schedule item
+     * 
+     * @param item The item to add. It's copied.
+     * @return uint32_t CHANGE_ITEM_ADDED
+     * 
+     * The with methods such as withTime() and fromJson() use this method. Other items are not affected
+     * so their cached next scheduled times are kept.
+     */
+    uint32_t addItem(const LocalTimeScheduleItem &item);
+
+    /**
+     * @brief Remove a schedule item
+     * 
+     * @param index Index into scheduleItems
+     * @return uint32_t CHANGE_ITEM_REMOVED, or CHANGE_NONE if index is out of range
+     */
+    uint32_t removeItem(size_t index);
+
+    /**
+     * @brief Replace a schedule item, for example to shift a time
+     * 
+     * @param index Index into scheduleItems
+     * @param item The new item. It's copied.
+     * @return uint32_t CHANGE_ITEM_REPLACED, or CHANGE_NONE if index is out of range or item is the same as the existing item
+     * 
+     * Only the replaced item's next scheduled time is recalculated.
+     */
+    uint32_t replaceItem(size_t index, const LocalTimeScheduleItem &item);
+
+    /**
+     * @brief Find a schedule item that is equal to item
+     * 
+     * @param item The item to look for
+     * @return int The index into scheduleItems, or -1 if not found
+     */
+    int findItem(const LocalTimeScheduleItem &item) const;
+
+    /**
+     * @brief Add a date to the except dates of one item
+     * 
+     * @param index Index into scheduleItems
+     * @param ymd Date to exclude (local time)
+     * @return uint32_t CHANGE_DATES, or CHANGE_NONE if index is out of range or the date was already excluded
+     */
+    uint32_t addExceptDate(size_t index, LocalTimeYMD ymd);
+
+    /**
+     * @brief Add a date to the except dates of every item, for example a closure date
+     * 
+     * @param ymd Date to exclude (local time)
+     * @return uint32_t CHANGE_DATES if any item changed, otherwise CHANGE_NONE
+     */
+    uint32_t addExceptDate(LocalTimeYMD ymd);
+
+    /**
+     * @brief Remove a date from the except dates of one item
+     * 
+     * @param index Index into scheduleItems
+     * @param ymd Date to remove from the except dates list
+     * @return uint32_t CHANGE_DATES, or CHANGE_NONE if index is out of range or the date was not in the list
+     */
+    uint32_t removeExceptDate(size_t index, LocalTimeYMD ymd);
+
+    /**
+     * @brief Remove a date from the except dates of every item
+     * 
+     * @param ymd Date to remove from the except dates lists
+     * @return uint32_t CHANGE_DATES if any item changed, otherwise CHANGE_NONE
+     */
+    uint32_t removeExceptDate(LocalTimeYMD ymd);
+
+    /**
+     * @brief Add a date to the only on dates of one item
+     * 
+     * @param index Index into scheduleItems
+     * @param ymd Date to allow (local time)
+     * @return uint32_t CHANGE_DATES, or CHANGE_NONE if index is out of range or the date was already in the list
+     */
+    uint32_t addOnlyOnDate(size_t index, LocalTimeYMD ymd);
+
+    /**
+     * @brief Remove a date from the only on dates of one item
+     * 
+     * @param index Index into scheduleItems
+     * @param ymd Date to remove from the only on dates list
+     * @return uint32_t CHANGE_DATES, or CHANGE_NONE if index is out of range or the date was not in the list
+     */
+    uint32_t removeOnlyOnDate(size_t index, LocalTimeYMD ymd);
+
+    /**
+     * @brief Discard all cached next scheduled times
+     * 
+     * You only need to call this if you modify scheduleItems directly instead of using methods like
+     * replaceItem(). Changing the timezone configuration does not require this.
+     */
+    void invalidate();
+
+    /**
+     * @brief Check the items in this schedule, marking items that can never fire so they are skipped
+     * 
+     * @param conv The current time and timezone configuration
+     * @param result Issues are appended to this object
+     * @param horizonDays Number of days to look ahead for an occurrence, or 0 to use LocalTime::instance().getScheduleLookaheadDays()
+     * 
+     * Call this after building or loading the schedule. LocalTimeScheduleManager::validate() calls this for 
+     * each schedule and also checks for duplicate times across schedules.
+     */
+    void validate(const LocalTimeConvert &conv, LocalTimeScheduleValidation &result, int horizonDays = 0);
+
+    /**
+     * @brief Returns false if validate() found that no item in this schedule can ever fire
+     * 
+     * @return true 
+     * @return false 
+     * 
+     * An empty schedule also returns false.
+     */
+    bool canFire() const;
+
     /**
      * @brief Set the schedule from a JSON string containing an array of objects.
      * 
@@ -1707,6 +2478,25 @@ public:
      */
     void fromJson(JSONValue jsonArray);
 
+    /**
+     * @brief Writes this schedule as a JSON array of schedule item objects
+     * 
+     * @param writer The JSONWriter to write to (JSONBufferWriter, for example)
+     * 
+     * This is the inverse of fromJson(JSONValue). See LocalTimeScheduleItem::toJson() for the keys.
+     */
+    void toJson(JSONWriter &writer) const;
+
+    /**
+     * @brief Writes this schedule as a JSON array into a buffer
+     * 
+     * @param buf Buffer to write to. It is always null terminated if bufSize > 0.
+     * @param bufSize Size of buf in bytes
+     * @return size_t Number of bytes of JSON data, not including the null terminator. If this is >= bufSize
+     * the output was truncated.
+     */
+    size_t toJson(char *buf, size_t bufSize) const;
+
     /**
      * @brief Update the conv object to point at the next schedule item
      * 
@@ -1758,14 +2548,43 @@ public:
      */
     bool isScheduledTime(LocalTimeConvert &conv, time_t timeNow);
 
+    /**
+     * @brief Resume after a restart from the time the schedule was last checked before it
+     * 
+     * @param checkedTime The value of nextTimeFrom saved before the restart
+     * 
+     * The next isScheduledTime() calculates the next time from checkedTime instead of the current time, so
+     * a time that came due during the restart fires (once, however many were missed) and a time that
+     * already fired before the restart does not fire again. Only one next time is calculated; the
+     * times in between are not scanned. See also LocalTimeScheduleManager::restoreState().
+     */
+    void resumeFrom(time_t checkedTime);
+
+    /**
+     * @brief If the items changed or resumeFrom() was called since nextTime was calculated, recalculate
+     * it from nextTimeFrom. isScheduledTime() does this first.
+     * 
+     * @param conv Timezone configuration to use
+     */
+    void updateStaleNextTime(const LocalTimeConvert &conv);
+
     static const uint32_t FLAG_QUICK_WAKE       = 0x00000001; //!< Schedule is for quick wake
     static const uint32_t FLAG_FULL_WAKE        = 0x00000002; //!< Schedule is for full wake with publish
     // Other wake constants go here, up to 0x00000080
     static const uint32_t FLAG_ANY_WAKE         = 0x000000ff; //!< Mask for any schedule that wakes
 
+    static const uint32_t CHANGE_NONE           = 0x00000000; //!< Nothing was changed
+    static const uint32_t CHANGE_ITEM_ADDED     = 0x00000001; //!< A schedule item was added
+    static const uint32_t CHANGE_ITEM_REMOVED   = 0x00000002; //!< A schedule item was removed
+    static const uint32_t CHANGE_ITEM_REPLACED  = 0x00000004; //!< A schedule item was replaced with a different item
+    static const uint32_t CHANGE_DATES          = 0x00000008; //!< Only on dates or except dates of one or more items changed
+
     String name; //!< Name of this schedule (optional, typically used with LocalTimeScheduleManager)
     uint32_t flags = 0; //!< Flags (optional, typically used with LocalTimeScheduleManager)
     time_t nextTime = 0; //!< Optional, used with isScheduleTime()
+    time_t nextTimeFrom = 0; //!< Time that nextTime was calculated from, used with isScheduledTime()
+    bool nextTimeStale = false; //!< Items changed since nextTime was calculated; isScheduledTime() will recalculate it from nextTimeFrom
+    time_t lastFired = 0; //!< Time (UTC) passed to the last isScheduledTime() that returned true, 0 if none
     std::vector<LocalTimeScheduleItem> scheduleItems; //!< LocalTimeSchedule items
 };
 
@@ -1776,6 +2595,127 @@ public:
  */
 class LocalTimeScheduleManager {
 public:
+    /**
+     * @brief Function or lambda called by checkSchedules() for each schedule that is due
+     * 
+     * The prototype is:
+     * 
+     * void callback(LocalTimeSchedule &schedule, time_t scheduledTime)
+     * 
+     * scheduledTime is the time (UTC) the schedule was due, which can be earlier than the time passed to
+     * checkSchedules() if it was not called exactly on time.
+     */
+    typedef std::function<void(LocalTimeSchedule &schedule, time_t scheduledTime)> ScheduledCallback;
+
+    /**
+     * @brief Function or lambda called when the earliest next event of all schedules changes
+     * 
+     * The prototype is:
+     * 
+     * void callback(time_t nextTime, const LocalTimeSchedule *schedule)
+     * 
+     * nextTime is the time (UTC) of the earliest next event, or 0 if no schedule has a next time, in which case
+     * schedule is NULL.
+     */
+    typedef std::function<void(time_t nextTime, const LocalTimeSchedule *schedule)> NextEventCallback;
+
+    /**
+     * @brief Sets a function to call when the earliest next event changes
+     * 
+     * @param callback Function or lambda to call from checkSchedules()
+     * 
+     * The next event only changes when an event fires, the schedules are changed, or the timezone changes,
+     * so work done in the callback, such as formatting the time for a display, is only done then.
+     */
+    LocalTimeScheduleManager &withNextEventCallback(NextEventCallback callback) { nextEventCallback = callback; return *this; };
+
+    /**
+     * @brief Check every schedule with isScheduledTime() and update the cached next event
+     * 
+     * @param conv The current time, converted. conv.time is used as the current time.
+     * @param callback Called for each schedule that is due (optional)
+     * @return true if any schedule was due
+     * 
+     * If the global timezone configuration (LocalTime::instance().withConfig()) changed since the last call,
+     * the next time of each schedule is recalculated with the new timezone first. The next event callback
+     * is called after checking the schedules if the earliest next event changed.
+     */
+    bool checkSchedules(const LocalTimeConvert &conv, ScheduledCallback callback = nullptr);
+
+    /**
+     * @brief Get the cached earliest next event time, as of the last checkSchedules()
+     * 
+     * @return time_t Time (UTC) or 0 if no schedule has a next time
+     */
+    time_t getNextEventTime() const { return nextEventTime; };
+
+    /**
+     * @brief Get the schedule of the cached earliest next event, as of the last checkSchedules()
+     * 
+     * @return const LocalTimeSchedule* The schedule, or NULL if there is no next event. This is only
+     * valid until schedules are added.
+     */
+    const LocalTimeSchedule *getNextEventSchedule() const;
+
+    /**
+     * @brief Returns true if the cached next event may be out of date, so checkSchedules() should be called
+     * 
+     * This is true if a schedule was changed, the global timezone configuration changed, or invalidateNextEvent()
+     * was called since the last checkSchedules(). It does not do any time conversions.
+     */
+    bool isNextEventStale() const;
+
+    /**
+     * @brief Recalculate the next time of every schedule on the next checkSchedules()
+     * 
+     * This is only necessary if conv uses its own timezone configuration (not the global one) and it changed.
+     */
+    void invalidateNextEvent();
+
+    static const uint32_t STATE_MAGIC = 0x5453544c; //!< "LTST", first 4 bytes of the saveState() data
+    static const size_t STATE_HEADER_SIZE = 8; //!< Magic and number of schedules in the saveState() data
+    static const size_t STATE_ENTRY_SIZE = 12; //!< Name CRC, nextTimeFrom and lastFired for each schedule in the saveState() data
+    static const size_t STATE_CHECKSUM_SIZE = 4; //!< CRC-32 at the end of the saveState() data
+
+    /**
+     * @brief Number of bytes saveState() writes for numSchedules schedules
+     */
+    static constexpr size_t getStateSize(size_t numSchedules) { return STATE_HEADER_SIZE + numSchedules * STATE_ENTRY_SIZE + STATE_CHECKSUM_SIZE; };
+
+    /**
+     * @brief Save the time each schedule was last checked and last fired, to resume with restoreState() after a restart
+     * 
+     * @param buf Buffer to write to, for example retained memory or a block to write to flash
+     * @param bufSize Size of buf in bytes. getStateSize(schedules.size()) is enough.
+     * @return size_t Number of bytes written, or 0 if buf is too small
+     * 
+     * Each schedule takes 12 bytes: a CRC-32 of its name, LocalTimeSchedule::nextTimeFrom and
+     * LocalTimeSchedule::lastFired (32 bits each). The data is little endian, with a CRC-32 of the whole
+     * record at the end.
+     * 
+     * Save after the first checkSchedules() and after each checkSchedules() that returns true. Checks in
+     * between don't need to be saved: nothing fired, so resuming from the earlier check finds the same
+     * next times.
+     */
+    size_t saveState(uint8_t *buf, size_t bufSize) const;
+
+    /**
+     * @brief Resume the schedules from data saved by saveState() before a restart
+     * 
+     * @param buf The data saved by saveState()
+     * @param len Length of the data in bytes
+     * @param notBefore Resume no earlier than this time (UTC), to limit how old an event that came
+     * due during the restart can be and still fire. 0 for no limit.
+     * @return true if the data was valid, false if it was not (wrong magic or size, or bad checksum)
+     * and nothing was changed
+     * 
+     * Call this after adding the schedules and before the first checkSchedules(). Schedules are matched
+     * by name, so schedules can be added, removed or reordered between saving and restoring; schedules
+     * without a saved entry, and saved entries for schedules that no longer exist, are ignored. See
+     * LocalTimeSchedule::resumeFrom() for what happens on the next check.
+     */
+    bool restoreState(const uint8_t *buf, size_t len, time_t notBefore = 0);
+
     /**
      * @brief Get the next scheduled time of the schedule with name "name"
      * 
@@ -1821,6 +2761,17 @@ public:
      */
     void forEach(std::function<void(LocalTimeSchedule &schedule)> callback);
 
+    /**
+     * @brief Get the earliest nextTime of all schedules, as calculated by isScheduledTime()
+     * 
+     * @return time_t Time (UTC) or 0 if no schedule has a next time
+     * 
+     * This does not do any time conversions, so it's inexpensive to use as a deadline in loop(). 
+     * Call isScheduledTime() on each schedule when this time is reached, then call this again
+     * to get the next deadline.
+     */
+    time_t getEarliestNextTime() const;
+
     /**
      * @brief Get a LocalTimeSchedule reference by name and creates it if it does not exist
      * 
@@ -1843,7 +2794,42 @@ public:
      */
     void setFromJsonObject(const JSONValue &obj);
 
+    /**
+     * @brief Writes all schedules as a JSON object, the inverse of setFromJsonObject()
+     * 
+     * @param writer The JSONWriter to write to (JSONBufferWriter, for example)
+     * 
+     * The keys are the schedule names and the values are arrays of schedule items.
+     */
+    void toJsonObject(JSONWriter &writer) const;
+
+    /**
+     * @brief Check all schedules after building or loading them
+     * 
+     * @param conv The current time and timezone configuration
+     * @param result Filled in with the result. It's cleared first.
+     * @param horizonDays Number of days to look ahead, or 0 to use LocalTime::instance().getScheduleLookaheadDays()
+     * 
+     * Items that can never fire are marked and skipped by getNextScheduledTime() and isScheduledTime() from 
+     * then on. The times of every schedule within the horizon are also compared to find schedules that fire
+     * at the same time. This lists every time in the horizon, so it's intended to be run when the schedules
+     * change, not from loop.
+     */
+    void validate(const LocalTimeConvert &conv, LocalTimeScheduleValidation &result, int horizonDays = 0);
+
     std::vector<LocalTimeSchedule> schedules; //!< Vector of all of the schedules. Names and flags are in the schedule object
+
+protected:
+    /**
+     * @brief Find the earliest next event and call the next event callback if it changed
+     */
+    void updateNextEvent();
+
+    NextEventCallback nextEventCallback = nullptr; //!< Called when the earliest next event changes
+    time_t nextEventTime = 0; //!< Cached earliest next event time (UTC)
+    int nextEventIndex = -1; //!< Index into schedules of the cached next event, or -1
+    bool nextEventValid = false; //!< False until checkSchedules() is called and after invalidateNextEvent()
+    uint32_t nextEventConfigCount = 0; //!< LocalTime::getConfigChangeCount() when the next times were last calculated
 };
 
 /**
@@ -1873,6 +2859,16 @@ public:
      */
     LocalTimeConvert &withConfig(LocalTimePosixTimezone config) { this->config = config; return *this; };
 
+    /**
+     * @brief Sets a TZif transition table to use for time conversion instead of the config
+     * 
+     * @param zoneInfo The zone, which must exist as long as this object uses it, or nullptr to use the config
+     * 
+     * The footer rule of the zone is used for times after its last change. If you do not set a config
+     * either, the global zone set with LocalTime::withZoneInfo() is used.
+     */
+    LocalTimeConvert &withZoneInfo(const LocalTimeZoneInfo *zoneInfo) { this->zoneInfo = zoneInfo; return *this; };
+
     /**
      * @brief Sets the UTC time to begin conversion from 
      * 
@@ -1901,6 +2897,10 @@ public:
      */
     void convert();
 
+#ifdef UNITTEST
+    static std::atomic<uint32_t> convertCount; //!< Number of times convert() has been called, for counting conversions in host builds (atomic as host tests run on several threads)
+#endif
+
     /**
      * @brief Returns true if the current time is in daylight saving time
      */
@@ -1911,6 +2911,28 @@ public:
      */
     bool isStandardTime() const { return !isDST(); };
 
+    /**
+     * @brief Returns true if the local time will happen again later, because it's in the first pass
+     * through the local times that repeat when DST ends
+     * 
+     * LocalTimeValue::toUTC() returns the second pass of a repeated local time, so in the first pass the
+     * same or earlier local times still convert to later UTC times.
+     */
+    bool isRepeatedLocalTime() const;
+
+    /**
+     * @brief Converts a local time into a UTC time with the zone info or config of this object
+     * 
+     * This is LocalTimeValue::toUTC() with config, or LocalTimeZoneInfo::toUTC() if withZoneInfo() was used.
+     */
+    time_t localToUTC(const LocalTimeValue &value) const;
+
+    /**
+     * @brief The POSIX rules used when time is not covered by a transition table: the footer of the
+     * zone info if withZoneInfo() was used, otherwise config
+     */
+    const LocalTimePosixTimezone &posixRules() const { return (zoneInfo && zoneInfo->isValid()) ? zoneInfo->footer : config; };
+
     /**
      * @brief Adds a number of seconds to the current object
      * 
@@ -2242,7 +3264,7 @@ public:
      * For example, for the United States east coast, EST or EDT depending on
      * whether the current time is DST or not. See also isDST().
      * 
-     * This string comes from the LocalTimePosixTimezone object.
+     * This string comes from the LocalTimePosixTimezone object, or the LocalTimeZoneInfo if one is set.
      */
     String zoneName() const;
 
@@ -2253,6 +3275,9 @@ public:
 
     /**
      * @brief Where time is relative to DST
+     * 
+     * When the time was converted with the table of a LocalTimeZoneInfo this is IN_DST or NO_DST, and
+     * dstStart and standardStart are not set.
      */
     Position position = Position::NO_DST;
 
@@ -2264,6 +3289,17 @@ public:
      */
     LocalTimePosixTimezone config;
 
+    /**
+     * @brief TZif transition table to use instead of config, or nullptr
+     */
+    const LocalTimeZoneInfo *zoneInfo = nullptr;
+
+    /**
+     * @brief The local time type from the zoneInfo table that time was converted with, or nullptr if it
+     * was converted with config or the footer rule of zoneInfo
+     */
+    const LocalTimeZoneInfo::LocalTimeType *zoneType = nullptr;
+
     /**
      * @brief The time that is being converted. This is always Unix time at UTC
      * 
@@ -2328,13 +3364,30 @@ public:
     /**
      * @brief Sets the default global timezone configuration
      */
-    LocalTime &withConfig(LocalTimePosixTimezone config) { this->config = config; return *this; };
+    LocalTime &withConfig(LocalTimePosixTimezone config) { this->config = config; configChangeCount++; return *this; };
 
     /**
      * @brief Gets the default global timezone configuration
      */
     const LocalTimePosixTimezone &getConfig() const { return config; };
 
+    /**
+     * @brief Gets the number of times withConfig() or withZoneInfo() has been called, so cached times can tell when the timezone changed
+     */
+    uint32_t getConfigChangeCount() const { return configChangeCount; };
+
+    /**
+     * @brief Sets the default global TZif transition table, used instead of the config
+     * 
+     * @param zoneInfo The zone, which must exist as long as it's set, or nullptr to use the config
+     */
+    LocalTime &withZoneInfo(const LocalTimeZoneInfo *zoneInfo) { this->zoneInfo = zoneInfo; configChangeCount++; return *this; };
+
+    /**
+     * @brief Gets the default global TZif transition table, or nullptr if there isn't one
+     */
+    const LocalTimeZoneInfo *getZoneInfo() const { return zoneInfo; };
+
     /**
      * @brief Sets the maximum number of days to look ahead in the schedule for a match (default: 3)
      * 
@@ -2482,11 +3535,21 @@ protected:
      */
     LocalTimePosixTimezone config;
 
+    /**
+     * @brief Global default TZif transition table, or nullptr
+     */
+    const LocalTimeZoneInfo *zoneInfo = nullptr;
+
     /**
      * @brief Number of days to look forward to see if there are scheduled events. Default: 100
      */
     int scheduleLookaheadDays = 100;
 
+    /**
+     * @brief Number of times withConfig() or withZoneInfo() has been called
+     */
+    uint32_t configChangeCount = 0;
+
     /**
      * @brief Singleton instance of this class
      */
@@ -2584,5 +3647,138 @@ public:
 };
 
 
+/**
+ * @brief Index over many LocalTimeRange and LocalDateTimeRange windows for fast "which are active" checks
+ * 
+ * Checking dozens of windows (quiet hours, blackout periods, maintenance windows) with isInRange()
+ * requires a conversion and a check for each window every time. This class converts all of the 
+ * windows to UTC intervals over a horizon (7 days by default) and stores the points where the set of 
+ * active windows changes in sorted order. Finding the active windows at a time, or the next time the 
+ * set changes, is then a binary search.
+ * 
+ * A LocalTimeRange is active at a time if its date restrictions allow the local date and the local 
+ * time is in the range (inclusive), exactly as LocalTimeRange::inRange(). This includes ranges that
+ * cross midnight and the repeated hour when DST ends. A LocalDateTimeRange is active from startTime
+ * (inclusive) to endTime (exclusive), as LocalDateTimeRange::isInRange().
+ * 
+ * The index is rebuilt automatically when a time outside the horizon is checked, or after add() or
+ * clear(). Windows are identified by the index returned from add().
+ */
+class LocalTimeRangeIndex {
+public:
+    /**
+     * @brief Set the timezone configuration. If not set, LocalTime::instance().getConfig() is used.
+     * 
+     * @param config 
+     * @return LocalTimeRangeIndex& 
+     */
+    LocalTimeRangeIndex &withConfig(LocalTimePosixTimezone config) { this->config = config; invalidate(); return *this; };
+
+    /**
+     * @brief Set the number of days the index covers before it needs to be rebuilt (default: 7)
+     * 
+     * @param days 
+     * @return LocalTimeRangeIndex& 
+     */
+    LocalTimeRangeIndex &withHorizonDays(int days) { horizonDays = days; invalidate(); return *this; };
+
+    /**
+     * @brief Add a daily time range, with optional date restrictions, in local time
+     * 
+     * @param range The range to add. It's copied.
+     * @return int The window ID, used in getActive() and isActive(id, t)
+     */
+    int add(const LocalTimeRange &range);
+
+    /**
+     * @brief Add a date and time range
+     * 
+     * @param range The range to add. It's copied.
+     * @return int The window ID, used in getActive() and isActive(id, t)
+     */
+    int add(const LocalDateTimeRange &range);
+
+    /**
+     * @brief Remove all windows
+     */
+    void clear();
+
+    /**
+     * @brief Get all of the windows that are active at a time
+     * 
+     * @param t Time to check (UTC)
+     * @param ids Filled in with the IDs of the active windows, in increasing order. It's cleared first.
+     * @return size_t Number of active windows
+     * 
+     * If you reuse the same ids vector, this does not allocate memory unless the index is rebuilt.
+     */
+    size_t getActive(time_t t, std::vector<int> &ids);
+
+    /**
+     * @brief Returns true if any window is active at a time
+     * 
+     * @param t Time to check (UTC)
+     * @return true 
+     * @return false 
+     */
+    bool isActive(time_t t);
+
+    /**
+     * @brief Returns true if a specific window is active at a time
+     * 
+     * @param id Window ID returned by add()
+     * @param t Time to check (UTC)
+     * @return true 
+     * @return false 
+     */
+    bool isActive(int id, time_t t);
+
+    /**
+     * @brief Get the next time after t that the set of active windows changes
+     * 
+     * @param t Time to check (UTC)
+     * @return time_t The next time a window starts or ends (UTC), or 0 if nothing changes within the horizon
+     */
+    time_t getNextBoundary(time_t t);
+
+    /**
+     * @brief Rebuild the index to cover the horizon starting at t
+     * 
+     * @param t Start time (UTC)
+     * 
+     * This is called automatically when needed.
+     */
+    void build(time_t t);
+
+    /**
+     * @brief Discard the index, so it's rebuilt on the next check
+     */
+    void invalidate() { coverEnd = 0; };
+
+protected:
+    /**
+     * @brief Find the segment containing t, rebuilding if t is not covered
+     * 
+     * @param t Time to check (UTC)
+     * @return size_t Index into boundaries of the segment containing t
+     */
+    size_t findSegment(time_t t);
+
+    LocalTimePosixTimezone config; //!< Timezone configuration, or invalid to use the LocalTime configuration
+    int horizonDays = 7; //!< Number of days covered by the index
+    std::vector<LocalTimeRange> timeRanges; //!< Daily ranges added with add(LocalTimeRange)
+    std::vector<LocalDateTimeRange> dateTimeRanges; //!< Date time ranges added with add(LocalDateTimeRange)
+    std::vector<int> timeRangeIds; //!< Window ID for each entry in timeRanges
+    std::vector<int> dateTimeRangeIds; //!< Window ID for each entry in dateTimeRanges
+    int nextId = 0; //!< ID for the next window added
+
+    time_t coverStart = 0; //!< Start of the time covered by the index (UTC)
+    time_t coverEnd = 0; //!< End of the time covered by the index (UTC, exclusive), or 0 if it needs to be rebuilt
+    std::vector<time_t> boundaries; //!< Sorted times where the set of active windows changes
+    std::vector<uint32_t> segmentOffsets; //!< For the segment starting at each boundary, the offset into activeIds. Has one extra entry at the end.
+    std::vector<int> activeIds; //!< Active window IDs for all segments
+};
+
+
 
 #endif /* __LOCALTIMERK_H */
@@ -0,0 +1,104 @@
+#include "EventPayload.h"
+
+// Appends up to len characters of s to buf at pos, always leaving room for the null terminator.
+// Returns false if anything was truncated.
+static bool appendPayload(char *buf, size_t bufSize, size_t &pos, const char *s, size_t len) {
+    bool result = true;
+    if (pos + len >= bufSize) {
+        len = (pos + 1 < bufSize) ? (bufSize - pos - 1) : 0;
+        result = false;
+    }
+    memcpy(&buf[pos], s, len);
+    pos += len;
+    buf[pos] = 0;
+    return result;
+}
+
+size_t EventPayload::formatLogMessage(char *buf, size_t bufSize, const char *message, int deviceNum, const char *payload, int SNRhub1, int RSSIHub1) {
+    if (bufSize == 0) {
+        return 0;
+    }
+    int len = snprintf(buf, bufSize, "message=%.*s|deviceNum=%d|payload=%.*s|SNRhub1=%d|RSSIHub1=%d",
+        (int)MAX_MESSAGE_LEN, message, deviceNum, (int)MAX_PAYLOAD_LEN, payload, SNRhub1, RSSIHub1);
+    if (len < 0) {
+        buf[0] = 0;
+        return 0;
+    }
+    return ((size_t)len < bufSize) ? (size_t)len : (bufSize - 1);
+}
+
+bool EventPayload::expand(const char *tmpl, const EventPayloadContext &context, char *buf, size_t bufSize) {
+    if (bufSize == 0) {
+        return false;
+    }
+    buf[0] = 0;
+
+    bool result = true;
+    size_t pos = 0;
+
+    while(*tmpl) {
+        if (tmpl[0] == '{' && tmpl[1] == '{') {
+            result &= appendPayload(buf, bufSize, pos, "{", 1);
+            tmpl += 2;
+        }
+        else
+        if (placeholderIs(tmpl, "{name}")) {
+            size_t len = strlen(context.scheduleName);
+            if (len > MAX_NAME_LEN) {
+                len = MAX_NAME_LEN;
+            }
+            result &= appendPayload(buf, bufSize, pos, context.scheduleName, len);
+            tmpl += 6;
+        }
+        else
+        if (placeholderIs(tmpl, "{late}")) {
+            char num[MAX_INT_LEN + 1];
+            snprintf(num, sizeof(num), "%d", context.lateSeconds);
+            result &= appendPayload(buf, bufSize, pos, num, strlen(num));
+            tmpl += 6;
+        }
+        else
+        if (placeholderIs(tmpl, "{uncertainty}")) {
+            char num[MAX_INT_LEN + 1];
+            snprintf(num, sizeof(num), "%lu", (unsigned long)context.uncertaintyMs);
+            result &= appendPayload(buf, bufSize, pos, num, strlen(num));
+            tmpl += 13;
+        }
+        else
+        if (placeholderIs(tmpl, "{time}") || placeholderIs(tmpl, "{time:")) {
+            const char *end = strchr(tmpl, '}');
+            if (!end) {
+                // Not terminated, copy the rest unchanged
+                result &= appendPayload(buf, bufSize, pos, tmpl, strlen(tmpl));
+                break;
+            }
+
+            char spec[MAX_TIME_LEN + 1];
+            if (tmpl[5] == ':') {
+                size_t specLen = end - &tmpl[6];
+                if (specLen > MAX_TIME_LEN) {
+                    specLen = MAX_TIME_LEN;
+                }
+                memcpy(spec, &tmpl[6], specLen);
+                spec[specLen] = 0;
+            }
+            else {
+                strcpy(spec, "%m-%d %H:%M:%S");
+            }
+
+            char timeStr[MAX_TIME_LEN + 1];
+            size_t len = 0;
+            if (context.localTime) {
+                // strftime returns 0 if the result does not fit, so the substitution is never longer than MAX_TIME_LEN
+                len = strftime(timeStr, sizeof(timeStr), spec, context.localTime);
+            }
+            result &= appendPayload(buf, bufSize, pos, timeStr, len);
+            tmpl = end + 1;
+        }
+        else {
+            result &= appendPayload(buf, bufSize, pos, tmpl, 1);
+            tmpl++;
+        }
+    }
+    return result;
+}
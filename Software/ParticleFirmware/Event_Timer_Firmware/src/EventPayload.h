@@ -0,0 +1,153 @@
+#ifndef __EVENTPAYLOAD_H
+#define __EVENTPAYLOAD_H
+
+#include "Particle.h"
+
+/**
+ * @brief Values substituted into a payload template by EventPayload::expand()
+ */
+class EventPayloadContext {
+public:
+    const char *scheduleName = ""; //!< {name}: name of the schedule that fired
+    const struct tm *localTime = nullptr; //!< {time}: local time the event fired, for example LocalTimeConvert::localTimeValue
+    int lateSeconds = 0; //!< {late}: number of seconds after the scheduled time that the event fired
+    uint32_t uncertaintyMs = 0; //!< {uncertainty}: bound on the error of the clock when the event fired, in milliseconds (see TimeHoldover)
+};
+
+/**
+ * @brief Builds event payloads into fixed-size buffers, without allocating memory
+ *
+ * formatLogMessage() builds the LoRaHubLogging format:
+ *
+ *     message=EventTimer|deviceNum=13|payload=dummyPayload|SNRhub1=0|RSSIHub1=0
+ *
+ * The buffer is passed as an array so its size is checked against the longest possible message
+ * at compile time. The message and payload strings are truncated to MAX_MESSAGE_LEN and MAX_PAYLOAD_LEN.
+ *
+ * expand() builds a payload from a template with these substitutions:
+ *
+ * - {name} The schedule name (up to MAX_NAME_LEN characters)
+ * - {time} The local time the event fired, as "%m-%d %H:%M:%S"
+ * - {time:spec} The local time the event fired using a strftime format spec, for example {time:%I:%M%p} (up to MAX_TIME_LEN characters)
+ * - {late} The number of seconds late the event fired
+ * - {uncertainty} The bound on the error of the clock when the event fired, in milliseconds
+ * - {{ A literal {
+ *
+ * maxLength() is constexpr, so the longest possible expansion of a template literal can be checked
+ * with static_assert.
+ */
+class EventPayload {
+public:
+    static const size_t MAX_MESSAGE_LEN = 32; //!< Longest message in formatLogMessage()
+    static const size_t MAX_PAYLOAD_LEN = 64; //!< Longest payload in formatLogMessage()
+    static const size_t MAX_INT_LEN = 11; //!< Longest int, "-2147483648"
+    static const size_t MAX_NAME_LEN = 16; //!< Longest {name} substitution
+    static const size_t MAX_TIME_LEN = 32; //!< Longest {time} substitution
+
+    /**
+     * @brief Longest message from formatLogMessage(), not including the null terminator
+     */
+    static constexpr size_t MAX_LOG_MESSAGE_LEN = (sizeof("message=") - 1) + MAX_MESSAGE_LEN
+        + (sizeof("|deviceNum=") - 1) + MAX_INT_LEN
+        + (sizeof("|payload=") - 1) + MAX_PAYLOAD_LEN
+        + (sizeof("|SNRhub1=") - 1) + MAX_INT_LEN
+        + (sizeof("|RSSIHub1=") - 1) + MAX_INT_LEN;
+
+    /**
+     * @brief Format the LoRaHubLogging event data
+     *
+     * @param buf Buffer to write to. Must be at least MAX_LOG_MESSAGE_LEN + 1 bytes, checked at compile time.
+     * @param message Message (c string)
+     * @param deviceNum Device number
+     * @param payload Payload (c string)
+     * @param SNRhub1 Signal to noise ratio
+     * @param RSSIHub1 Received signal strength
+     * @return size_t Length of the message written to buf, not including the null terminator
+     */
+    template<size_t SIZE>
+    static size_t formatLogMessage(char (&buf)[SIZE], const char *message, int deviceNum, const char *payload, int SNRhub1, int RSSIHub1) {
+        static_assert(SIZE > MAX_LOG_MESSAGE_LEN, "buffer is too small for the longest log message");
+        return formatLogMessage(buf, SIZE, message, deviceNum, payload, SNRhub1, RSSIHub1);
+    }
+
+    /**
+     * @brief Format the LoRaHubLogging event data into a buffer of a size known at runtime
+     *
+     * @return size_t Length written, not including the null terminator. The result is truncated if bufSize is too small.
+     */
+    static size_t formatLogMessage(char *buf, size_t bufSize, const char *message, int deviceNum, const char *payload, int SNRhub1, int RSSIHub1);
+
+    /**
+     * @brief Expand a payload template
+     *
+     * @param tmpl Template (c string)
+     * @param context Values to substitute
+     * @param buf Buffer to write to
+     * @param bufSize Size of buf in bytes
+     * @return true if the whole expansion fit in buf, false if it was truncated
+     *
+     * Unknown {placeholders} are copied unchanged.
+     */
+    static bool expand(const char *tmpl, const EventPayloadContext &context, char *buf, size_t bufSize);
+
+    /**
+     * @brief Longest possible expansion of a template, not including the null terminator
+     *
+     * @param tmpl Template (c string)
+     * @return size_t Upper bound on the length of the result of expand()
+     */
+    static constexpr size_t maxLength(const char *tmpl) {
+        size_t len = 0;
+        while(*tmpl) {
+            if (tmpl[0] == '{' && tmpl[1] == '{') {
+                len++;
+                tmpl += 2;
+            }
+            else
+            if (tmpl[0] == '{' && placeholderIs(tmpl, "{name}")) {
+                len += MAX_NAME_LEN;
+                tmpl += 6;
+            }
+            else
+            if (tmpl[0] == '{' && placeholderIs(tmpl, "{late}")) {
+                len += MAX_INT_LEN;
+                tmpl += 6;
+            }
+            else
+            if (tmpl[0] == '{' && placeholderIs(tmpl, "{uncertainty}")) {
+                len += MAX_INT_LEN;
+                tmpl += 13;
+            }
+            else
+            if (tmpl[0] == '{' && (placeholderIs(tmpl, "{time}") || placeholderIs(tmpl, "{time:"))) {
+                len += MAX_TIME_LEN;
+                while(*tmpl && *tmpl != '}') {
+                    tmpl++;
+                }
+                if (*tmpl) {
+                    tmpl++;
+                }
+            }
+            else {
+                len++;
+                tmpl++;
+            }
+        }
+        return len;
+    }
+
+protected:
+    /**
+     * @brief Returns true if s starts with prefix
+     */
+    static constexpr bool placeholderIs(const char *s, const char *prefix) {
+        while(*prefix) {
+            if (*s++ != *prefix++) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif /* __EVENTPAYLOAD_H */
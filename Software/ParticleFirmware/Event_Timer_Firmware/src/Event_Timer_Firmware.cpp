@@ -32,6 +32,38 @@
     
     (c) 2025 by: Bob Glicksman, Jim Schrempp, Team Practicle Projects; all rights reserved.
 
+    version 1.11 Histograms of the time spent in loop(), the publish latency, the LCD write time,
+        and how late each event fired, kept in fixed memory by LoopTiming and shown as JSON in
+        the "timing" cloud variable, which is refreshed once per second.
+    version 1.10 When each schedule was last checked and last fired is saved to the emulated EEPROM
+        by ScheduleStateStore, so after a reset or power loss the schedules resume where they left
+        off: events that came due while the device was down (up to an hour before) fire once, and
+        events that already fired don't fire again.
+    version 1.09 setup() no longer waits for the cloud. The schedules run from the RTC as soon as
+        it is valid (right away after a reset) on a holdover clock, TimeHoldover, that tracks a
+        bound on its drift since the last cloud time sync and slews or steps to the synced time.
+        Events fired in holdover are queued and published once the cloud is back, with the
+        bound in the payload ("holdover:2360ms").
+    version 1.08 The next event line is cached by the schedule manager, which calls back only when
+        the next event changes (an event fired, a schedule or the timezone changed); the line is
+        only converted and formatted then.
+    version 1.07 loop() no longer writes to the LCD. It posts the frame to LcdWriter, and a separate
+        thread sends it to the panel a few bytes at a time, skipping frames that were replaced
+        before it got to them.
+    version 1.06 LiquidCrystal 0.0.4 waits for each LCD command's execution time (or the busy
+        flag, if RW is wired) instead of fixed 100 us and 5 ms delays, so redraws and begin() are faster.
+    version 1.05 The LCD is drawn through LcdFramebuffer, which only sends the characters that
+        changed, so the clock tick is usually one cursor move and one character instead of a
+        whole line.
+    version 1.04 Event payloads are formatted into stack buffers by EventPayload instead of String
+        concatenation, and schedules can have payload templates.
+    version 1.03 Events are queued in PublishOutbox and published from loop() within the cloud
+        rate limit, retried with backoff if the publish fails, instead of published synchronously.
+    version 1.02 The LED and buzzer no longer block with delay(); they are driven from loop() by
+        IndicatorEffects, so several events firing together no longer stall the loop.
+    version 1.01 loop() runs on deadlines instead of every 100 ms: the clock line is redrawn once
+        per second when the second changes, and the schedules are only checked when the next event
+        is due. The next event line is only redrawn when it changes.
     version 1.00 Initial release.
     version 0.9 Pre-release.  The code is fully functional!  It just needs all of the test related
         stuff removed and the formatting cleaned up.
@@ -47,8 +79,16 @@ SYSTEM_MODE(AUTOMATIC)
 #include <Particle.h>
 #include <LiquidCrystal.h>
 #include <LocalTimeRK.h>
+#include "IndicatorEffects.h"
+#include "PublishOutbox.h"
+#include "EventPayload.h"
+#include "LcdFramebuffer.h"
+#include "LcdWriter.h"
+#include "TimeHoldover.h"
+#include "ScheduleStateStore.h"
+#include "LoopTiming.h"
 
-#define VERSION "1.00"
+#define VERSION "1.11"
 
 // Pinout Definitions for the RFID PCB
 #define ADMIT_LED D19
@@ -59,27 +99,161 @@ SYSTEM_MODE(AUTOMATIC)
 // pinout on LCD [RS, EN, D4, D5, D6, D7];
 LiquidCrystal lcd(D11, D12, D13, D14, D5, D6);
 
+// what should be on the LCD; flush() sends only the characters that changed
+LcdFramebuffer display(lcd);
+
+// loop() posts frames here; the LCD thread draws the newest one
+LcdWriter lcdWriter(display);
+
+// bytes the LCD thread sends before yielding to loop(), about 0.25 ms without an RW pin
+const size_t LCD_BYTES_PER_SLICE = 4;
+
+// how long the LCD thread sleeps when the panel is up to date
+const unsigned long LCD_IDLE_MS = 10;
+
+Thread *lcdThread = nullptr;
+
+// clock for the schedules; runs without the cloud and absorbs time syncs without skipping or repeating events
+TimeHoldover holdover;
+
+// time (UTC) of the last cloud time sync, kept through a reset so the drift bound is known in holdover
+retained time_t lastCloudSyncTime = 0;
+
+// ask the cloud for the time when the last sync is older than this, to keep the drift bound small
+const time_t TIME_SYNC_SECONDS = 24 * 3600;
+
 // local time schedule manager
 LocalTimeScheduleManager MNScheduleManager;
 
-void logToParticle(String message, int deviceNum, String payload, int SNRhub1, int RSSIHub1) {   
-    // create a JSON string to send to the cloud
-    String data = "message=" + message
-        + "|deviceNum=" + String(deviceNum) + "|payload=" + payload 
-        + "|SNRhub1=" + String(SNRhub1) + "|RSSIHub1=" + String(RSSIHub1);
-
-    long rtn = Particle.publish("LoRaHubLogging", data, PRIVATE);
+// when each schedule was last checked and fired, kept in the emulated EEPROM so a restart resumes where it left off
+ScheduleStateStore scheduleState(MNScheduleManager);
+bool schedulesStarted = false;  // true once the schedules have been validated and resumed, when the time is first known
+
+// blinks the LEDs and beeps the buzzer without blocking loop()
+IndicatorEffects indicators;
+
+// events waiting to be published; sent from loop() at most once per second, retried if the publish fails
+PublishOutbox outbox;
+
+// result of checking the schedules in setup(), as JSON for the "validation" cloud variable
+char validationJson[256];
+
+// histograms of the time spent in loop(), publishing, drawing the LCD, and how late events fired
+LoopTiming timing;
+
+// the histograms as JSON for the "timing" cloud variable, refreshed once per second by loop()
+char timingJson[LoopTiming::MAX_JSON_LEN + 1];
+
+// deadlines for loop(); nothing is converted or redrawn between them
+time_t displayTime = 0;         // time (UTC) shown on the first line of the LCD, redrawn when the second changes
+time_t eventDeadline = 0;       // time (UTC) to check the schedules again, 0 to check them now
+time_t nextEventTime = 0;       // earliest next scheduled time of all schedules (UTC), 0 if none
+time_t lastSyncRequest = 0;     // time (UTC) of the last Particle.syncTime() request
+
+// if no schedule has a next time within the lookahead, check the schedules again after this many seconds
+const time_t EVENT_RECHECK_SECONDS = 3600;
+
+// Per-schedule payload templates, used instead of the simulated sensor message for the named schedule.
+// {name} is the schedule name, {time} or {time:strftime spec} the local time it fired, {late} the seconds late,
+// {uncertainty} the bound on the clock error in milliseconds.
+// For example: { "15", "message=EventTimer|deviceNum={name}|payload=closed {time:%I:%M%p}|SNRhub1=0|RSSIHub1=0" },
+struct PayloadTemplate {
+    const char *scheduleName;
+    const char *payloadTemplate;
+};
+constexpr PayloadTemplate payloadTemplates[] = {
+    { nullptr, nullptr }    // end of the list
+};
+
+// the longest expansion of each template must fit in an outbox entry
+constexpr bool payloadTemplatesFit(size_t index = 0) {
+    return payloadTemplates[index].scheduleName == nullptr ||
+        (EventPayload::maxLength(payloadTemplates[index].payloadTemplate) <= PublishOutboxEntry::MAX_DATA_LEN && payloadTemplatesFit(index + 1));
+}
+static_assert(payloadTemplatesFit(), "payload template can be longer than PublishOutboxEntry::MAX_DATA_LEN");
+
+void logToParticle(const char *message, int deviceNum, const char *payload, int SNRhub1, int RSSIHub1) {
+    // format the message into a stack buffer; the size is checked against the longest message at compile time
+    char data[EventPayload::MAX_LOG_MESSAGE_LEN + 1];
+    EventPayload::formatLogMessage(data, message, deviceNum, payload, SNRhub1, RSSIHub1);
+
+    outbox.enqueue("LoRaHubLogging", data);
 }  // end of LogToParticle()
 
 // function to generate a "simulated sensor" received message event to the Particle cloud
-int simulateSensor(String sensorNum) {
-    int _deviceID = sensorNum.toInt();
-    String msg = "EventTimer";
-    logToParticle(msg, _deviceID, "dummyPayload", 0, 0);
+int simulateSensor(const char *sensorNum) {
+    int _deviceID = atoi(sensorNum);
+    logToParticle("EventTimer", _deviceID, "dummyPayload", 0, 0);
 
     return 0;
 }   // end of simulatedSensor()
 
+// publish the event for a schedule that fired at conv (local time) and was scheduled for scheduledTime (UTC)
+void publishScheduleEvent(const LocalTimeSchedule &schedule, const LocalTimeConvert &conv, time_t scheduledTime) {
+    for(const PayloadTemplate *t = payloadTemplates; t->scheduleName; t++) {
+        if(schedule.name.equals(t->scheduleName)) {
+            EventPayloadContext context;
+            context.scheduleName = schedule.name.c_str();
+            context.localTime = &conv.localTimeValue;
+            context.lateSeconds = (scheduledTime != 0) ? (int)(conv.time - scheduledTime) : 0;
+            context.uncertaintyMs = holdover.getUncertaintyMs();
+
+            char data[PublishOutboxEntry::MAX_DATA_LEN + 1];
+            EventPayload::expand(t->payloadTemplate, context, data, sizeof(data));
+            outbox.enqueue("LoRaHubLogging", data);
+            return;
+        }
+    }
+
+    if(holdover.isHoldover()) {
+        // flag the event with how far off the clock may be; the outbox holds it until the cloud is back
+        char payload[EventPayload::MAX_PAYLOAD_LEN + 1];
+        snprintf(payload, sizeof(payload), "holdover:%lums", (unsigned long)holdover.getUncertaintyMs());
+        logToParticle("EventTimer", atoi(schedule.name.c_str()), payload, 0, 0);
+        return;
+    }
+    simulateSensor(schedule.name.c_str());
+}   // end of publishScheduleEvent()
+
+// LCD thread: draws the newest frame posted by loop(), a few bytes at a time. It runs at the same
+// priority as loop() (a lower priority would never run, since loop() doesn't block) and yields
+// after each slice, so an LCD redraw never holds up checking the schedules or publishing.
+void lcdThreadFunction() {
+    while(true) {
+        if(lcdWriter.service(LCD_BYTES_PER_SLICE) == 0) {
+            delay(LCD_IDLE_MS);     // up to date; sleep so loop() has the processor
+        } else {
+            os_thread_yield();
+        }
+    }
+}   // end of lcdThreadFunction()
+
+// update the second line of the LCD with the time of the next event; called by the schedule
+// manager only when the next event changes
+void updateNextEventDisplay(time_t eventTime, const LocalTimeSchedule *schedule) {
+    String msg = " -------------- ";
+    if(eventTime != 0) {
+        LocalTimeConvert conv;
+        conv.withTime(eventTime).convert();
+        msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
+    }
+    lcdWriter.setLine(1, msg.c_str());
+}   // end of updateNextEventDisplay()
+
+// called once the time is known: check the schedules for items that can never fire, for the
+// "validation" cloud variable, and resume them from the state saved before the last restart
+void startSchedules(time_t now) {
+    LocalTimeConvert validationConv;
+    validationConv.withTime(now).convert();
+
+    LocalTimeScheduleValidation validation;
+    MNScheduleManager.validate(validationConv, validation);
+    validation.toJson(validationJson, sizeof(validationJson));
+
+    scheduleState.restore(now);
+    schedulesStarted = true;
+}   // end of startSchedules()
+
 void setup() {
     Particle.variable("version", VERSION);  // make the version available to the Console
 
@@ -95,23 +269,16 @@ void setup() {
 
     // set up the LCD's number of columns and rows and clear the display
     lcd.begin(16,2);
-    lcd.clear();
-
-    // wait for the device to connect to the Internet
-    // put up blanks on the LCD display in the meantime
-    lcd.setCursor(0,0);
-    lcd.print(" -------------- ");
-    lcd.setCursor(0,1);
-    lcd.print(" -------------- ");  
-
-    // wait for the device to connect to the Internet
-    while(!Particle.connected()) {
-        delay(100);
-    }
+    display.begin();
+
+    // put up blanks on the LCD display until the time is known
+    display.setLine(0, " -------------- ");
+    display.setLine(1, " -------------- ");
+    display.flush();
 
-    // set up the current time in local time and clear the display
-    lcd.clear();
-    lcd.setCursor(0,0);
+    // don't wait for the cloud: if the RTC kept the time through a reset, the schedules start now
+    // in holdover, and the clock is corrected when the cloud syncs the time
+    holdover.begin(lastCloudSyncTime);
 
     // set up the local time (Pacific Time)
     LocalTime::instance().withConfig(LocalTimePosixTimezone("PST8PDT,M3.2.0/2:00:00,M11.1.0/2:00:00"));
@@ -148,23 +315,32 @@ void setup() {
         LocalTimeRestrictedDate(LocalTimeDayOfWeek::MASK_ALL)
     ));
 
+    // second line of the display is the time of the next event; only redrawn when it changes
+    MNScheduleManager.withNextEventCallback(updateNextEventDisplay);
+
+    // the schedules are checked for items that can never fire, and resumed from the saved state,
+    // by loop() once the time is known
+    Particle.variable("validation", validationJson);
+
+    // timing histograms; the outbox and the LCD thread record into theirs
+    outbox.withLatencyHistogram(&timing.publishLatencyMs);
+    lcdWriter.withServiceHistogram(&timing.lcdWriteMicros);
+    timing.toJson(timingJson, sizeof(timingJson));
+    Particle.variable("timing", timingJson);
+
+    // from here on only the LCD thread draws to the LCD
+    lcdThread = new Thread("lcd", lcdThreadFunction, OS_THREAD_PRIORITY_DEFAULT);
+
     // indicate that the device is ready
     digitalWrite(READY_LED, HIGH);
-    digitalWrite(BUZZER, HIGH);
-    delay(100);
-    digitalWrite(BUZZER, LOW);
-    delay(100);
-    digitalWrite(BUZZER, HIGH);
-    delay(100);
-    digitalWrite(BUZZER, LOW);
+    indicators.beep(BUZZER, 100, 100, 2);   // two short beeps, played from loop()
 
 } // end of setup()
 
-void loop() {
-  
-    // display the date and time on the lcd
+// update the first line of the LCD and the DST indicator; called once per second
+void updateClockDisplay(time_t now) {
     LocalTimeConvert conv;
-    conv.withCurrentTime().convert();
+    conv.withTime(now).convert();
 
     // set the DST indicator LED
     if(conv.isDST()) {
@@ -173,43 +349,85 @@ void loop() {
         digitalWrite(ADMIT_LED, LOW);
     }
 
-    String msg;
     // first line of display is the date
-    msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
-    lcd.setCursor(0,0);
-    lcd.print(msg);
-
-    time_t earliestTime = 0;
-    // for each schedule in the schedule manager, check if there is an event for now
-    MNScheduleManager.forEach([&](LocalTimeSchedule &schedule) {
-        if (schedule.isScheduledTime()) {
-            // Publish event if scheduled time
-            String temp = schedule.name;
-            simulateSensor(temp);
-
-            // flash the indicator LED briefly
-            digitalWrite(REJECT_LED, HIGH);
-            delay(200);
-            digitalWrite(REJECT_LED, LOW);
-        }
+    String msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
+    lcdWriter.setLine(0, msg.c_str());
+}   // end of updateClockDisplay()
+
+// fire the events that are due and update the next event time and deadline
+void checkSchedules(time_t now) {
+    LocalTimeConvert conv;
+    conv.withTime(now).convert();
+
+    // check each schedule in the schedule manager; the callback is called for each one that is due.
+    // If the next event changes, the manager calls updateNextEventDisplay() afterwards.
+    bool fired = MNScheduleManager.checkSchedules(conv, [&](LocalTimeSchedule &schedule, time_t scheduledTime) {
+        // Publish event if scheduled time
+        publishScheduleEvent(schedule, conv, scheduledTime);
 
-        // Get next scheduled event time for display on the second line of the LCD
-        conv.withCurrentTime().convert();   // set conv with the current time for next scheduled event
-        schedule.getNextScheduledTime(conv);    // update he conv object with the next scheduled time
-        time_t nextTime = conv.time;       // converts conv to a time type
-        if(earliestTime == 0) {
-            earliestTime = nextTime;
-        } else if(nextTime < earliestTime) {
-            earliestTime = nextTime; 
+        // flash the indicator LED briefly; events firing together flash one after another
+        indicators.blink(REJECT_LED, 200, 200);
+
+        if(scheduledTime != 0) {
+            timing.fireLateMs.record((uint32_t)(holdover.nowMs() - (uint64_t)scheduledTime * 1000));
         }
     });
 
-    // second line of the display is the time
-    conv.withTime(earliestTime).convert();
-    msg = conv.format("%m-%d %I:%M:%S%p"); // 08-25 10:00:00AM
-    lcd.setCursor(0,1);
-    lcd.print(msg);
+    // save when the schedules were checked and fired. Checks where nothing fired don't need saving:
+    // resuming from the earlier check finds the same next times.
+    if(fired || scheduleState.getWriteCount() == 0) {
+        scheduleState.save();
+    }
+
+    nextEventTime = MNScheduleManager.getNextEventTime();
+    if(nextEventTime != 0) {
+        eventDeadline = nextEventTime;
+    } else {
+        eventDeadline = now + EVENT_RECHECK_SECONDS;
+    }
+}   // end of checkSchedules()
+
+void loop() {
+    // time spent in loop(), recorded when it returns
+    TimingScope loopTiming(timing.loopMicros);
+
+    // advance the LED and buzzer effects
+    indicators.loop();
+
+    // advance the schedule clock; until the time is known there is nothing to show or check
+    holdover.loop();
+    if(!holdover.isValid()) {
+        return;
+    }
+    time_t now = holdover.now();
+    if(!schedulesStarted) {
+        startSchedules(now);
+    }
+
+    // keep the last sync time through a reset, and ask for the time once a day so the drift bound stays small
+    lastCloudSyncTime = holdover.getLastSyncTime();
+    if(Particle.connected() && now - lastCloudSyncTime >= TIME_SYNC_SECONDS && now - lastSyncRequest >= TIME_SYNC_SECONDS) {
+        lastSyncRequest = now;
+        Particle.syncTime();
+    }
+
+    // once per second, when the second changes, update the clock on the first line of the display
+    if(now != displayTime) {
+        displayTime = now;
+        updateClockDisplay(now);
+        timing.toJson(timingJson, sizeof(timingJson));
+    }
+
+    // when the next event is due, publish it and find the next one. Also check if the schedules or
+    // the timezone changed, which doesn't do any conversions.
+    if(eventDeadline == 0 || now >= eventDeadline || MNScheduleManager.isNextEventStale()) {
+        checkSchedules(now);
+    }
+
+    // publish queued events when the cloud rate limit allows
+    outbox.loop();
 
-    delay(100);     // wait a bit before looping back
+    // hand the frame to the LCD thread if it changed
+    lcdWriter.post();
 
 } // end of loop()
@@ -0,0 +1,173 @@
+#include "IndicatorEffects.h"
+
+bool IndicatorEffects::play(pin_t pin, uint16_t onMs, uint16_t offMs, uint8_t count, uint8_t priority) {
+    if (count == 0) {
+        return false;
+    }
+
+    // Find a free slot, or the queued effect to discard to make room for this one
+    IndicatorEffect *slot = nullptr;
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        if (effects[ii].remaining == 0) {
+            slot = &effects[ii];
+            break;
+        }
+    }
+    if (!slot) {
+        IndicatorEffect *victim = nullptr;
+        for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+            IndicatorEffect &effect = effects[ii];
+            if (!effect.playing && (!victim || effect.priority < victim->priority || (effect.priority == victim->priority && effect.seq > victim->seq))) {
+                victim = &effect;
+            }
+        }
+        if (!victim || victim->priority >= priority) {
+            return false;
+        }
+        victim->remaining = 0;
+        slot = victim;
+    }
+
+    slot->pin = pin;
+    slot->onMs = onMs;
+    slot->offMs = offMs;
+    slot->remaining = count;
+    slot->priority = priority;
+    slot->playing = false;
+    slot->pinHigh = false;
+    slot->seq = nextSeq++;
+
+    IndicatorEffect *current = findPlaying(pin);
+    if (current && current->priority < priority) {
+        // Preempt the lower priority effect; the rest of it is discarded
+        current->remaining = 0;
+        current->playing = false;
+        current = nullptr;
+    }
+    if (!current) {
+        // Pin is free, start now
+        slot->playing = true;
+        slot->pinHigh = true;
+        slot->stepStart = millis();
+        digitalWrite(pin, HIGH);
+    }
+
+    updateDeadline();
+    return true;
+}
+
+void IndicatorEffects::loop() {
+    if (!hasDeadline) {
+        return;
+    }
+    uint32_t now = millis();
+    if ((int32_t)(now - nextDeadline) < 0) {
+        return;
+    }
+
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        IndicatorEffect &effect = effects[ii];
+
+        // A zero length gap (or pulse) moves on to the next step in the same call
+        while(effect.playing) {
+            uint32_t elapsed = now - effect.stepStart;
+            if (effect.pinHigh) {
+                if (elapsed < effect.onMs) {
+                    break;
+                }
+                // End of pulse
+                effect.pinHigh = false;
+                effect.stepStart = now;
+                digitalWrite(effect.pin, LOW);
+            }
+            else {
+                if (elapsed < effect.offMs) {
+                    break;
+                }
+                // End of gap
+                if (--effect.remaining > 0) {
+                    effect.pinHigh = true;
+                    effect.stepStart = now;
+                    digitalWrite(effect.pin, HIGH);
+                }
+                else {
+                    effect.playing = false;
+                    startNext(effect.pin, now);
+                }
+            }
+        }
+    }
+
+    updateDeadline();
+}
+
+void IndicatorEffects::stopAll() {
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        IndicatorEffect &effect = effects[ii];
+        if (effect.playing) {
+            digitalWrite(effect.pin, LOW);
+        }
+        effect.remaining = 0;
+        effect.playing = false;
+    }
+    hasDeadline = false;
+}
+
+bool IndicatorEffects::isIdle() const {
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        if (effects[ii].remaining != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IndicatorEffects::isBusy(pin_t pin) const {
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        if (effects[ii].remaining != 0 && effects[ii].pin == pin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void IndicatorEffects::startNext(pin_t pin, uint32_t now) {
+    IndicatorEffect *next = nullptr;
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        IndicatorEffect &effect = effects[ii];
+        if (effect.remaining != 0 && !effect.playing && effect.pin == pin) {
+            if (!next || effect.priority > next->priority || (effect.priority == next->priority && effect.seq < next->seq)) {
+                next = &effect;
+            }
+        }
+    }
+    if (next) {
+        next->playing = true;
+        next->pinHigh = true;
+        next->stepStart = now;
+        digitalWrite(pin, HIGH);
+    }
+}
+
+IndicatorEffect *IndicatorEffects::findPlaying(pin_t pin) {
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        if (effects[ii].playing && effects[ii].pin == pin) {
+            return &effects[ii];
+        }
+    }
+    return nullptr;
+}
+
+void IndicatorEffects::updateDeadline() {
+    hasDeadline = false;
+    for(size_t ii = 0; ii < MAX_EFFECTS; ii++) {
+        const IndicatorEffect &effect = effects[ii];
+        if (effect.playing) {
+            uint32_t deadline = effect.stepStart + (effect.pinHigh ? effect.onMs : effect.offMs);
+            if (!hasDeadline || (int32_t)(deadline - nextDeadline) < 0) {
+                nextDeadline = deadline;
+                hasDeadline = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef __INDICATOREFFECTS_H
+#define __INDICATOREFFECTS_H
+
+#include "Particle.h"
+
+/**
+ * @brief One queued or playing effect: a number of pulses on an LED or buzzer pin
+ */
+class IndicatorEffect {
+public:
+    pin_t pin = 0; //!< Pin to drive HIGH during each pulse
+    uint16_t onMs = 0; //!< Length of each pulse in milliseconds
+    uint16_t offMs = 0; //!< Time LOW after each pulse in milliseconds, including after the last one
+    uint8_t remaining = 0; //!< Number of pulses left, including the current one. 0 if this slot is free.
+    uint8_t priority = 0; //!< Larger values preempt smaller ones on the same pin
+    bool playing = false; //!< True if this effect is driving the pin; false if it's waiting in the queue
+    bool pinHigh = false; //!< True during a pulse, false during the gap after it
+    uint32_t seq = 0; //!< Order added, so effects of the same priority play first in, first out
+    uint32_t stepStart = 0; //!< millis() value when the current pulse or gap started
+};
+
+/**
+ * @brief Non-blocking blink and beep patterns for the indicator LEDs and the buzzer
+ *
+ * Effects are added with play(), blink(), or beep(), which return immediately. Call loop() from
+ * the main loop to advance them; it only writes a pin when a pulse starts or ends.
+ *
+ * Each pin plays one effect at a time. Additional effects for the same pin wait in the queue and
+ * play in priority order, then in the order they were added. An effect with a higher priority than
+ * the one playing on its pin stops it (the rest of it is discarded) and starts immediately.
+ *
+ * There is a fixed number of slots for effects, shared by all pins, so no memory is allocated.
+ */
+class IndicatorEffects {
+public:
+    /**
+     * @brief Add an effect
+     *
+     * @param pin Pin to drive (must already be set to OUTPUT)
+     * @param onMs Length of each pulse in milliseconds
+     * @param offMs Time LOW after each pulse in milliseconds. This also separates this effect from the next one on the same pin.
+     * @param count Number of pulses
+     * @param priority Larger values preempt smaller ones on the same pin (default: 0)
+     * @return true if the effect was added, false if count is 0 or all slots are in use by effects of the same or higher priority
+     *
+     * If all slots are in use, the queued effect with the lowest priority (most recently added first)
+     * is discarded to make room, if its priority is lower than this one.
+     */
+    bool play(pin_t pin, uint16_t onMs, uint16_t offMs, uint8_t count, uint8_t priority = 0);
+
+    /**
+     * @brief Turn on an LED for onMs, count times, with offMs between. Same as play().
+     */
+    bool blink(pin_t pin, uint16_t onMs, uint16_t offMs = 0, uint8_t count = 1, uint8_t priority = 0) { return play(pin, onMs, offMs, count, priority); };
+
+    /**
+     * @brief Sound the buzzer for onMs, count times, with offMs between. Same as play().
+     */
+    bool beep(pin_t pin, uint16_t onMs, uint16_t offMs = 0, uint8_t count = 1, uint8_t priority = 0) { return play(pin, onMs, offMs, count, priority); };
+
+    /**
+     * @brief Advance the effects. Call this from loop().
+     *
+     * This only does work when a pulse starts or ends; otherwise it compares millis() to the next deadline and returns.
+     */
+    void loop();
+
+    /**
+     * @brief Stop all effects and set their pins LOW
+     */
+    void stopAll();
+
+    /**
+     * @brief Returns true if no effects are playing or queued
+     */
+    bool isIdle() const;
+
+    /**
+     * @brief Returns true if an effect is playing or queued for pin
+     */
+    bool isBusy(pin_t pin) const;
+
+    static const size_t MAX_EFFECTS = 8; //!< Number of slots for playing and queued effects, shared by all pins
+
+protected:
+    /**
+     * @brief Start the next queued effect for pin, if there is one
+     */
+    void startNext(pin_t pin, uint32_t now);
+
+    /**
+     * @brief Returns the playing effect for pin, or nullptr
+     */
+    IndicatorEffect *findPlaying(pin_t pin);
+
+    /**
+     * @brief Recalculate nextDeadline from the playing effects
+     */
+    void updateDeadline();
+
+    IndicatorEffect effects[MAX_EFFECTS]; //!< Slots for playing and queued effects
+    uint32_t nextSeq = 0; //!< Value of seq for the next effect added
+    uint32_t nextDeadline = 0; //!< millis() value when loop() next has work to do
+    bool hasDeadline = false; //!< True if nextDeadline is set; false when idle
+};
+
+#endif /* __INDICATOREFFECTS_H */
@@ -0,0 +1,115 @@
+#include "LcdFramebuffer.h"
+
+// DDRAM address of the start of each line, the same as LiquidCrystal::setCursor()
+static const uint8_t rowOffsets[LcdFramebuffer::ROWS] = { 0x00, 0x40 };
+
+LcdFramebuffer::LcdFramebuffer(LiquidCrystal &lcd) : lcd(lcd) {
+    memset(frame, ' ', sizeof(frame));
+    memset(shown, ' ', sizeof(shown));
+}
+
+void LcdFramebuffer::begin() {
+    lcd.clear();
+
+    // clear() fills the panel with spaces and moves the address counter to 0
+    memset(frame, ' ', sizeof(frame));
+    memset(shown, ' ', sizeof(shown));
+    shownValid = true;
+    dirty = false;
+    cursorAddr = 0;
+}
+
+bool LcdFramebuffer::setLine(uint8_t row, const char *text) {
+    if (row >= ROWS) {
+        return false;
+    }
+    char line[COLS];
+    size_t len = strlen(text);
+    if (len > COLS) {
+        len = COLS;
+    }
+    memcpy(line, text, len);
+    memset(&line[len], ' ', COLS - len);
+
+    if (memcmp(frame[row], line, COLS) == 0) {
+        return false;
+    }
+    memcpy(frame[row], line, COLS);
+    dirty = true;
+    return true;
+}
+
+bool LcdFramebuffer::setText(uint8_t col, uint8_t row, const char *text) {
+    if (row >= ROWS || col >= COLS) {
+        return false;
+    }
+    size_t len = strlen(text);
+    if (len > (size_t)(COLS - col)) {
+        len = COLS - col;
+    }
+    if (memcmp(&frame[row][col], text, len) == 0) {
+        return false;
+    }
+    memcpy(&frame[row][col], text, len);
+    dirty = true;
+    return true;
+}
+
+void LcdFramebuffer::clear() {
+    memset(frame, ' ', sizeof(frame));
+    dirty = true;
+}
+
+size_t LcdFramebuffer::flush(size_t maxBytes) {
+    if (!dirty) {
+        return 0;
+    }
+
+    if (!shownValid) {
+        // Mark every cell as different from the frame, so a partial flush can resume from shown
+        for(uint8_t row = 0; row < ROWS; row++) {
+            for(uint8_t col = 0; col < COLS; col++) {
+                shown[row][col] = ~frame[row][col];
+            }
+        }
+        shownValid = true;
+    }
+
+    size_t bytes = 0;
+    bool finished = true;
+    for(uint8_t row = 0; row < ROWS && finished; row++) {
+        for(uint8_t col = 0; col < COLS; col++) {
+            char c = frame[row][col];
+            if (shown[row][col] == c) {
+                continue;
+            }
+            int addr = rowOffsets[row] + col;
+            size_t needed = (addr != cursorAddr) ? 2 : 1;
+            if (bytes + needed > maxBytes) {
+                finished = false;
+                break;
+            }
+            if (addr != cursorAddr) {
+                lcd.setCursor(col, row);
+            }
+            lcd.write((uint8_t)c);
+            bytes += needed;
+            shown[row][col] = c;
+            cursorAddr = addr + 1;
+        }
+    }
+    dirty = !finished;
+
+    if (bytes) {
+        lastFrameBytes = bytes;
+        totalBytes += bytes;
+        frameCount++;
+    }
+    return bytes;
+}
+
+void LcdFramebuffer::invalidate() {
+    shownValid = false;
+    dirty = true;
+    cursorAddr = -1;
+}
@@ -0,0 +1,114 @@
+#ifndef __LCDFRAMEBUFFER_H
+#define __LCDFRAMEBUFFER_H
+
+#include "Particle.h"
+
+#include <LiquidCrystal.h>
+
+/**
+ * @brief Shadow framebuffer for the 16x2 LCD that only sends the characters that changed
+ *
+ * setLine() and setText() only write to the frame in RAM. flush() compares the frame to a copy
+ * of what the panel is showing and sends just the cells that differ. The panel's address counter
+ * moves right after each character, so a run of changed cells is sent with one setCursor()
+ * followed by the characters; setCursor() is only sent when the next changed cell is not the
+ * one the address counter is already on.
+ *
+ * Each command or character is one byte on the bus (two nibbles in 4-bit mode). When only the
+ * seconds digit of the clock changes, a frame is 2 bytes instead of the 17 it takes to redraw
+ * the line.
+ *
+ * All drawing to the LCD should go through this class after begin(), otherwise the copy of
+ * the panel is wrong; call invalidate() after drawing directly to force a full redraw.
+ */
+class LcdFramebuffer {
+public:
+    static const uint8_t COLS = 16; //!< Characters per line
+    static const uint8_t ROWS = 2; //!< Lines
+
+    /**
+     * @brief Draw to an LCD. lcd.begin() must be called before begin().
+     */
+    LcdFramebuffer(LiquidCrystal &lcd);
+
+    /**
+     * @brief Clear the panel and the frame. Call once from setup(), after lcd.begin().
+     */
+    void begin();
+
+    /**
+     * @brief Set a whole line of the frame
+     *
+     * @param row 0 or 1
+     * @param text Text (c string). Padded with spaces or truncated to COLS characters.
+     * @return true if the frame changed
+     */
+    bool setLine(uint8_t row, const char *text);
+
+    /**
+     * @brief Set part of a line of the frame, leaving the rest of the line unchanged
+     *
+     * @param col Starting column, 0 - 15
+     * @param row 0 or 1
+     * @param text Text (c string). Truncated at the end of the line.
+     * @return true if the frame changed
+     */
+    bool setText(uint8_t col, uint8_t row, const char *text);
+
+    /**
+     * @brief Set the whole frame to spaces
+     */
+    void clear();
+
+    /**
+     * @brief Get a line of the frame (not null terminated, COLS characters)
+     */
+    const char *getLine(uint8_t row) const { return frame[row]; };
+
+    /**
+     * @brief Returns true if the frame has changes that have not been sent by flush()
+     */
+    bool isDirty() const { return dirty; };
+
+    /**
+     * @brief Send the cells that changed since the last flush() to the LCD
+     *
+     * @param maxBytes Stop after sending this many bytes (default: no limit). The rest of the
+     * changes are sent by the next call, so a frame can be sent a few bytes at a time.
+     * @return size_t Number of bytes sent (commands and characters), 0 if nothing changed
+     */
+    size_t flush(size_t maxBytes = SIZE_MAX);
+
+    /**
+     * @brief Forget what the panel shows, so the next flush() redraws every cell
+     */
+    void invalidate();
+
+    /**
+     * @brief Number of bytes sent by the last flush() that sent anything
+     */
+    size_t getLastFrameBytes() const { return lastFrameBytes; };
+
+    /**
+     * @brief Number of bytes sent by all flush() calls since construction
+     */
+    uint32_t getTotalBytes() const { return totalBytes; };
+
+    /**
+     * @brief Number of flush() calls that sent anything since construction
+     */
+    uint32_t getFrameCount() const { return frameCount; };
+
+protected:
+    LiquidCrystal &lcd;
+    char frame[ROWS][COLS]; //!< What should be on the panel
+    char shown[ROWS][COLS]; //!< What the panel is showing
+    bool shownValid = false; //!< False if shown is unknown and every cell must be sent
+    bool dirty = true; //!< True if frame may differ from shown
+    int cursorAddr = -1; //!< DDRAM address the panel's address counter is on, -1 if unknown
+    size_t lastFrameBytes = 0;
+    uint32_t totalBytes = 0;
+    uint32_t frameCount = 0;
+};
+
+#endif /* __LCDFRAMEBUFFER_H */
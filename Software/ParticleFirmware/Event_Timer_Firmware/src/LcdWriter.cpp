@@ -0,0 +1,93 @@
+#include "LcdWriter.h"
+
+//
+// LcdFrame
+//
+LcdFrame::LcdFrame() {
+    for(uint8_t row = 0; row < LcdFramebuffer::ROWS; row++) {
+        memset(text[row], ' ', LcdFramebuffer::COLS);
+        text[row][LcdFramebuffer::COLS] = 0;
+    }
+}
+
+bool LcdFrame::setLine(uint8_t row, const char *line) {
+    if (row >= LcdFramebuffer::ROWS) {
+        return false;
+    }
+    char padded[LcdFramebuffer::COLS];
+    size_t len = strlen(line);
+    if (len > LcdFramebuffer::COLS) {
+        len = LcdFramebuffer::COLS;
+    }
+    memcpy(padded, line, len);
+    memset(&padded[len], ' ', LcdFramebuffer::COLS - len);
+
+    if (memcmp(text[row], padded, LcdFramebuffer::COLS) == 0) {
+        return false;
+    }
+    memcpy(text[row], padded, LcdFramebuffer::COLS);
+    return true;
+}
+
+//
+// LcdFrameQueue
+//
+bool LcdFrameQueue::post(const LcdFrame &frame) {
+    buffers[back] = frame;
+
+    // Publish the filled buffer and take back the one it replaces
+    uint8_t prev = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+    back = prev & INDEX_MASK;
+    return (prev & FRESH) != 0;
+}
+
+const LcdFrame *LcdFrameQueue::take() {
+    if ((middle.load(std::memory_order_acquire) & FRESH) == 0) {
+        return nullptr;
+    }
+    uint8_t prev = middle.exchange(front, std::memory_order_acq_rel);
+    front = prev & INDEX_MASK;
+    return &buffers[front];
+}
+
+//
+// LcdWriter
+//
+bool LcdWriter::setLine(uint8_t row, const char *text) {
+    bool changed = staged.setLine(row, text);
+    stagedChanged |= changed;
+    return changed;
+}
+
+bool LcdWriter::post() {
+    if (!stagedChanged) {
+        return false;
+    }
+    stagedChanged = false;
+
+    if (queue.post(staged)) {
+        stats.collapsed++;
+    }
+    stats.posted++;
+    return true;
+}
+
+size_t LcdWriter::service(size_t maxBytes) {
+    uint32_t startMicros = serviceHistogram ? micros() : 0;
+
+    const LcdFrame *frame = queue.take();
+    if (frame) {
+        // Newest frame replaces whatever is still being sent; cells already on the panel are not resent
+        for(uint8_t row = 0; row < LcdFramebuffer::ROWS; row++) {
+            framebuffer.setLine(row, frame->text[row]);
+        }
+        stats.taken++;
+    }
+
+    size_t bytes = framebuffer.flush(maxBytes);
+    stats.bytes += bytes;
+    if (serviceHistogram && bytes != 0) {
+        serviceHistogram->record(micros() - startMicros);
+    }
+    return bytes;
+}
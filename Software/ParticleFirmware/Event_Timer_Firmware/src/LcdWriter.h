@@ -0,0 +1,146 @@
+#ifndef __LCDWRITER_H
+#define __LCDWRITER_H
+
+#include "Particle.h"
+#include "LcdFramebuffer.h"
+#include "LoopTiming.h"
+
+#include <atomic>
+
+/**
+ * @brief A complete frame for the 16x2 LCD, posted to LcdWriter
+ */
+class LcdFrame {
+public:
+    LcdFrame();
+
+    /**
+     * @brief Set a line. Padded with spaces or truncated to LcdFramebuffer::COLS characters.
+     *
+     * @return true if the line changed
+     */
+    bool setLine(uint8_t row, const char *text);
+
+    char text[LcdFramebuffer::ROWS][LcdFramebuffer::COLS + 1]; //!< Each line as a c string
+};
+
+/**
+ * @brief Lock-free single-producer, single-consumer mailbox for LCD frames that keeps only the newest
+ *
+ * A triple buffer: the producer copies a frame into its own buffer and swaps it with the shared
+ * middle buffer; the consumer swaps its buffer with the middle one when there is a new frame. A
+ * frame that is replaced before the consumer takes it is discarded, so the consumer always draws
+ * the newest frame and never waits for the ones in between.
+ *
+ * post() must only be called from one thread and take() from one other thread. Neither blocks
+ * or allocates memory.
+ */
+class LcdFrameQueue {
+public:
+    /**
+     * @brief Copy a frame into the mailbox, replacing any frame the consumer has not taken yet
+     *
+     * @return true if an untaken frame was replaced
+     */
+    bool post(const LcdFrame &frame);
+
+    /**
+     * @brief Get the newest frame, if there is one the consumer has not taken yet
+     *
+     * @return The frame, which stays valid until the next call to take(), or nullptr if there is no new frame
+     */
+    const LcdFrame *take();
+
+    /**
+     * @brief Returns true if there is a frame the consumer has not taken
+     */
+    bool hasFrame() const { return (middle.load(std::memory_order_acquire) & FRESH) != 0; };
+
+protected:
+    static const uint8_t INDEX_MASK = 0x03; //!< Buffer index in middle
+    static const uint8_t FRESH = 0x04; //!< Set in middle when the middle buffer has not been taken
+
+    LcdFrame buffers[3];
+    std::atomic<uint8_t> middle{2}; //!< Index of the shared buffer, and FRESH
+    uint8_t back = 0; //!< Producer's buffer
+    uint8_t front = 1; //!< Consumer's buffer
+};
+
+/**
+ * @brief Counters for LcdWriter
+ */
+class LcdWriterStats {
+public:
+    uint32_t posted = 0; //!< Frames posted (producer side)
+    uint32_t collapsed = 0; //!< Frames replaced by a newer one before the worker took them (producer side)
+    uint32_t taken = 0; //!< Frames taken by the worker (worker side)
+    uint32_t bytes = 0; //!< Bytes sent to the LCD (worker side)
+};
+
+/**
+ * @brief Draws the LCD from a worker so writing to the panel never holds up loop()
+ *
+ * loop() builds the frame with setLine() and calls post(), which copies it into an LcdFrameQueue
+ * if it changed, and returns without touching the LCD. The worker calls service(), which takes
+ * the newest frame and sends the cells that differ from the panel through LcdFramebuffer, a few
+ * bytes per call. If a newer frame arrives while one is being sent, the worker moves on to it,
+ * so only the newest frame is ever finished.
+ *
+ * On the device the worker is a thread (see Event_Timer_Firmware.cpp); in the host tests
+ * service() is called directly. After begin(), only the worker may use the LcdFramebuffer.
+ */
+class LcdWriter {
+public:
+    /**
+     * @brief Write through a framebuffer. The framebuffer's begin() must be called before the worker starts.
+     */
+    LcdWriter(LcdFramebuffer &framebuffer) : framebuffer(framebuffer) {};
+
+    /**
+     * @brief Also record the time of each service() call that sends something in a histogram, in
+     * microseconds (default: none). The histogram is recorded by the worker and can be read by another thread.
+     */
+    LcdWriter &withServiceHistogram(SharedTimingHistogram *histogram) { serviceHistogram = histogram; return *this; };
+
+    /**
+     * @brief Set a line of the frame to post (producer side)
+     *
+     * @return true if the line changed
+     */
+    bool setLine(uint8_t row, const char *text);
+
+    /**
+     * @brief Post the frame if setLine() changed it since the last post (producer side)
+     *
+     * @return true if a frame was posted
+     */
+    bool post();
+
+    /**
+     * @brief Take the newest frame and send up to maxBytes of it to the LCD (worker side)
+     *
+     * @param maxBytes Bytes to send before returning (default: the whole frame)
+     * @return size_t Bytes sent; 0 when the panel is up to date with the newest frame
+     */
+    size_t service(size_t maxBytes = SIZE_MAX);
+
+    /**
+     * @brief Returns true if the worker has nothing to send (worker side)
+     */
+    bool isIdle() const { return !queue.hasFrame() && !framebuffer.isDirty(); };
+
+    /**
+     * @brief Get the counters. The producer and worker side counters are each written by one thread.
+     */
+    const LcdWriterStats &getStats() const { return stats; };
+
+protected:
+    LcdFramebuffer &framebuffer;
+    LcdFrameQueue queue;
+    LcdFrame staged; //!< Frame being built by setLine() (producer side)
+    bool stagedChanged = false;
+    LcdWriterStats stats;
+    SharedTimingHistogram *serviceHistogram = nullptr; //!< Histogram of the service() time, or nullptr
+};
+
+#endif /* __LCDWRITER_H */
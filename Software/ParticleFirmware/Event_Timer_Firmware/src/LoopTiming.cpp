@@ -0,0 +1,92 @@
+#include "LoopTiming.h"
+
+//
+// TimingHistogram
+//
+void TimingHistogram::record(uint32_t value) {
+    buckets[bucketFor(value)]++;
+    count++;
+    total += value;
+    if (value > max) {
+        max = value;
+    }
+}
+
+void TimingHistogram::clear() {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    max = 0;
+    total = 0;
+}
+
+void TimingHistogram::toJson(JSONWriter &writer, bool withBuckets) const {
+    writer.beginObject();
+    writer.name("n").value((unsigned int)count);
+    writer.name("max").value((unsigned int)max);
+    writer.name("sum").value((unsigned long long)total);
+    if (withBuckets) {
+        size_t used = BUCKETS;
+        while(used > 0 && buckets[used - 1] == 0) {
+            used--;
+        }
+        writer.name("b").beginArray();
+        for(size_t ii = 0; ii < used; ii++) {
+            writer.value((unsigned int)buckets[ii]);
+        }
+        writer.endArray();
+    }
+    writer.endObject();
+}
+
+//
+// SharedTimingHistogram
+//
+void SharedTimingHistogram::record(uint32_t value) {
+    recording.record(value);
+    buffers[back] = recording;
+
+    // Publish the filled buffer and take back the one it replaces
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+const TimingHistogram &SharedTimingHistogram::read() {
+    if ((middle.load(std::memory_order_acquire) & FRESH) != 0) {
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+    return buffers[front];
+}
+
+//
+// LoopTiming
+//
+size_t LoopTiming::toJson(char *buf, size_t bufSize) {
+    if (bufSize == 0) {
+        return 0;
+    }
+
+    const TimingHistogram &lcdWrite = lcdWriteMicros.read();
+
+    size_t size = 0;
+    for(int withBuckets = 1; withBuckets >= 0; withBuckets--) {
+        // Leave room for the null terminator, which JSONBufferWriter does not add
+        JSONBufferWriter writer(buf, bufSize - 1);
+        writer.beginObject();
+        writer.name("loop_us");
+        loopMicros.toJson(writer, withBuckets);
+        writer.name("publish_ms");
+        publishLatencyMs.toJson(writer, withBuckets);
+        writer.name("lcd_us");
+        lcdWrite.toJson(writer, withBuckets);
+        writer.name("late_ms");
+        fireLateMs.toJson(writer, withBuckets);
+        writer.endObject();
+
+        size = writer.dataSize();
+        if (size < bufSize) {
+            break;
+        }
+    }
+    buf[(size < bufSize) ? size : (bufSize - 1)] = 0;
+
+    return size;
+}
@@ -0,0 +1,155 @@
+#ifndef __LOOPTIMING_H
+#define __LOOPTIMING_H
+
+#include "Particle.h"
+
+#include <atomic>
+
+/**
+ * @brief Histogram of durations in fixed memory, with power-of-two buckets
+ *
+ * Bucket 0 counts durations of 0, bucket n those from 2^(n-1) to 2^n - 1, and the last bucket
+ * everything from 2^(BUCKETS - 2) up. record() takes the same few instructions for any value and
+ * never allocates, so it can be called from the hot paths. The units are up to the caller.
+ *
+ * Only one thread may call record(); another thread reading the counters may see a recording that
+ * is partly done.
+ */
+class TimingHistogram {
+public:
+    static const size_t BUCKETS = 16; //!< Number of buckets, the last one open-ended
+
+    /**
+     * @brief Count a duration
+     */
+    void record(uint32_t value);
+
+    /**
+     * @brief Reset all of the counters
+     */
+    void clear();
+
+    /**
+     * @brief Bucket that counts a duration
+     */
+    static size_t bucketFor(uint32_t value) {
+        size_t bucket = (value == 0) ? 0 : (size_t)(32 - __builtin_clz(value));
+        return (bucket < BUCKETS) ? bucket : (BUCKETS - 1);
+    };
+
+    /**
+     * @brief Number of durations recorded
+     */
+    uint32_t getCount() const { return count; };
+
+    /**
+     * @brief Largest duration recorded, 0 if none
+     */
+    uint32_t getMax() const { return max; };
+
+    /**
+     * @brief Sum of the durations recorded, for the average
+     */
+    uint64_t getTotal() const { return total; };
+
+    /**
+     * @brief Number of durations counted in a bucket
+     */
+    uint32_t getBucket(size_t bucket) const { return (bucket < BUCKETS) ? buckets[bucket] : 0; };
+
+    /**
+     * @brief Write as a JSON object: {"n":count,"max":max,"sum":total,"b":[bucket 0, bucket 1, ...]}
+     *
+     * @param withBuckets false to leave out "b", to make it shorter. The empty buckets after the
+     * last one used are always left out.
+     */
+    void toJson(JSONWriter &writer, bool withBuckets = true) const;
+
+protected:
+    uint32_t buckets[BUCKETS] = {};
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint64_t total = 0;
+};
+
+/**
+ * @brief A TimingHistogram recorded by one thread and read by another
+ *
+ * record() counts into the recording thread's own histogram and then publishes a copy of it through
+ * a lock-free triple buffer, like LcdFrameQueue. read() returns the newest complete copy, so the
+ * reading thread never sees a recording that is partly done. Neither blocks or allocates memory.
+ *
+ * record() must only be called from one thread and read() from one other thread.
+ */
+class SharedTimingHistogram {
+public:
+    /**
+     * @brief Count a duration (recording thread)
+     */
+    void record(uint32_t value);
+
+    /**
+     * @brief Get the newest copy published by record() (reading thread)
+     *
+     * @return The histogram, which stays valid until the next call to read()
+     */
+    const TimingHistogram &read();
+
+protected:
+    static const uint8_t INDEX_MASK = 0x03; //!< Buffer index in middle
+    static const uint8_t FRESH = 0x04; //!< Set in middle when the middle buffer has not been read
+
+    TimingHistogram recording; //!< Running counts (recording thread)
+    TimingHistogram buffers[3];
+    std::atomic<uint8_t> middle{2}; //!< Index of the shared buffer, and FRESH
+    uint8_t back = 0; //!< Recording thread's buffer
+    uint8_t front = 1; //!< Reading thread's buffer
+};
+
+/**
+ * @brief Records the microseconds from its construction to the end of its scope in a histogram
+ */
+class TimingScope {
+public:
+    TimingScope(TimingHistogram &histogram) : histogram(histogram), startMicros(micros()) {};
+    ~TimingScope() { histogram.record(micros() - startMicros); };
+
+protected:
+    TimingHistogram &histogram;
+    uint32_t startMicros;
+};
+
+/**
+ * @brief Timing of the firmware's hot paths, for the "timing" cloud variable
+ *
+ * The firmware records loopMicros and fireLateMs itself, and passes publishLatencyMs to
+ * PublishOutbox::withLatencyHistogram() and lcdWriteMicros to LcdWriter::withServiceHistogram().
+ * lcdWriteMicros is recorded by the LCD thread, so it is a SharedTimingHistogram; toJson() shows
+ * the newest copy the LCD thread has published. The others are recorded by loop().
+ */
+class LoopTiming {
+public:
+    /**
+     * @brief Longest JSON for a Particle.variable string, not including the null terminator
+     */
+    static const size_t MAX_JSON_LEN = 622;
+
+    /**
+     * @brief Write all of the histograms as JSON, without allocating memory. Call this from loop().
+     *
+     * {"loop_us":{...},"publish_ms":{...},"lcd_us":{...},"late_ms":{...}}, each histogram as in
+     * TimingHistogram::toJson(). If that doesn't fit, the buckets are left out.
+     *
+     * @param buf Buffer to write to, which is always null terminated
+     * @param bufSize Size of buf, normally MAX_JSON_LEN + 1
+     * @return size_t Length of the JSON, not including the null terminator
+     */
+    size_t toJson(char *buf, size_t bufSize);
+
+    TimingHistogram loopMicros; //!< Time spent in each loop(), in microseconds
+    TimingHistogram publishLatencyMs; //!< Time from PublishOutbox::enqueue() to a successful publish, in milliseconds
+    SharedTimingHistogram lcdWriteMicros; //!< Time for each LcdWriter::service() call that sent something, in microseconds
+    TimingHistogram fireLateMs; //!< Time from the scheduled time of an event to when it fired, in milliseconds
+};
+
+#endif /* __LOOPTIMING_H */
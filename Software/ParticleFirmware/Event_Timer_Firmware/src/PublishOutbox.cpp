@@ -0,0 +1,122 @@
+#include "PublishOutbox.h"
+
+PublishOutbox::PublishOutbox() {
+    publisher = [](const char *eventName, const char *data) {
+        return Particle.publish(eventName, data, PRIVATE);
+    };
+    connectedCheck = []() {
+        return Particle.connected();
+    };
+}
+
+bool PublishOutbox::enqueue(const char *eventName, const char *data) {
+    if (strlen(eventName) > PublishOutboxEntry::MAX_EVENT_NAME_LEN || strlen(data) > PublishOutboxEntry::MAX_DATA_LEN) {
+        stats.droppedTooLong++;
+        return false;
+    }
+
+    bool result = true;
+    if (count == CAPACITY) {
+        // Full, discard the oldest. Its publish, if in progress, is no longer waited for.
+        publishing = false;
+        head = (head + 1) % CAPACITY;
+        count--;
+        stats.droppedFull++;
+        result = false;
+    }
+
+    PublishOutboxEntry &entry = entries[(head + count) % CAPACITY];
+    strcpy(entry.eventName, eventName);
+    strcpy(entry.data, data);
+    entry.enqueuedMillis = millis();
+    entry.retryMillis = 0;
+    entry.attempts = 0;
+    count++;
+
+    stats.enqueued++;
+    if (count > stats.maxDepth) {
+        stats.maxDepth = count;
+    }
+    return result;
+}
+
+void PublishOutbox::loop() {
+    if (publishing) {
+        if (!pendingPublish.isDone()) {
+            // Still waiting for the cloud
+            return;
+        }
+        publishing = false;
+        finishAttempt(pendingPublish.isSucceeded() && pendingPublish.result());
+        return;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t now = millis();
+    PublishOutboxEntry &entry = entries[head];
+
+    if (attempted && (now - lastAttemptMillis) < minIntervalMs) {
+        // Rate limit
+        return;
+    }
+    if (entry.attempts != 0 && (int32_t)(now - entry.retryMillis) < 0) {
+        // Backoff after a failed attempt
+        return;
+    }
+    if (!connectedCheck()) {
+        // Not counted as an attempt; publish after reconnecting
+        return;
+    }
+
+    attempted = true;
+    lastAttemptMillis = now;
+
+    pendingPublish = publisher(entry.eventName, entry.data);
+    publishing = true;
+    if (pendingPublish.isDone()) {
+        // Finished without waiting, for example failed because the cloud just disconnected
+        publishing = false;
+        finishAttempt(pendingPublish.isSucceeded() && pendingPublish.result());
+    }
+}
+
+void PublishOutbox::finishAttempt(bool succeeded) {
+    PublishOutboxEntry &entry = entries[head];
+    uint32_t now = millis();
+
+    if (succeeded) {
+        uint32_t latency = now - entry.enqueuedMillis;
+        stats.published++;
+        stats.lastLatencyMs = latency;
+        stats.totalLatencyMs += latency;
+        if (latency > stats.maxLatencyMs) {
+            stats.maxLatencyMs = latency;
+        }
+        if (latencyHistogram) {
+            latencyHistogram->record(latency);
+        }
+    }
+    else {
+        stats.failedAttempts++;
+        entry.attempts++;
+        if (maxAttempts == 0 || entry.attempts < maxAttempts) {
+            // Try the same event again after the backoff, so events stay in order
+            uint32_t backoff = retryMs;
+            for(uint16_t ii = 1; ii < entry.attempts && backoff < maxRetryMs; ii++) {
+                backoff *= 2;
+            }
+            if (backoff > maxRetryMs) {
+                backoff = maxRetryMs;
+            }
+            entry.retryMillis = now + backoff;
+            return;
+        }
+        stats.droppedRetries++;
+    }
+
+    head = (head + 1) % CAPACITY;
+    count--;
+}
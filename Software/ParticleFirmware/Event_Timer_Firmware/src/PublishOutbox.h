@@ -0,0 +1,173 @@
+#ifndef __PUBLISHOUTBOX_H
+#define __PUBLISHOUTBOX_H
+
+#include "Particle.h"
+#include "LoopTiming.h"
+
+#include <functional>
+
+/**
+ * @brief One event waiting in the outbox
+ */
+class PublishOutboxEntry {
+public:
+    static const size_t MAX_EVENT_NAME_LEN = 64; //!< Maximum event name length, not including the null terminator
+    static const size_t MAX_DATA_LEN = 255; //!< Maximum event data length, not including the null terminator
+
+    char eventName[MAX_EVENT_NAME_LEN + 1]; //!< Event name (c string)
+    char data[MAX_DATA_LEN + 1]; //!< Event data (c string)
+    uint32_t enqueuedMillis; //!< millis() value when enqueue() was called, for the latency counters
+    uint32_t retryMillis; //!< millis() value to try again after a failed publish
+    uint16_t attempts; //!< Number of failed publish attempts so far
+};
+
+/**
+ * @brief Counters for PublishOutbox
+ */
+class PublishOutboxStats {
+public:
+    uint32_t enqueued = 0; //!< Events added by enqueue()
+    uint32_t published = 0; //!< Events published successfully
+    uint32_t failedAttempts = 0; //!< Publish attempts that failed (the event is retried)
+    uint32_t droppedFull = 0; //!< Oldest events discarded because the outbox was full
+    uint32_t droppedRetries = 0; //!< Events discarded after maxAttempts failed attempts
+    uint32_t droppedTooLong = 0; //!< Events rejected by enqueue() because the name or data was too long
+    uint32_t maxDepth = 0; //!< Largest number of events waiting at once
+    uint32_t lastLatencyMs = 0; //!< Time from enqueue() to successful publish for the last event published
+    uint32_t maxLatencyMs = 0; //!< Largest time from enqueue() to successful publish
+    uint64_t totalLatencyMs = 0; //!< Sum of the time from enqueue() to successful publish, for the average
+};
+
+/**
+ * @brief Fixed-capacity queue of events to publish, sent from loop() within the cloud publish rate limit
+ *
+ * enqueue() copies the event into a ring buffer and returns immediately. loop() starts publishing the
+ * oldest event when the rate limit (one publish per second by default) allows and the cloud is connected.
+ * It doesn't wait for the cloud to acknowledge the publish; later calls to loop() check the Future the
+ * publisher returned, and start the next publish only after it's done. If the publish fails, the same
+ * event is tried again after a backoff that doubles with each failure, so events are published in order.
+ * Events queued while disconnected are published after reconnecting.
+ *
+ * When the outbox is full, enqueue() discards the oldest event to make room for the new one. If that
+ * event is being published, the publish isn't waited for and it is counted as dropped, not published.
+ *
+ * The publisher is Particle.publish() with PRIVATE by default. It can be replaced with withPublisher(),
+ * for example by a stand-in in host tests.
+ */
+class PublishOutbox {
+public:
+    /**
+     * @brief Function that starts publishing an event, returning a Future that succeeds with true when
+     * the event has been published
+     */
+    typedef std::function<particle::Future<bool>(const char *eventName, const char *data)> Publisher;
+
+    /**
+     * @brief Function that returns true if the cloud is connected
+     */
+    typedef std::function<bool()> ConnectedCheck;
+
+    PublishOutbox();
+
+    /**
+     * @brief Replace the function that publishes events (default: Particle.publish with PRIVATE)
+     */
+    PublishOutbox &withPublisher(Publisher publisher) { this->publisher = publisher; return *this; };
+
+    /**
+     * @brief Replace the function that checks for a cloud connection (default: Particle.connected)
+     */
+    PublishOutbox &withConnectedCheck(ConnectedCheck connectedCheck) { this->connectedCheck = connectedCheck; return *this; };
+
+    /**
+     * @brief Minimum time between publish attempts in milliseconds (default: 1000)
+     */
+    PublishOutbox &withMinIntervalMs(uint32_t ms) { minIntervalMs = ms; return *this; };
+
+    /**
+     * @brief Backoff after the first failed attempt, doubled after each additional failure, up to maxRetryMs (default: 1000)
+     */
+    PublishOutbox &withRetryMs(uint32_t retryMs, uint32_t maxRetryMs = 60000) { this->retryMs = retryMs; this->maxRetryMs = maxRetryMs; return *this; };
+
+    /**
+     * @brief Number of failed attempts after which an event is discarded, or 0 to retry forever (default: 10)
+     */
+    PublishOutbox &withMaxAttempts(uint16_t maxAttempts) { this->maxAttempts = maxAttempts; return *this; };
+
+    /**
+     * @brief Also record the time from enqueue() to each successful publish in a histogram, in milliseconds (default: none)
+     */
+    PublishOutbox &withLatencyHistogram(TimingHistogram *histogram) { latencyHistogram = histogram; return *this; };
+
+    /**
+     * @brief Add an event to publish
+     *
+     * @param eventName Event name (c string), up to PublishOutboxEntry::MAX_EVENT_NAME_LEN characters
+     * @param data Event data (c string), up to PublishOutboxEntry::MAX_DATA_LEN characters
+     * @return true if added without discarding anything, false if the oldest event was discarded to
+     * make room or the event was rejected because the name or data was too long
+     */
+    bool enqueue(const char *eventName, const char *data);
+
+    /**
+     * @brief Check on the publish in progress, or start publishing the next event if it's allowed now.
+     * Call this from loop().
+     *
+     * This never waits for the cloud. At most one publish attempt is started per call, and none while
+     * one is in progress.
+     */
+    void loop();
+
+    /**
+     * @brief Number of events waiting to be published
+     */
+    size_t getDepth() const { return count; };
+
+    /**
+     * @brief Returns true if no events are waiting
+     */
+    bool isEmpty() const { return count == 0; };
+
+    /**
+     * @brief Returns true if the oldest event is being published and loop() is waiting for the result
+     */
+    bool isPublishing() const { return publishing; };
+
+    /**
+     * @brief Get the counters
+     */
+    const PublishOutboxStats &getStats() const { return stats; };
+
+    /**
+     * @brief Discard all waiting events. The counters are not reset.
+     */
+    void clear() { head = count = 0; publishing = false; };
+
+    static const size_t CAPACITY = 8; //!< Maximum number of events waiting
+
+protected:
+    PublishOutboxEntry entries[CAPACITY]; //!< Ring buffer of waiting events
+    size_t head = 0; //!< Index of the oldest event in entries
+    size_t count = 0; //!< Number of events in entries
+
+    Publisher publisher; //!< Function that publishes an event
+    ConnectedCheck connectedCheck; //!< Function that checks the cloud connection
+    uint32_t minIntervalMs = 1000; //!< Minimum time between publish attempts
+    uint32_t retryMs = 1000; //!< Backoff after the first failed attempt
+    uint32_t maxRetryMs = 60000; //!< Largest backoff
+    uint16_t maxAttempts = 10; //!< Failed attempts before an event is discarded, 0 for no limit
+    uint32_t lastAttemptMillis = 0; //!< millis() value of the last publish attempt
+    bool attempted = false; //!< True if there has been a publish attempt, so lastAttemptMillis is valid
+    particle::Future<bool> pendingPublish; //!< Result of the publish in progress, if publishing
+    bool publishing = false; //!< True if entries[head] is being published
+
+    /**
+     * @brief Count the result of the publish attempt for entries[head], removing it unless it will be retried
+     */
+    void finishAttempt(bool succeeded);
+
+    PublishOutboxStats stats; //!< Counters
+    TimingHistogram *latencyHistogram = nullptr; //!< Histogram of the publish latency, or nullptr
+};
+
+#endif /* __PUBLISHOUTBOX_H */
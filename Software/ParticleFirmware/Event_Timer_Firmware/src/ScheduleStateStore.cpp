@@ -0,0 +1,32 @@
+#include "ScheduleStateStore.h"
+
+bool ScheduleStateStore::restore(time_t now) {
+    EEPROM.get(address, saved);
+
+    if (!manager.restoreState(saved, sizeof(saved), now - catchUpSeconds)) {
+        savedLen = 0;
+        return false;
+    }
+    savedLen = LocalTimeScheduleManager::getStateSize(manager.schedules.size());
+    return true;
+}
+
+bool ScheduleStateStore::save() {
+    uint8_t state[MAX_STATE_SIZE];
+    size_t len = manager.saveState(state, sizeof(state));
+    if (len == 0) {
+        // more than MAX_SCHEDULES schedules
+        return false;
+    }
+    if (len == savedLen && memcmp(state, saved, len) == 0) {
+        return false;
+    }
+
+    for(size_t ii = 0; ii < len; ii++) {
+        EEPROM.write(address + ii, state[ii]);
+    }
+    memcpy(saved, state, len);
+    savedLen = len;
+    writeCount++;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef __SCHEDULESTATESTORE_H
+#define __SCHEDULESTATESTORE_H
+
+#include "Particle.h"
+
+#include <LocalTimeRK.h>
+
+/**
+ * @brief Keeps the schedule manager's state in the emulated EEPROM, so a reset or power loss resumes
+ * where it left off
+ *
+ * The state is LocalTimeScheduleManager::saveState(): for each schedule, the time it was last checked
+ * and last fired, 12 bytes per schedule plus 12 bytes of header and checksum. After a restart,
+ * restore() makes the next check fire the events that came due while the device was down (once
+ * per schedule), and not fire again the ones that fired before it.
+ *
+ * The EEPROM is emulated in flash, so it survives a power loss, unlike retained memory on the
+ * Photon 2. To keep flash writes to a few a day, call save() after the first check and after each
+ * check that fired an event; it only writes if the state changed. In the host tests the fake
+ * EEPROM is kept in a file.
+ */
+class ScheduleStateStore {
+public:
+    static const size_t MAX_SCHEDULES = 8; //!< Most schedules that can be saved
+    static const size_t MAX_STATE_SIZE = LocalTimeScheduleManager::getStateSize(MAX_SCHEDULES); //!< Bytes of EEPROM used
+
+    /**
+     * @brief Store the state of a schedule manager at an EEPROM address
+     */
+    ScheduleStateStore(LocalTimeScheduleManager &manager, int address = 0) : manager(manager), address(address) {};
+
+    /**
+     * @brief Events that came due longer than this before restore() don't fire (default: 3600)
+     */
+    ScheduleStateStore &withCatchUpSeconds(time_t seconds) { catchUpSeconds = seconds; return *this; };
+
+    /**
+     * @brief Resume the schedules from the saved state. Call once the time is valid, after adding
+     * the schedules and before the first LocalTimeScheduleManager::checkSchedules().
+     *
+     * @param now Current time (UTC)
+     * @return true if there was a valid saved state, false if the EEPROM was blank or corrupt (the
+     * schedules then start from now)
+     */
+    bool restore(time_t now);
+
+    /**
+     * @brief Save the state if it changed since it was last saved or restored. Call after the first
+     * LocalTimeScheduleManager::checkSchedules() and after each one that returns true.
+     *
+     * @return true if the EEPROM was written
+     */
+    bool save();
+
+    /**
+     * @brief Number of times save() wrote the EEPROM
+     */
+    uint32_t getWriteCount() const { return writeCount; };
+
+protected:
+    LocalTimeScheduleManager &manager;
+    int address;
+    time_t catchUpSeconds = 3600;
+    uint8_t saved[MAX_STATE_SIZE]; //!< What is in the EEPROM, valid if savedLen is not 0
+    size_t savedLen = 0;
+    uint32_t writeCount = 0;
+};
+
+#endif /* __SCHEDULESTATESTORE_H */
@@ -0,0 +1,114 @@
+#include "TimeHoldover.h"
+
+void TimeHoldover::begin(time_t lastSyncTime) {
+    this->lastSyncTime = lastSyncTime;
+    syncedMillis = Particle.timeSyncedLast();
+
+    if (Time.isValid()) {
+        setFromRtc();
+
+        if (syncedMillis != 0) {
+            // The cloud already synced the time since boot, before setup() got here
+            synced = true;
+            this->lastSyncTime = Time.now() - (time_t)((millis() - syncedMillis) / 1000);
+        }
+    }
+}
+
+void TimeHoldover::loop() {
+    if (!valid) {
+        if (!Time.isValid()) {
+            return;
+        }
+        setFromRtc();
+    }
+
+    uint32_t nowMillis = millis();
+    uint32_t elapsed = nowMillis - lastMillis;
+    lastMillis = nowMillis;
+    clockMs += elapsed;
+
+    if (pendingSlewMs != 0) {
+        // slewAccum is in thousandths of a millisecond, so short loops still add up
+        slewAccum += (uint64_t)elapsed * slewMsPerSecond;
+        int32_t adjust = (int32_t)(slewAccum / 1000);
+        slewAccum %= 1000;
+
+        if (pendingSlewMs > 0) {
+            if (adjust > pendingSlewMs) {
+                adjust = pendingSlewMs;
+            }
+            clockMs += adjust;
+            pendingSlewMs -= adjust;
+        }
+        else {
+            if (adjust > -pendingSlewMs) {
+                adjust = -pendingSlewMs;
+            }
+            clockMs -= adjust;
+            pendingSlewMs += adjust;
+        }
+    }
+
+    uint32_t syncMillis = Particle.timeSyncedLast();
+    if (syncMillis != syncedMillis) {
+        syncedMillis = syncMillis;
+        handleSync();
+    }
+}
+
+uint32_t TimeHoldover::getUncertaintyMs() const {
+    uint64_t sinceMs;
+    uint64_t result;
+    if (lastSyncTime != 0) {
+        time_t t = now();
+        sinceMs = (t > lastSyncTime) ? (uint64_t)(t - lastSyncTime) * 1000 : 0;
+        result = 0;
+    }
+    else {
+        sinceMs = clockMs - holdoverStartMs;
+        result = unknownSyncMs;
+    }
+    result += sinceMs * driftPpm / 1000000;
+    result += (pendingSlewMs >= 0) ? pendingSlewMs : -pendingSlewMs;
+
+    return (result < UINT32_MAX) ? (uint32_t)result : UINT32_MAX;
+}
+
+void TimeHoldover::setFromRtc() {
+    time_t rtc = Time.now();
+    if (lastSyncTime > rtc) {
+        lastSyncTime = 0;
+    }
+    clockMs = (uint64_t)rtc * 1000;
+    holdoverStartMs = clockMs;
+    lastMillis = millis();
+    valid = true;
+}
+
+void TimeHoldover::handleSync() {
+    time_t rtc = Time.now();
+    synced = true;
+    lastSyncTime = rtc;
+
+    // The RTC only has whole seconds, so the synced time is somewhere in its second. A clock in that
+    // second is not corrected; one outside it is corrected to the start of the second, never past
+    // it, so the clock doesn't get ahead of the cloud's time and fire a schedule early.
+    int64_t errorMs = (int64_t)rtc * 1000 - (int64_t)clockMs;
+    if (errorMs <= 0 && errorMs > -1000) {
+        lastSyncErrorMs = 0;
+        pendingSlewMs = 0;
+        return;
+    }
+    lastSyncErrorMs = (int32_t)errorMs;
+
+    if (errorMs >= -(int64_t)maxSlewMs && errorMs <= (int64_t)maxSlewMs) {
+        pendingSlewMs = (int32_t)errorMs;
+        slewAccum = 0;
+    }
+    else {
+        clockMs = (uint64_t)((int64_t)clockMs + errorMs);
+        pendingSlewMs = 0;
+        stepCount++;
+    }
+}
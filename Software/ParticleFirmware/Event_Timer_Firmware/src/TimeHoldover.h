@@ -0,0 +1,141 @@
+#ifndef __TIMEHOLDOVER_H
+#define __TIMEHOLDOVER_H
+
+#include "Particle.h"
+
+/**
+ * @brief Clock for the schedules that keeps running without the cloud and absorbs time syncs
+ *
+ * The clock starts from the RTC as soon as Time.isValid() is true, which after a reset is right
+ * away since the RTC keeps running, so the schedules do not wait for Wi-Fi and the cloud. It then
+ * runs on millis(), ignoring the RTC, until the cloud syncs the time.
+ *
+ * Until the first sync after begin(), and from then on while the cloud is disconnected, the clock
+ * is in holdover: its error is only known to be within a bound that grows with the time since the
+ * last sync, at driftPpm plus a fixed error when there has not been a sync since begin() and no
+ * last sync time was saved.
+ *
+ * When Particle.timeSyncedLast() shows a new sync, the RTC is compared to this clock. The RTC only
+ * has whole seconds, so a clock within the RTC's second is left alone, and the error of one outside
+ * it is measured to the start of the second, so a correction never puts the clock ahead:
+ *
+ * - An error up to maxSlewMs is slewed out: the clock runs faster or slower by slewMsPerSecond until
+ *   it matches the RTC, so it never jumps and never goes backwards, and no event is skipped or
+ *   fired twice.
+ * - A larger error is stepped: the clock jumps to the RTC. After a step forward, events in the
+ *   skipped interval are due and fire late on the next check (catch-up); after a step backward,
+ *   the next times were already computed from the later time, so nothing fires twice.
+ *
+ * Call loop() from every loop() and use now() instead of Time.now() for the schedules.
+ */
+class TimeHoldover {
+public:
+    /**
+     * @brief Worst case frequency error of the clock in parts per million (default: 100)
+     */
+    TimeHoldover &withDriftPpm(uint32_t ppm) { driftPpm = ppm; return *this; };
+
+    /**
+     * @brief Largest error that is slewed instead of stepped, in milliseconds (default: 10000)
+     */
+    TimeHoldover &withMaxSlewMs(uint32_t ms) { maxSlewMs = ms; return *this; };
+
+    /**
+     * @brief Milliseconds of correction per second while slewing (default: 100, so 10 seconds take 100 seconds)
+     */
+    TimeHoldover &withSlewMsPerSecond(uint32_t ms) { slewMsPerSecond = ms; return *this; };
+
+    /**
+     * @brief Error bound when the time of the last sync is unknown, in milliseconds (default: 2000)
+     */
+    TimeHoldover &withUnknownSyncMs(uint32_t ms) { unknownSyncMs = ms; return *this; };
+
+    /**
+     * @brief Start the clock. Call from setup().
+     *
+     * @param lastSyncTime Time (UTC) of the last cloud sync before the reset, for example from
+     * retained memory, or 0 if unknown. Ignored if it is later than the RTC.
+     */
+    void begin(time_t lastSyncTime = 0);
+
+    /**
+     * @brief Advance the clock and check for a time sync. Call from every loop().
+     */
+    void loop();
+
+    /**
+     * @brief Returns true once the clock has been set from a valid RTC
+     */
+    bool isValid() const { return valid; };
+
+    /**
+     * @brief Current time (UTC) for the schedules
+     */
+    time_t now() const { return (time_t)(clockMs / 1000); };
+
+    /**
+     * @brief Current time (UTC) for the schedules in milliseconds
+     */
+    uint64_t nowMs() const { return clockMs; };
+
+    /**
+     * @brief Returns true if the time has not been synced since begin() or the cloud is disconnected
+     */
+    bool isHoldover() const { return !synced || !Particle.connected(); };
+
+    /**
+     * @brief Bound on the error of now() in milliseconds: the drift since the last sync, plus the
+     * correction still being slewed
+     */
+    uint32_t getUncertaintyMs() const;
+
+    /**
+     * @brief Time (UTC) of the last cloud sync, 0 if unknown. Save this in retained memory to pass to begin() after a reset.
+     */
+    time_t getLastSyncTime() const { return lastSyncTime; };
+
+    /**
+     * @brief Correction not yet slewed in milliseconds; positive if the clock is behind the RTC
+     */
+    int32_t getPendingSlewMs() const { return pendingSlewMs; };
+
+    /**
+     * @brief Number of syncs whose error was too large to slew
+     */
+    uint32_t getStepCount() const { return stepCount; };
+
+    /**
+     * @brief Error found by the last sync in milliseconds; positive if the clock was behind the RTC
+     */
+    int32_t getLastSyncErrorMs() const { return lastSyncErrorMs; };
+
+protected:
+    /**
+     * @brief Set the clock from the RTC
+     */
+    void setFromRtc();
+
+    /**
+     * @brief Compare the clock to the RTC after a sync, and slew or step
+     */
+    void handleSync();
+
+    uint32_t driftPpm = 100;
+    uint32_t maxSlewMs = 10000;
+    uint32_t slewMsPerSecond = 100;
+    uint32_t unknownSyncMs = 2000;
+
+    bool valid = false;
+    bool synced = false; //!< True once there has been a sync since begin()
+    uint64_t clockMs = 0; //!< The clock (UTC) in milliseconds
+    uint32_t lastMillis = 0; //!< millis() when clockMs was last advanced
+    uint32_t syncedMillis = 0; //!< Particle.timeSyncedLast() when last checked
+    time_t lastSyncTime = 0; //!< Time (UTC) of the last sync, 0 if unknown
+    uint64_t holdoverStartMs = 0; //!< clockMs when the drift started counting if lastSyncTime is unknown
+    int32_t pendingSlewMs = 0;
+    uint64_t slewAccum = 0; //!< Slew earned but not yet applied, in thousandths of a millisecond
+    int32_t lastSyncErrorMs = 0;
+    uint32_t stepCount = 0;
+};
+
+#endif /* __TIMEHOLDOVER_H */